@@ -0,0 +1,110 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FILE_COUNT 16
+#define FILE_BLOCKS 32
+#define ROUNDS 4
+#define WORKER_COUNT 8
+
+/* This benchmark reads FILE_COUNT files (each with a single tfs_read) from
+ * one thread, first synchronously and then through an asynchronous ring that
+ * keeps all the reads in flight. The files do not fit in the block cache, so
+ * each read pays the simulated storage delay, which the ring's workers can
+ * overlap when there are spare cores. Readahead is disabled.
+ *
+ * Keep the simulated storage delay, but build without the thread sanitizer:
+ *   make clean && make bench TSAN=no */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *buffers[FILE_COUNT];
+static int handles[FILE_COUNT];
+
+static void open_all(void) {
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "/f%d", i);
+        handles[i] = tfs_open(name, 0);
+        assert(handles[i] != -1);
+    }
+}
+
+static void close_all(void) {
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_close(handles[i]) != -1);
+    }
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.readahead_blocks = 0;
+    assert(tfs_init(&params) != -1);
+
+    size_t file_size = FILE_BLOCKS * params.block_size;
+    for (int i = 0; i < FILE_COUNT; i++) {
+        buffers[i] = malloc(file_size);
+        assert(buffers[i] != NULL);
+        memset(buffers[i], 'A', file_size);
+        char name[16];
+        snprintf(name, sizeof(name), "/f%d", i);
+        int f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffers[i], file_size) == file_size);
+        assert(tfs_close(f) != -1);
+    }
+
+    double start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        open_all();
+        for (int i = 0; i < FILE_COUNT; i++) {
+            assert(tfs_read(handles[i], buffers[i], file_size) == file_size);
+        }
+        close_all();
+    }
+    double sync_elapsed = now() - start;
+
+    tfs_ring_t *ring = tfs_ring_create(FILE_COUNT, WORKER_COUNT);
+    assert(ring != NULL);
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        open_all();
+        tfs_request_t requests[FILE_COUNT];
+        for (int i = 0; i < FILE_COUNT; i++) {
+            requests[i] = (tfs_request_t){.op = TFS_OP_READ,
+                                          .fhandle = handles[i],
+                                          .buffer = buffers[i],
+                                          .len = file_size};
+        }
+        assert(tfs_ring_submit(ring, requests, FILE_COUNT) == FILE_COUNT);
+        tfs_completion_t completions[FILE_COUNT];
+        assert(tfs_ring_reap(ring, completions, FILE_COUNT, FILE_COUNT) ==
+               FILE_COUNT);
+        for (int i = 0; i < FILE_COUNT; i++) {
+            assert(completions[i].result == file_size);
+        }
+        close_all();
+    }
+    double async_elapsed = now() - start;
+    tfs_ring_destroy(ring);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        free(buffers[i]);
+    }
+    assert(tfs_destroy() != -1);
+
+    double mib = (double)(ROUNDS * FILE_COUNT * file_size) / (1024 * 1024);
+    printf("%d files of %d blocks read %d times\n", FILE_COUNT, FILE_BLOCKS,
+           ROUNDS);
+    printf("synchronous:      %.1f MiB/s\n", mib / sync_elapsed);
+    printf("ring, %d workers: %.1f MiB/s\n", WORKER_COUNT,
+           mib / async_elapsed);
+    return 0;
+}
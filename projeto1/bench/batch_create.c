@@ -0,0 +1,69 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#define FILE_COUNT 1000
+#define ROUNDS 5
+
+/* This benchmark creates and then deletes FILE_COUNT files in the root
+ * directory, one by one (tfs_open with TFS_O_CREAT, tfs_unlink) and in a
+ * single batch (tfs_create_many, tfs_unlink_many).
+ *
+ * Build without the thread sanitizer and the simulated storage delay:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static char name_storage[FILE_COUNT][16];
+static char const *names[FILE_COUNT];
+static int results[FILE_COUNT];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = 64 * 1024; // room for FILE_COUNT directory entries
+    params.max_block_count = 16;
+    params.max_inode_count = FILE_COUNT + 1;
+    assert(tfs_init(&params) != -1);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(name_storage[i], sizeof(name_storage[i]), "/box%d", i);
+        names[i] = name_storage[i];
+    }
+
+    double create_one = 0, unlink_one = 0, create_many = 0, unlink_many = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now();
+        for (int i = 0; i < FILE_COUNT; i++) {
+            int f = tfs_open(names[i], TFS_O_CREAT);
+            assert(f != -1);
+            assert(tfs_close(f) != -1);
+        }
+        create_one += now() - start;
+        start = now();
+        for (int i = 0; i < FILE_COUNT; i++) {
+            assert(tfs_unlink(names[i]) != -1);
+        }
+        unlink_one += now() - start;
+
+        start = now();
+        assert(tfs_create_many(names, FILE_COUNT, results) != -1);
+        create_many += now() - start;
+        start = now();
+        assert(tfs_unlink_many(names, FILE_COUNT, results) != -1);
+        unlink_many += now() - start;
+    }
+    assert(tfs_destroy() != -1);
+
+    double ops = ROUNDS * FILE_COUNT;
+    printf("%d files, %d rounds\n", FILE_COUNT, ROUNDS);
+    printf("one by one: %.0f creates/s, %.0f unlinks/s\n", ops / create_one,
+           ops / unlink_one);
+    printf("batched:    %.0f creates/s, %.0f unlinks/s\n", ops / create_many,
+           ops / unlink_many);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILE_COUNT 1000
+#define FILE_SIZE (32 * 1024)
+
+/* This benchmark imports FILE_COUNT host files with tfs_bulk_import, on an
+ * increasing number of workers, and reports the aggregate throughput. The
+ * host files are written right before, so they are read from the page cache.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static char source_dir[] = "/tmp/tfs_benchXXXXXX";
+static char source_paths[FILE_COUNT][64];
+static char dest_paths[FILE_COUNT][16];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main() {
+    // one root directory block must hold all the files
+    tfs_params params = tfs_default_params();
+    params.block_size = 64 * 1024;
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 64;
+
+    assert(mkdtemp(source_dir) != NULL);
+    char contents[FILE_SIZE];
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+    tfs_import_t imports[FILE_COUNT];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(source_paths[i], sizeof(source_paths[i]), "%s/file%d",
+                 source_dir, i);
+        snprintf(dest_paths[i], sizeof(dest_paths[i]), "/file%d", i);
+        imports[i].source_path = source_paths[i];
+        imports[i].dest_path = dest_paths[i];
+
+        FILE *file = fopen(source_paths[i], "w");
+        assert(file != NULL);
+        assert(fwrite(contents, 1, sizeof(contents), file) ==
+               sizeof(contents));
+        assert(fclose(file) == 0);
+    }
+
+    printf("%d files of %d KiB\n", FILE_COUNT, FILE_SIZE / 1024);
+    size_t worker_counts[] = {1, 2, 4, 8};
+    for (size_t w = 0; w < sizeof(worker_counts) / sizeof(size_t); w++) {
+        assert(tfs_init(&params) != -1);
+        double start = now();
+        assert(tfs_bulk_import(imports, FILE_COUNT, worker_counts[w]) == 0);
+        double elapsed = now() - start;
+        assert(tfs_destroy() != -1);
+
+        printf("workers: %zu  %8.0f files/s  %8.1f MiB/s\n", worker_counts[w],
+               FILE_COUNT / elapsed,
+               (double)FILE_COUNT * FILE_SIZE / (1024 * 1024) / elapsed);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        unlink(source_paths[i]);
+    }
+    assert(rmdir(source_dir) == 0);
+    return 0;
+}
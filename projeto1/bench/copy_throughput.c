@@ -0,0 +1,94 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 4096
+#define FILE_MIB 16
+#define ROUNDS 8
+
+/* This benchmark measures the throughput of tfs_copy_from_external_fs on a
+ * large file (the contents of tests/file_to_copy_over512.txt repeated up to
+ * FILE_MIB MiB), against a copy loop like the one it used to run: one fread
+ * and one tfs_write per default-sized block, clearing the buffer each time.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers, and run from the root of the project:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static char source_path[] = "/tmp/tfs_benchXXXXXX";
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int copy_per_block(char const *path, char const *dest_path) {
+    FILE *source = fopen(path, "r");
+    assert(source != NULL);
+    int dest = tfs_open(dest_path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(dest != -1);
+
+    size_t block_size = tfs_default_params().block_size;
+    char *buffer = malloc(block_size);
+    assert(buffer != NULL);
+    size_t bytes_read;
+    do {
+        memset(buffer, 0, block_size);
+        bytes_read = fread(buffer, 1, block_size, source);
+        assert(tfs_write(dest, buffer, bytes_read) == bytes_read);
+    } while (bytes_read == block_size);
+
+    free(buffer);
+    fclose(source);
+    return tfs_close(dest);
+}
+
+int main() {
+    // builds the source file
+    FILE *sample = fopen("tests/file_to_copy_over512.txt", "r");
+    assert(sample != NULL);
+    char contents[1024];
+    size_t sample_size = fread(contents, 1, sizeof(contents), sample);
+    assert(sample_size > 0);
+    fclose(sample);
+
+    int fd = mkstemp(source_path);
+    assert(fd != -1);
+    size_t size = 0;
+    while (size < FILE_MIB * 1024 * 1024) {
+        assert(write(fd, contents, sample_size) == sample_size);
+        size += sample_size;
+    }
+    assert(close(fd) == 0);
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = 2 * size / BLOCK_SIZE + 64;
+    assert(tfs_init(&params) != -1);
+
+    double start = now();
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(copy_per_block(source_path, "/f1") == 0);
+    }
+    double per_block_time = now() - start;
+
+    start = now();
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(tfs_copy_from_external_fs(source_path, "/f1") == 0);
+    }
+    double copy_time = now() - start;
+
+    assert(tfs_destroy() != -1);
+    assert(unlink(source_path) == 0);
+
+    double mib = (double)(ROUNDS * size) / (1024 * 1024);
+    printf("%zu KiB file, %d rounds\n", size / 1024, ROUNDS);
+    printf("per-block fread loop:      %.0f MiB/s\n", mib / per_block_time);
+    printf("tfs_copy_from_external_fs: %.0f MiB/s\n", mib / copy_time);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK_SIZE 4096
+#define BLOCK_COUNT 8192
+#define MAX_FILES 80
+#define MAX_FILE_BLOCKS 64
+#define AGING_ROUNDS 20
+#define SEQ_FILES 8
+#define SEQ_FILE_SIZE (256 * 1024)
+#define READ_PASSES 20
+
+/* This benchmark ages a volume by repeatedly filling it with files of random
+ * sizes (written in small appends) and deleting a random half of them, and
+ * then reports free space fragmentation, the number of extents per file, and
+ * the sequential read throughput of freshly written files on the aged volume.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static char buffer[SEQ_FILE_SIZE];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void path_of(char *path, size_t size, int i) {
+    snprintf(path, size, "/f%d", i);
+}
+
+// writes a file with appends of append_len bytes; returns bytes written
+static size_t write_file(char const *path, size_t size, size_t append_len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    size_t done = 0;
+    while (done < size) {
+        size_t len = size - done < append_len ? size - done : append_len;
+        ssize_t w = tfs_write(f, buffer, len);
+        if (w <= 0) {
+            break; // volume full or out of extents
+        }
+        done += (size_t)w;
+    }
+    assert(tfs_close(f) != -1);
+    return done;
+}
+
+static void report_fragmentation(char const *when) {
+    tfs_instance_t *fs = tfs_default_instance();
+    size_t free_count, free_runs, largest_free_run;
+    data_blocks_fragmentation(fs, &free_count, &free_runs, &largest_free_run);
+    printf("%s: %zu free blocks in %zu runs (largest run: %zu)\n", when,
+           free_count, free_runs, largest_free_run);
+}
+
+static double extents_per_file(int first, int count) {
+    tfs_instance_t *fs = tfs_default_instance();
+    size_t extents = 0;
+    int files = 0;
+    for (int i = first; i < first + count; i++) {
+        char path[16];
+        path_of(path, sizeof(path), i);
+        int inum = tfs_lookup(path);
+        if (inum != -1) {
+            extents += (size_t)inode_get(fs, inum)->i_extent_count;
+            files++;
+        }
+    }
+    return files > 0 ? (double)extents / files : 0;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    params.max_inode_count = MAX_FILES + SEQ_FILES + 1;
+    assert(tfs_init(&params) != -1);
+    memset(buffer, 'x', sizeof(buffer));
+    srand(42);
+
+    bool exists[MAX_FILES] = {false};
+    for (int round = 0; round < AGING_ROUNDS; round++) {
+        for (int i = 0; i < MAX_FILES; i++) {
+            if (!exists[i]) {
+                char path[16];
+                path_of(path, sizeof(path), i);
+                size_t blocks = 1 + (size_t)rand() % MAX_FILE_BLOCKS;
+                write_file(path, blocks * BLOCK_SIZE, 1000);
+                exists[i] = true;
+            }
+        }
+        for (int i = 0; i < MAX_FILES; i++) {
+            if (rand() % 2) {
+                char path[16];
+                path_of(path, sizeof(path), i);
+                assert(tfs_unlink(path) != -1);
+                exists[i] = false;
+            }
+        }
+    }
+    report_fragmentation("aged volume");
+    printf("aged files: %.2f extents/file\n",
+           extents_per_file(0, MAX_FILES));
+
+    size_t total = 0;
+    for (int i = 0; i < SEQ_FILES; i++) {
+        char path[16];
+        path_of(path, sizeof(path), MAX_FILES + i);
+        total += write_file(path, SEQ_FILE_SIZE, 4096);
+    }
+    report_fragmentation("after sequential files");
+    printf("sequential files: %.2f extents/file, %zu of %d bytes written\n",
+           extents_per_file(MAX_FILES, SEQ_FILES), total,
+           SEQ_FILES * SEQ_FILE_SIZE);
+
+    double start = now();
+    for (int pass = 0; pass < READ_PASSES; pass++) {
+        for (int i = 0; i < SEQ_FILES; i++) {
+            char path[16];
+            path_of(path, sizeof(path), MAX_FILES + i);
+            int f = tfs_open(path, 0);
+            assert(f != -1);
+            while (tfs_read(f, buffer, sizeof(buffer)) > 0) {
+            }
+            assert(tfs_close(f) != -1);
+        }
+    }
+    double elapsed = now() - start;
+    printf("sequential read: %.1f MiB/s\n",
+           (double)total * READ_PASSES / elapsed / (1024 * 1024));
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#define FILE_COUNT 16
+#define THREAD_NUM 8
+#define DURATION_SEC 2
+
+/* This benchmark measures how many lookups and open/close pairs per second the
+ * inode table sustains when several threads hammer a small set of files.
+ * Every operation touches the root directory inode and the target inode, so
+ * the layout of the inode table (and the false sharing between neighbouring
+ * inodes and their locks) dominates the result.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static char paths[FILE_COUNT][8];
+static atomic_bool running;
+
+typedef struct {
+    _Alignas(64) size_t ops;
+} counter_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void *lookup_fn(void *arg) {
+    counter_t *counter = (counter_t *)arg;
+
+    for (size_t i = 0; atomic_load(&running); i++) {
+        assert(tfs_lookup(paths[i % FILE_COUNT]) != -1);
+        counter->ops++;
+    }
+    return NULL;
+}
+
+void *open_fn(void *arg) {
+    counter_t *counter = (counter_t *)arg;
+
+    for (size_t i = 0; atomic_load(&running); i++) {
+        int f = tfs_open(paths[i % FILE_COUNT], 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+        counter->ops++;
+    }
+    return NULL;
+}
+
+// runs fn in THREAD_NUM threads for DURATION_SEC and returns the ops/s
+static double run(void *(*fn)(void *)) {
+    pthread_t tid[THREAD_NUM];
+    counter_t counters[THREAD_NUM] = {0};
+
+    atomic_store(&running, true);
+    double start = now();
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_create(&tid[i], NULL, fn, &counters[i]) == 0);
+    }
+
+    struct timespec duration = {.tv_sec = DURATION_SEC};
+    nanosleep(&duration, NULL);
+    atomic_store(&running, false);
+
+    size_t ops = 0;
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+        ops += counters[i].ops;
+    }
+    return (double)ops / (now() - start);
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/f%d", i);
+        int f = tfs_open(paths[i], TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    printf("threads: %d\n", THREAD_NUM);
+    printf("lookups/s: %.0f\n", run(lookup_fn));
+    printf("opens/s: %.0f\n", run(open_fn));
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#define THREAD_NUM 4
+#define FILES_PER_THREAD 4
+#define DURATION_SEC 2
+
+/* This benchmark runs the parallel_alloc workload (every thread creates a few
+ * files, writes to them and unlinks them again) twice: first with all the
+ * threads on one shared instance, and then with each thread on an instance of
+ * its own, which shares no tables or locks with the others (e.g. one tenant
+ * per volume).
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static atomic_bool running;
+
+typedef struct {
+    int id;
+    tfs_instance_t *fs;
+    _Alignas(64) size_t files;
+} worker_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *writer_fn(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    tfs_instance_t *fs = worker->fs;
+    char paths[FILES_PER_THREAD][16];
+    char const contents[] = "AAA!";
+
+    for (int i = 0; i < FILES_PER_THREAD; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/t%d_%d", worker->id, i);
+    }
+
+    while (atomic_load(&running)) {
+        for (int i = 0; i < FILES_PER_THREAD; i++) {
+            int f = tfsi_open(fs, paths[i], TFS_O_CREAT);
+            assert(f != -1);
+            assert(tfsi_write(fs, f, contents, sizeof(contents)) ==
+                   sizeof(contents));
+            assert(tfsi_close(fs, f) != -1);
+        }
+        for (int i = 0; i < FILES_PER_THREAD; i++) {
+            assert(tfsi_unlink(fs, paths[i]) != -1);
+        }
+        worker->files += FILES_PER_THREAD;
+    }
+    return NULL;
+}
+
+/*
+ * Runs the workload with each thread on the given instance, and returns the
+ * files created+written+unlinked per second
+ */
+static double run(tfs_instance_t *const *fs) {
+    pthread_t tid[THREAD_NUM];
+    worker_t workers[THREAD_NUM] = {0};
+
+    atomic_store(&running, true);
+    double start = now();
+    for (int i = 0; i < THREAD_NUM; i++) {
+        workers[i].id = i;
+        workers[i].fs = fs[i];
+        assert(pthread_create(&tid[i], NULL, writer_fn, &workers[i]) == 0);
+    }
+
+    struct timespec duration = {.tv_sec = DURATION_SEC};
+    nanosleep(&duration, NULL);
+    atomic_store(&running, false);
+
+    size_t files = 0;
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+        files += workers[i].files;
+    }
+    return (double)files / (now() - start);
+}
+
+int main() {
+    tfs_instance_t *fs[THREAD_NUM];
+
+    tfs_instance_t *shared = tfs_instance_create(NULL);
+    assert(shared != NULL);
+    for (int i = 0; i < THREAD_NUM; i++) {
+        fs[i] = shared;
+    }
+    double shared_rate = run(fs);
+    assert(tfs_instance_destroy(shared) != -1);
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        fs[i] = tfs_instance_create(NULL);
+        assert(fs[i] != NULL);
+    }
+    double own_rate = run(fs);
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(tfs_instance_destroy(fs[i]) != -1);
+    }
+
+    printf("threads: %d\n", THREAD_NUM);
+    printf("shared instance: %.0f files created+written+unlinked/s\n",
+           shared_rate);
+    printf("one instance per thread: %.0f files created+written+unlinked/s\n",
+           own_rate);
+    return 0;
+}
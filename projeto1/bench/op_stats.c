@@ -0,0 +1,69 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#define ROUNDS 2000000
+#define BUFFER_SIZE 16
+
+/* This benchmark measures the cost of the op_stats parameter: it times small
+ * reads (which are among the cheapest measured operations, so the clock reads
+ * and histogram updates are a large part of them) on an instance without and
+ * with the parameter, and prints the statistics of the latter.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns the average time of a small read (in ns) on a new instance, and
+ * stores its statistics in stats
+ */
+static double run(bool op_stats, tfs_stats_t *stats) {
+    tfs_params params = tfs_default_params();
+    params.op_stats = op_stats;
+    tfs_instance_t *fs = tfs_instance_create(&params);
+    assert(fs != NULL);
+
+    char buffer[BUFFER_SIZE] = {0};
+    int f = tfsi_open(fs, "/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfsi_write(fs, f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfsi_close(fs, f) != -1);
+
+    f = tfsi_open(fs, "/f", 0);
+    assert(f != -1);
+    double start = now();
+    for (int i = 0; i < ROUNDS; i++) {
+        // reads at end of file, so that every read is the same
+        assert(tfsi_read(fs, f, buffer, sizeof(buffer)) >= 0);
+    }
+    double elapsed = now() - start;
+    assert(tfsi_close(fs, f) != -1);
+
+    tfsi_get_stats(fs, stats);
+    assert(tfs_instance_destroy(fs) != -1);
+    return elapsed * 1e9 / ROUNDS;
+}
+
+int main() {
+    tfs_stats_t stats;
+    double without = run(false, &stats);
+    double with = run(true, &stats);
+
+    tfs_op_stats_t *reads = &stats.st_ops[TFS_STATS_READ];
+    printf("read without op_stats: %.1f ns\n", without);
+    printf("read with op_stats: %.1f ns (%+.1f ns)\n", with, with - without);
+    printf("reads: %zu, p50 %lu ns, p99 %lu ns, p999 %lu ns, max %lu ns\n",
+           reads->s_ops, (unsigned long)reads->s_p50_ns,
+           (unsigned long)reads->s_p99_ns, (unsigned long)reads->s_p999_ns,
+           (unsigned long)reads->s_max_ns);
+    return 0;
+}
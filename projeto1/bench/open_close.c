@@ -0,0 +1,96 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#define THREAD_NUM 4
+#define HELD_PER_THREAD 250 // 1000 files kept open in all
+#define MAX_OPEN_FILES 4096
+#define DURATION_SEC 2
+
+/* This benchmark has every thread keep many files open (so the open file
+ * table is large and mostly in use) while it repeatedly opens and closes one
+ * more, so that the allocation of file handles is on the hot path.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static atomic_bool running;
+
+typedef struct {
+    int id;
+    _Alignas(64) size_t opens;
+} worker_t;
+
+static int held[THREAD_NUM][HELD_PER_THREAD];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *opener_fn(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    char path[16];
+    snprintf(path, sizeof(path), "/t%d", worker->id);
+
+    while (atomic_load(&running)) {
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+        worker->opens++;
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_open_files_count = MAX_OPEN_FILES;
+    assert(tfs_init(&params) != -1);
+
+    pthread_t tid[THREAD_NUM];
+    worker_t workers[THREAD_NUM] = {0};
+    for (int i = 0; i < THREAD_NUM; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/t%d", i);
+        for (int j = 0; j < HELD_PER_THREAD; j++) {
+            held[i][j] = tfs_open(path, TFS_O_CREAT);
+            assert(held[i][j] != -1);
+        }
+    }
+
+    atomic_store(&running, true);
+    double start = now();
+    for (int i = 0; i < THREAD_NUM; i++) {
+        workers[i].id = i;
+        assert(pthread_create(&tid[i], NULL, opener_fn, &workers[i]) == 0);
+    }
+
+    struct timespec duration = {.tv_sec = DURATION_SEC};
+    nanosleep(&duration, NULL);
+    atomic_store(&running, false);
+
+    size_t opens = 0;
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+        opens += workers[i].opens;
+    }
+    double elapsed = now() - start;
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        for (int j = 0; j < HELD_PER_THREAD; j++) {
+            assert(tfs_close(held[i][j]) != -1);
+        }
+    }
+    assert(tfs_destroy() != -1);
+
+    printf("threads: %d, files held open: %d\n", THREAD_NUM,
+           THREAD_NUM * HELD_PER_THREAD);
+    printf("%.0f opens+closes/s\n", (double)opens / elapsed);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#define THREAD_NUM 4
+#define FILES_PER_THREAD 4
+#define DURATION_SEC 2
+
+/* This benchmark runs thread_test-style writers in parallel: every thread
+ * repeatedly creates a few files, writes to them (allocating a data block),
+ * and unlinks them again (freeing the inode and the block), so that the inode
+ * and block allocators are on the hot path of every iteration.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static atomic_bool running;
+
+typedef struct {
+    int id;
+    _Alignas(64) size_t files;
+} worker_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void *writer_fn(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    char paths[FILES_PER_THREAD][16];
+    char const contents[] = "AAA!";
+
+    for (int i = 0; i < FILES_PER_THREAD; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/t%d_%d", worker->id, i);
+    }
+
+    while (atomic_load(&running)) {
+        for (int i = 0; i < FILES_PER_THREAD; i++) {
+            int f = tfs_open(paths[i], TFS_O_CREAT);
+            assert(f != -1);
+            assert(tfs_write(f, contents, sizeof(contents)) ==
+                   sizeof(contents));
+            assert(tfs_close(f) != -1);
+        }
+        for (int i = 0; i < FILES_PER_THREAD; i++) {
+            assert(tfs_unlink(paths[i]) != -1);
+        }
+        worker->files += FILES_PER_THREAD;
+    }
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    pthread_t tid[THREAD_NUM];
+    worker_t workers[THREAD_NUM] = {0};
+
+    atomic_store(&running, true);
+    double start = now();
+    for (int i = 0; i < THREAD_NUM; i++) {
+        workers[i].id = i;
+        assert(pthread_create(&tid[i], NULL, writer_fn, &workers[i]) == 0);
+    }
+
+    struct timespec duration = {.tv_sec = DURATION_SEC};
+    nanosleep(&duration, NULL);
+    atomic_store(&running, false);
+
+    size_t files = 0;
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+        files += workers[i].files;
+    }
+
+    printf("threads: %d\n", THREAD_NUM);
+    printf("files created+written+unlinked/s: %.0f\n",
+           (double)files / (now() - start));
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
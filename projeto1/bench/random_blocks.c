@@ -0,0 +1,86 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK_SIZE 4096
+#define BLOCK_COUNT 65536 // 256 MiB of data blocks
+#define ACCESSES 4000000
+
+/* This benchmark measures accesses to random data blocks of a large volume
+ * (each one reading the number of the next block to access from the block,
+ * so that they are not overlapped), with the data blocks backed by regular
+ * pages and by huge pages (whose TLB entries cover the whole volume).
+ *
+ * Build without the thread sanitizer and the simulated storage delay:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static int blocks[BLOCK_COUNT];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns the nanoseconds per access to a random data block, with the given
+ * placement of the data blocks
+ */
+static double run(bool huge_pages, tfs_numa_policy numa_policy) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    params.huge_pages = huge_pages;
+    params.numa_policy = numa_policy;
+    tfs_instance_t *fs = tfs_instance_create(&params);
+    assert(fs != NULL);
+
+    // all the data blocks but the root directory's, chained in a random
+    // cycle (Sattolo's algorithm)
+    size_t count = 0;
+    int block;
+    while ((block = data_block_alloc(fs)) != -1) {
+        blocks[count++] = block;
+    }
+    srand(1);
+    for (size_t i = count - 1; i > 0; i--) {
+        size_t j = (size_t)rand() % i;
+        int tmp = blocks[i];
+        blocks[i] = blocks[j];
+        blocks[j] = tmp;
+    }
+    for (size_t i = 0; i < count; i++) {
+        int *next = data_block_get(fs, blocks[i]);
+        memset(next, 0, BLOCK_SIZE);
+        *next = blocks[(i + 1) % count];
+    }
+
+    block = blocks[0];
+    double start = now();
+    for (int i = 0; i < ACCESSES; i++) {
+        block = *(int *)data_block_get(fs, block);
+    }
+    double elapsed = now() - start;
+    assert(block != -1);
+
+    for (size_t i = 0; i < count; i++) {
+        data_block_free(fs, blocks[i]);
+    }
+    assert(tfs_instance_destroy(fs) != -1);
+    return elapsed / ACCESSES * 1e9;
+}
+
+int main() {
+    printf("%d blocks of %d bytes\n", BLOCK_COUNT, BLOCK_SIZE);
+    printf("regular pages:           %.1f ns per block access\n",
+           run(false, TFS_NUMA_DEFAULT));
+    printf("huge pages:              %.1f ns per block access\n",
+           run(true, TFS_NUMA_DEFAULT));
+    printf("huge pages, interleaved: %.1f ns per block access\n",
+           run(true, TFS_NUMA_INTERLEAVE));
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FILE_BLOCKS 512
+#define ROUNDS 4
+#define THINK_TIME_NS 20000
+
+/* This benchmark scans a file sequentially, one block per tfs_read, with and
+ * without readahead. After each read the reader waits for THINK_TIME_NS (as
+ * if it sent the data over the network), which the prefetcher can use to
+ * bring in the next blocks. The block cache is smaller than the file, so
+ * each scan starts cold.
+ *
+ * The simulated storage delay is what readahead hides, so build without the
+ * thread sanitizer but keep the delay:
+ *   make clean && make bench TSAN=no */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void scan(char const *name, size_t readahead_blocks) {
+    tfs_params params = tfs_default_params();
+    params.readahead_blocks = readahead_blocks;
+    assert(tfs_init(&params) != -1);
+
+    size_t block_size = params.block_size;
+    char *buffer = malloc(block_size);
+    assert(buffer != NULL);
+    memset(buffer, 'A', block_size);
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    for (int i = 0; i < FILE_BLOCKS; i++) {
+        assert(tfs_write(f, buffer, block_size) == block_size);
+    }
+    assert(tfs_close(f) != -1);
+
+    struct timespec think = {.tv_nsec = THINK_TIME_NS};
+    double read_time = 0; // time stalled in tfs_read
+    double start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        f = tfs_open("/f1", 0);
+        assert(f != -1);
+        for (;;) {
+            double read_start = now();
+            ssize_t r = tfs_read(f, buffer, block_size);
+            read_time += now() - read_start;
+            if (r <= 0) {
+                break;
+            }
+            nanosleep(&think, NULL);
+        }
+        assert(tfs_close(f) != -1);
+    }
+    double elapsed = now() - start;
+
+    free(buffer);
+    assert(tfs_destroy() != -1);
+    printf("%s: %.1f MiB/s, %.2f us in tfs_read per block\n", name,
+           (double)(ROUNDS * FILE_BLOCKS * block_size) / (1024 * 1024) /
+               elapsed,
+           read_time / (ROUNDS * FILE_BLOCKS) * 1e6);
+}
+
+int main() {
+    printf("%d blocks scanned %d times, %d ns think time per block\n",
+           FILE_BLOCKS, ROUNDS, THINK_TIME_NS);
+    scan("readahead off", 0);
+    scan("readahead on ", tfs_default_params().readahead_blocks);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORD_SIZE 16
+#define RECORDS 32768 // 512 KiB, fits the default volume
+#define ROUNDS 8
+
+/* This benchmark appends small records (as a logger would) to a file, with
+ * and without a write buffer. Unbuffered, every record takes the volume,
+ * handle and inode locks and walks the block list; buffered, records are
+ * copied to the handle's buffer and written to the file in batches.
+ *
+ * Build without the thread sanitizer and the simulated storage delay:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void append(char const *name, tfs_file_mode_t mode) {
+    tfs_params params = tfs_default_params();
+    assert(tfs_init(&params) != -1);
+
+    char record[RECORD_SIZE];
+    memset(record, 'A', sizeof(record));
+
+    double start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        int f = tfs_open("/log", TFS_O_CREAT | TFS_O_TRUNC | mode);
+        assert(f != -1);
+        for (int i = 0; i < RECORDS; i++) {
+            assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+        }
+        assert(tfs_close(f) != -1);
+    }
+    double elapsed = now() - start;
+
+    assert(tfs_destroy() != -1);
+    printf("%s: %.0f appends/s\n", name, ROUNDS * RECORDS / elapsed);
+}
+
+int main() {
+    printf("%d appends of %d bytes, %d times\n", RECORDS, RECORD_SIZE,
+           ROUNDS);
+    append("unbuffered", 0);
+    append("buffered  ", TFS_O_BUFFERED);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREAD_NUM 4
+#define FILE_BLOCKS 32
+#define WRITE_SIZE 1024
+#define MAX_SAMPLES (1 << 20)
+#define DURATION_SEC 1
+
+/* This benchmark measures the latency of tfs_write while the volume is being
+ * snapshotted: writer threads keep overwriting their own files, first alone
+ * and then while another thread repeatedly takes a snapshot, exports it to a
+ * temporary directory, and releases it. Writes only wait while a snapshot
+ * copies the metadata, and pay for copying a block the first time they change
+ * it after each snapshot.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static atomic_bool running;
+static atomic_bool snapshotting;
+static char export_dir[] = "/tmp/tfs_benchXXXXXX";
+
+typedef struct {
+    int id;
+    size_t count;
+    double *samples; // write latencies, in seconds
+} worker_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void *writer_fn(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    char path[16];
+    char buffer[WRITE_SIZE];
+    snprintf(path, sizeof(path), "/w%d", worker->id);
+    memset(buffer, 'A' + worker->id, sizeof(buffer));
+
+    while (atomic_load(&running)) {
+        // overwrites the whole file, one block at a time
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        for (int i = 0; i < FILE_BLOCKS && worker->count < MAX_SAMPLES; i++) {
+            double start = now();
+            assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+            worker->samples[worker->count++] = now() - start;
+        }
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+typedef struct {
+    size_t count;
+    double capture_time; // spent in tfs_snapshot
+    double export_time;  // spent in tfs_snapshot_export
+} snapshotter_t;
+
+void *snapshotter_fn(void *arg) {
+    snapshotter_t *snapshotter = (snapshotter_t *)arg;
+    while (atomic_load(&snapshotting)) {
+        double start = now();
+        tfs_snapshot_t *snapshot = tfs_snapshot();
+        assert(snapshot != NULL);
+        double captured = now();
+        assert(tfs_snapshot_export(snapshot, export_dir) == 0);
+        snapshotter->export_time += now() - captured;
+        snapshotter->capture_time += captured - start;
+        tfs_snapshot_release(snapshot);
+        snapshotter->count++;
+    }
+    return NULL;
+}
+
+static int compare_doubles(void const *a, void const *b) {
+    double x = *(double const *)a, y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_phase(char const *name, bool with_snapshots) {
+    pthread_t tid[THREAD_NUM];
+    worker_t workers[THREAD_NUM];
+    pthread_t snapshotter_tid;
+    snapshotter_t snapshotter = {0};
+
+    atomic_store(&running, true);
+    atomic_store(&snapshotting, with_snapshots);
+    for (int i = 0; i < THREAD_NUM; i++) {
+        workers[i].id = i;
+        workers[i].count = 0;
+        workers[i].samples = malloc(MAX_SAMPLES * sizeof(double));
+        assert(workers[i].samples != NULL);
+        assert(pthread_create(&tid[i], NULL, writer_fn, &workers[i]) == 0);
+    }
+    if (with_snapshots) {
+        assert(pthread_create(&snapshotter_tid, NULL, snapshotter_fn,
+                              &snapshotter) == 0);
+    }
+
+    struct timespec duration = {.tv_sec = DURATION_SEC};
+    nanosleep(&duration, NULL);
+    atomic_store(&snapshotting, false);
+    if (with_snapshots) {
+        assert(pthread_join(snapshotter_tid, NULL) == 0);
+    }
+    atomic_store(&running, false);
+
+    size_t count = 0;
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+        count += workers[i].count;
+    }
+    double *samples = malloc(count * sizeof(double));
+    assert(samples != NULL);
+    count = 0;
+    for (int i = 0; i < THREAD_NUM; i++) {
+        memcpy(samples + count, workers[i].samples,
+               workers[i].count * sizeof(double));
+        count += workers[i].count;
+        free(workers[i].samples);
+    }
+    qsort(samples, count, sizeof(double), compare_doubles);
+
+    printf("%s: %zu writes, latency p50 %.2f us, p99 %.2f us, p99.9 %.2f us, "
+           "max %.2f us\n",
+           name, count, samples[count / 2] * 1e6,
+           samples[count * 99 / 100] * 1e6, samples[count * 999 / 1000] * 1e6,
+           samples[count - 1] * 1e6);
+    if (snapshotter.count > 0) {
+        printf("  %zu snapshots, capture %.2f us and export %.2f us on average"
+               "\n",
+               snapshotter.count,
+               snapshotter.capture_time / (double)snapshotter.count * 1e6,
+               snapshotter.export_time / (double)snapshotter.count * 1e6);
+    }
+    free(samples);
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+    assert(mkdtemp(export_dir) != NULL);
+
+    run_phase("no snapshots", false);
+    run_phase("snapshotting", true);
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/w%d", export_dir, i);
+        unlink(path);
+    }
+    assert(rmdir(export_dir) == 0);
+    assert(tfs_destroy() != -1);
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_INODES (1024 * 1024)
+#define MAX_BLOCKS (1024 * 1024)
+#define MAX_OPEN_FILES (64 * 1024)
+#define FILE_COUNT 20
+#define FILE_SIZE (256 * 1024)
+
+/* This benchmark starts a volume with room for a million inodes and blocks
+ * (1 GiB of data), and reports how long tfs_init takes and the resident
+ * memory of the process, after tfs_init and after writing a few files.
+ *
+ * Build without the thread sanitizer and the simulated storage delay:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double resident_mib(void) {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    assert(statm != NULL);
+    long size, resident;
+    assert(fscanf(statm, "%ld %ld", &size, &resident) == 2);
+    fclose(statm);
+    return (double)resident * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+int main() {
+    static char buffer[FILE_SIZE];
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = MAX_INODES;
+    params.max_block_count = MAX_BLOCKS;
+    params.max_open_files_count = MAX_OPEN_FILES;
+
+    double before = resident_mib();
+    double start = now();
+    assert(tfs_init(&params) != -1);
+    double init_elapsed = now() - start;
+    double after_init = resident_mib();
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "/f%d", i);
+        int f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(tfs_close(f) != -1);
+    }
+    double after_writes = resident_mib();
+    assert(tfs_destroy() != -1);
+
+    printf("tfs_init: %.2f ms\n", init_elapsed * 1e3);
+    printf("resident: %.1f MiB after tfs_init, %.1f MiB after writing "
+           "%d KiB\n",
+           after_init - before, after_writes - before,
+           FILE_COUNT * FILE_SIZE / 1024);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILE_COUNT 1000
+#define FILE_SIZE 4096
+
+/* This benchmark compares two ways of warming up a volume with FILE_COUNT
+ * files: importing each of them from the OS' file system with
+ * tfs_copy_from_external_fs, and loading an image written by tfs_dump.
+ *
+ * Build without the simulated storage delay and the thread sanitizer to get
+ * meaningful numbers:
+ *   make clean && make bench TSAN=no EXTRA_CFLAGS=-DDELAY=0 */
+
+static char source_dir[] = "/tmp/tfs_benchXXXXXX";
+static char image_path[64];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void source_path(char *path, size_t size, int i) {
+    snprintf(path, size, "%s/file%d", source_dir, i);
+}
+
+int main() {
+    // one root directory block must hold all the files
+    tfs_params params = tfs_default_params();
+    params.block_size = 64 * 1024;
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 64;
+
+    assert(mkdtemp(source_dir) != NULL);
+    snprintf(image_path, sizeof(image_path), "%s/image", source_dir);
+    char contents[FILE_SIZE];
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char path[64];
+        source_path(path, sizeof(path), i);
+        FILE *file = fopen(path, "w");
+        assert(file != NULL);
+        assert(fwrite(contents, 1, sizeof(contents), file) ==
+               sizeof(contents));
+        assert(fclose(file) == 0);
+    }
+
+    assert(tfs_init(&params) != -1);
+    double start = now();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char path[64], dest[16];
+        source_path(path, sizeof(path), i);
+        snprintf(dest, sizeof(dest), "/file%d", i);
+        assert(tfs_copy_from_external_fs(path, dest) == 0);
+    }
+    double import_time = now() - start;
+
+    start = now();
+    assert(tfs_dump(image_path) == 0);
+    double dump_time = now() - start;
+    assert(tfs_destroy() != -1);
+
+    assert(tfs_init(&params) != -1);
+    start = now();
+    assert(tfs_load(image_path) == 0);
+    double load_time = now() - start;
+
+    char buffer[FILE_SIZE];
+    int f = tfs_open("/file999", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+    assert(tfs_destroy() != -1);
+
+    printf("%d files of %d bytes\n", FILE_COUNT, FILE_SIZE);
+    printf("re-import: %.2f ms\n", import_time * 1e3);
+    printf("dump:      %.2f ms\n", dump_time * 1e3);
+    printf("load:      %.2f ms (%.1fx faster than re-import)\n",
+           load_time * 1e3, import_time / load_time);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char path[64];
+        source_path(path, sizeof(path), i);
+        unlink(path);
+    }
+    unlink(image_path);
+    assert(rmdir(source_dir) == 0);
+    return 0;
+}
@@ -6,6 +6,68 @@
 
 #define MAX_FILE_NAME (40)
 
+// Simulated storage access latency (busy loop iterations, see insert_delay)
+// can be overridden at build time, e.g. -DDELAY=0 for benchmarks
+#ifndef DELAY
 #define DELAY (5000)
+#endif
+
+// Lock profiler (built with -DLOCK_PROFILE, see lock_profile_report): number
+// of wait time buckets, and of locks a thread may hold at once and still have
+// their hold time measured
+#define LOCK_PROFILE_BUCKETS (8)
+#define LOCK_PROFILE_MAX_HELD (64)
+
+// Maximum number of extents (runs of contiguous data blocks) of an inode;
+// bounds the size of files on fragmented volumes
+#define INODE_MAX_EXTENTS (6)
+
+// Number of entries by which the inode table, the data blocks and the open
+// file table grow whenever they run out (each starts with one chunk, and
+// grows up to the maximum size given in tfs_params)
+#define INODE_TABLE_CHUNK (64)
+#define DATA_BLOCKS_CHUNK (256)
+#define OPEN_FILES_CHUNK (16)
+
+// Number of inodes, blocks or file handles moved at once between the global
+// allocation maps and a thread's allocation cache (magazine)
+#define MAGAZINE_BATCH (8)
+
+// Size of a cache line, used to lay out hot tables without false sharing
+#define CACHE_LINE_SIZE (64)
+
+// Number of data blocks kept by the simulated block cache (reads of cached
+// blocks do not pay the storage access delay, see data_blocks_read)
+#define BLOCK_CACHE_BLOCKS (256)
+
+// Readahead window (in blocks) of sequential readers: it starts at the
+// minimum and doubles on each sequential read, up to the maximum (the
+// default of the readahead_blocks parameter)
+#define READAHEAD_MIN_BLOCKS (4)
+#define READAHEAD_MAX_BLOCKS (32)
+
+// Maximum number of pending prefetch requests (runs of blocks); further
+// requests are dropped
+#define PREFETCH_QUEUE_SIZE (64)
+
+// Size (in bytes) of the write buffer of file handles opened with
+// TFS_O_BUFFERED
+#define WRITE_BUFFER_SIZE (4096)
+
+// Size (in blocks) of the reads from host files that cannot be mapped
+#define COPY_BUFFER_BLOCKS (64)
+
+// Precision of the latency histograms of the op_stats parameter: each power
+// of two (in ns) is split in 2^OP_STATS_SUB_BITS buckets, so the percentiles
+// reported by tfs_get_stats are within 1/8 of the exact values
+#define OP_STATS_SUB_BITS (3)
+
+// Only one in this many calls of each operation (by each thread) is timed for
+// the latency histograms of the op_stats parameter; 1 times them all
+#define OP_STATS_SAMPLE_PERIOD (16)
+
+// Size of the huge pages that back the data blocks when the huge_pages
+// parameter is set (the data blocks are mapped in multiples of it)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
 
 #endif // CONFIG_H
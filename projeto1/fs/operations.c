@@ -1,24 +1,80 @@
 #include "operations.h"
 #include "config.h"
 #include "state.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "betterassert.h"
 
+/*
+ * Volume lock: every operation that changes the volume (directory, inodes or
+ * file contents) holds it for reading, so tfs_snapshot and tfs_opendir only
+ * have to take it for writing (freeze the volume) to see a consistent
+ * volume. It is only held while the metadata is copied, not while the copy
+ * is used.
+ *
+ * The rwlock may prefer readers, so a pending freeze also closes a gate that
+ * new operations wait on, instead of waiting for a gap between them.
+ */
+static void volume_enter(tfs_instance_t *fs) {
+    volume_lock_t *volume = get_volume_lock(fs);
+    if (atomic_load(&volume->vl_freeze_pending)) {
+        lock_mutex(&volume->vl_gate); // waits for the freeze
+        unlock_mutex(&volume->vl_gate);
+    }
+    read_lock_rwlock(&volume->vl_lock);
+}
+
+static void volume_exit(tfs_instance_t *fs) {
+    unlock_rwlock(&get_volume_lock(fs)->vl_lock);
+}
+
+/*
+ * Waits for the operations in progress, and keeps new ones out until
+ * volume_thaw
+ */
+static void volume_freeze(tfs_instance_t *fs) {
+    volume_lock_t *volume = get_volume_lock(fs);
+    lock_mutex(&volume->vl_gate);
+    atomic_store(&volume->vl_freeze_pending, true);
+    write_lock_rwlock(&volume->vl_lock);
+}
+
+static void volume_thaw(tfs_instance_t *fs) {
+    volume_lock_t *volume = get_volume_lock(fs);
+    unlock_rwlock(&volume->vl_lock);
+    atomic_store(&volume->vl_freeze_pending, false);
+    unlock_mutex(&volume->vl_gate);
+}
+
+/* Instance used by the tfs_ functions (see tfs_init) */
+static tfs_instance_t *default_fs;
+
 tfs_params tfs_default_params() {
     tfs_params params = {
         .max_inode_count = 64,
         .max_block_count = 1024,
-        .max_open_files_count = 16,
+        .max_open_files_count = 1024,
         .block_size = 1024,
+        .readahead_blocks = READAHEAD_MAX_BLOCKS,
+        .huge_pages = false,
+        .numa_policy = TFS_NUMA_DEFAULT,
+        .op_stats = false,
     };
     return params;
 }
 
-int tfs_init(tfs_params const *params_ptr) {
+tfs_instance_t *tfs_instance_create(tfs_params const *params_ptr) {
     tfs_params params;
     if (params_ptr != NULL) {
         params = *params_ptr;
@@ -26,26 +82,57 @@ int tfs_init(tfs_params const *params_ptr) {
         params = tfs_default_params();
     }
 
-    if (state_init(params) != 0) {
-        return -1;
+    tfs_instance_t *fs = state_init(params);
+    if (fs == NULL) {
+        return NULL;
     }
 
     // create root inode
-    int root = inode_create(T_DIRECTORY);
+    int root = inode_create(fs, T_DIRECTORY);
     if (root != ROOT_DIR_INUM) {
-        return -1;
+        state_destroy(fs);
+        return NULL;
     }
 
+    return fs;
+}
+
+int tfs_instance_destroy(tfs_instance_t *fs) {
+    if (state_destroy(fs) != 0) {
+        return -1;
+    }
     return 0;
 }
 
+tfs_instance_t *tfs_default_instance(void) { return default_fs; }
+
+int tfs_init(tfs_params const *params) {
+    if (default_fs != NULL) {
+        return -1; // already initialized
+    }
+    default_fs = tfs_instance_create(params);
+    return default_fs != NULL ? 0 : -1;
+}
+
 int tfs_destroy() {
-    if (state_destroy() != 0) {
+    if (default_fs == NULL || tfs_instance_destroy(default_fs) != 0) {
         return -1;
     }
+    default_fs = NULL;
+#ifdef LOCK_PROFILE
+    lock_profile_report(stderr);
+#endif
     return 0;
 }
 
+void tfsi_statfs(tfs_instance_t *fs, tfs_statfs_t *stat) {
+    state_statfs(fs, stat);
+}
+
+void tfsi_get_stats(tfs_instance_t *fs, tfs_stats_t *stats) {
+    state_get_stats(fs, stats);
+}
+
 static bool valid_pathname(char const *name) {
     return name != NULL && strlen(name) > 1 && name[0] == '/';
 }
@@ -61,8 +148,8 @@ static bool valid_pathname(char const *name) {
  *   - root_inode: the root directory inode
  * Returns the inumber of the file, -1 if unsuccessful.
  */
-int tfs_lookup(char const *name) {
-    inode_t *root_inode = inode_get(ROOT_DIR_INUM);
+int tfsi_lookup(tfs_instance_t *fs, char const *name) {
+    inode_t *root_inode = inode_get(fs, ROOT_DIR_INUM);
 
     if (!valid_pathname(name)) {
         return -1;
@@ -70,24 +157,112 @@ int tfs_lookup(char const *name) {
     // skip the initial '/' character
     name++;
 
-    return find_in_dir(root_inode, name);
+    return find_in_dir(fs, root_inode, name);
 }
 
-int tfs_open(char const *name, tfs_file_mode_t mode) {
+/*
+ * Drops the pin of a file handle on its inode (see inode_pin). If it was the
+ * last handle open on it, releases the unused preallocated blocks (see
+ * tfs_fallocate), or deletes the inode if its last name was removed.
+ */
+static void inode_drop(tfs_instance_t *fs, int inumber) {
+    for (;;) {
+        unpin_result_t next = inode_unpin(fs, inumber);
+        if (next == UNPIN_DONE) {
+            return;
+        }
+
+        volume_enter(fs);
+        pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inumber);
+        write_lock_rwlock(inode_lock);
+        if (next == UNPIN_DELETE) {
+            inode_delete(fs, inumber);
+        } else {
+            // still pinned, so that it is not deleted meanwhile
+            inode_t *inode = inode_get(fs, inumber);
+            size_t block_size = state_block_size(fs);
+            inode_trim_blocks(fs, inode,
+                              (inode->i_size + block_size - 1) / block_size);
+        }
+        unlock_rwlock(inode_lock);
+        volume_exit(fs);
+        if (next == UNPIN_DELETE) {
+            return;
+        }
+    }
+}
+
+/*
+ * Looks up a name and pins its inode (see inode_pin). The name is looked up
+ * again once the inode is pinned, since in between the file may have been
+ * unlinked and its inode number reused by another file (which must not be
+ * opened under this name); the lookup is then retried.
+ *
+ * Returns the pinned inumber, or -1 if the name does not exist.
+ */
+static int lookup_and_pin(tfs_instance_t *fs, char const *name) {
+    for (;;) {
+        int inum = tfsi_lookup(fs, name);
+        if (inum == -1) {
+            return -1;
+        }
+        if (inode_pin(fs, inum)) {
+            if (tfsi_lookup(fs, name) == inum) {
+                return inum;
+            }
+            inode_drop(fs, inum);
+        }
+    }
+}
+
+/*
+ * Looks up a regular file and pins its inode (see lookup_and_pin), following
+ * a symbolic link as tfs_open does.
+ *
+ * Returns the pinned inumber, or -1 if the file does not exist or is not a
+ * regular file.
+ */
+static int lookup_and_pin_file(tfs_instance_t *fs, char const *path) {
+    int inumber = lookup_and_pin(fs, path);
+    if (inumber == -1) {
+        return -1;
+    }
+    if (inode_get(fs, inumber)->i_node_type == T_SYMLINK) {
+        int link_inumber = inumber;
+        inumber = lookup_and_pin(fs, inode_symlink_target(fs, link_inumber));
+        inode_drop(fs, link_inumber);
+        if (inumber == -1) {
+            return -1;
+        }
+    }
+    if (inode_get(fs, inumber)->i_node_type != T_FILE) {
+        inode_drop(fs, inumber);
+        return -1;
+    }
+    return inumber;
+}
+
+/*
+ * Opens a file (see tfs_open), without measuring it (for the opens made by
+ * other operations)
+ */
+static int open_untimed(tfs_instance_t *fs, char const *name,
+                        tfs_file_mode_t mode) {
     // Checks if the path name is valid
     if (!valid_pathname(name)) {
         return -1;
     }
 
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    inode_t *root_dir_inode = inode_get(fs, ROOT_DIR_INUM);
     ALWAYS_ASSERT(root_dir_inode != NULL,
                   "tfs_open: root dir inode must exist");
-    int inum = tfs_lookup(name);
+    // pins the inode of the file, so that it is not deleted while open
+    int inum = lookup_and_pin(fs, name);
     size_t offset;
 
     if (inum >= 0) {
         // The file already exists
-        inode_t *inode = inode_get(inum);
+        inode_t *inode = inode_get(fs, inum);
         ALWAYS_ASSERT(inode != NULL,
                       "tfs_open: directory files must have an inode");
 
@@ -96,30 +271,36 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
         // itself, the symlink target path is the one
         // opened by overwriting the values already made
         if (inode->i_node_type == T_SYMLINK) {
-            inum = tfs_lookup(inode->i_symlink_target);
+            int link_inum = inum;
+            inum = lookup_and_pin(fs, inode_symlink_target(fs, link_inum));
+            inode_drop(fs, link_inum);
             if (inum == -1)
                 return -1;
 
-            inode = inode_get(inum);
-            if (inode == NULL)
+            inode = inode_get(fs, inum);
+            if (inode == NULL) {
+                inode_drop(fs, inum);
                 return -1;
+            }
         }
 
         // Truncate (if requested)
         if (mode & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                pthread_rwlock_t *inode_lock = get_inode_table_lock(inum);
-                write_lock_rwlock(inode_lock); // locks the latch to write
+            volume_enter(fs);
+            pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inum);
+            write_lock_rwlock(inode_lock); // locks the latch to write
 
-                data_block_free(inode->i_data_block);
+            if (inode->i_size > 0 || inode->i_extent_count > 0) {
+                inode_free_blocks(fs, inode);
                 inode->i_size = 0;
-
-                unlock_rwlock(inode_lock); // after the changes, unlocks it
             }
+
+            unlock_rwlock(inode_lock); // after the changes, unlocks it
+            volume_exit(fs);
         }
         // Determine initial offset
         if (mode & TFS_O_APPEND) {
-            pthread_rwlock_t *inode_lock = get_inode_table_lock(inum);
+            pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inum);
             write_lock_rwlock(inode_lock); // locks the latch to write
 
             offset = inode->i_size;
@@ -127,8 +308,9 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
             // this if statement verifies if the target is in fact a sym link
             // and if the file which target is saving still exists or not
             if ((inode->i_node_type == T_SYMLINK) &&
-                (tfs_lookup(inode->i_symlink_target) == -1)) {
+                (tfsi_lookup(fs, inode_symlink_target(fs, inum)) == -1)) {
                 unlock_rwlock(inode_lock);
+                inode_drop(fs, inum);
                 return -1;
             }
             unlock_rwlock(inode_lock); // after the changes, unlocks it
@@ -138,167 +320,301 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
         }
     } else if (mode & TFS_O_CREAT) {
         // The file does not exist; the mode specified that it should be created
+        volume_enter(fs);
+        // looks the name up again, as no other name can be added meanwhile
+        pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+        write_lock_rwlock(batch_lock);
+        if (tfsi_lookup(fs, name) != -1) {
+            unlock_rwlock(batch_lock);
+            volume_exit(fs);
+            return open_untimed(fs, name, mode); // created meanwhile
+        }
+
         // Create inode
-        inum = inode_create(T_FILE);
+        inum = inode_create(fs, T_FILE);
         if (inum == -1) {
+            unlock_rwlock(batch_lock);
+            volume_exit(fs);
             return -1; // no space in inode table
         }
 
         // this if statement verifies if the target is in fact a sym link
         // and if the file which target is saving still exists or not
-        inode_t *name_inode = inode_get(inum);
+        inode_t *name_inode = inode_get(fs, inum);
         if ((name_inode->i_node_type == T_SYMLINK) &&
-            (tfs_lookup(name_inode->i_symlink_target) == -1) &&
+            (tfsi_lookup(fs, inode_symlink_target(fs, inum)) == -1) &&
             (mode != TFS_O_CREAT)) {
+            unlock_rwlock(batch_lock);
+            volume_exit(fs);
             return -1;
         }
 
-        pthread_rwlock_t *inode_lock = get_inode_table_lock(inum);
+        pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inum);
         write_lock_rwlock(inode_lock); // locks the latch to write
 
         // Add entry in the root directory
-        if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
-            inode_delete(inum);
+        if (add_dir_entry(fs, root_dir_inode, name + 1, inum) == -1) {
+            inode_delete(fs, inum);
             unlock_rwlock(inode_lock); // after the changes, unlocks it
-            return -1;                 // no space in directory
+            unlock_rwlock(batch_lock);
+            volume_exit(fs);
+            return -1; // no space in directory
         }
 
         offset = 0;
+        // pins the inode before its name can be removed (it is new, so this
+        // cannot fail)
+        inode_pin(fs, inum);
         unlock_rwlock(inode_lock); // after the changes, unlocks it
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
     } else {
         return -1;
     }
 
     // Finally, add entry to the open file table and return the corresponding
     // handle
-    return add_to_open_file_table(inum, offset);
+    char *wbuf = NULL;
+    if (mode & TFS_O_BUFFERED) {
+        wbuf = malloc(WRITE_BUFFER_SIZE);
+        if (wbuf == NULL) {
+            inode_drop(fs, inum);
+            return -1;
+        }
+    }
+    int fhandle = add_to_open_file_table(fs, inum, offset, wbuf);
+    if (fhandle == -1) {
+        free(wbuf);
+        inode_drop(fs, inum);
+        return -1;
+    }
+    return fhandle;
 
     // Note: for simplification, if file was created with TFS_O_CREAT and there
     // is an error adding an entry to the open file table, the file is not
     // opened but it remains created
 }
 
-int tfs_sym_link(char const *target, char const *link_name) {
-    inode_t *root = inode_get(ROOT_DIR_INUM);   // gets the root inode
-    int target_inumber = tfs_lookup(target);    // gets the target inumber
-    if (root == NULL || target_inumber == -1) { // checks if they're valid
+int tfsi_open(tfs_instance_t *fs, char const *name, tfs_file_mode_t mode) {
+    uint64_t start = op_stats_begin(fs, TFS_STATS_OPEN);
+    int fhandle = open_untimed(fs, name, mode);
+    op_stats_end(fs, TFS_STATS_OPEN, start, fhandle);
+    return fhandle;
+}
+
+int tfsi_sym_link(tfs_instance_t *fs, char const *target,
+                  char const *link_name) {
+    inode_t *root = inode_get(fs, ROOT_DIR_INUM); // gets the root inode
+    int target_inumber = tfsi_lookup(fs, target); // gets the target inumber
+    if (root == NULL || target_inumber == -1) {   // checks if they're valid
         return -1;
     }
 
     // creates a new inode of the type T_SYMLINK
-    int symlink_inumber = inode_create(T_SYMLINK);
+    volume_enter(fs);
+    int symlink_inumber = inode_create(fs, T_SYMLINK);
     if (symlink_inumber == -1) {
+        volume_exit(fs);
         return -1;
     }
 
     // gets the new inode of the sym link to be used later
-    inode_t *symlink_inode = inode_get(symlink_inumber);
+    inode_t *symlink_inode = inode_get(fs, symlink_inumber);
     if (symlink_inode == NULL) {
+        volume_exit(fs);
         return -1;
     }
 
     // copies the target path to the field that was created in the inode
     // to save the target's path in the newly created sym link's inode
-    strncpy(symlink_inode->i_symlink_target, target, MAX_FILE_NAME - 1);
+    strncpy(inode_symlink_target(fs, symlink_inumber), target,
+            MAX_FILE_NAME - 1);
 
     // adds the directory entry on the root,
     // with the link's name and with the sym link inumber
-    int link = add_dir_entry(root, link_name + 1, symlink_inumber);
+    pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+    write_lock_rwlock(batch_lock); // not listed halfway (see tfs_opendir)
+    int link = add_dir_entry(fs, root, link_name + 1, symlink_inumber);
+    unlock_rwlock(batch_lock);
+    volume_exit(fs);
     if (link == -1) {
         return -1;
     }
     return 0;
 }
 
-int tfs_link(char const *target, char const *link_name) {
-    inode_t *root = inode_get(ROOT_DIR_INUM);   // gets the root inode
-    int target_inumber = tfs_lookup(target);    // gets the target inumber
-    if (root == NULL || target_inumber == -1) { // checks if they're valid
+int tfsi_link(tfs_instance_t *fs, char const *target, char const *link_name) {
+    inode_t *root = inode_get(fs, ROOT_DIR_INUM); // gets the root inode
+    int target_inumber = tfsi_lookup(fs, target); // gets the target inumber
+    if (root == NULL || target_inumber == -1) {   // checks if they're valid
         return -1;
     }
 
     // gets the inode_lock and locks it for writing and safety purposes
-    pthread_rwlock_t *inode_lock = get_inode_table_lock(target_inumber);
+    volume_enter(fs);
+    pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+    write_lock_rwlock(batch_lock); // not listed halfway (see tfs_opendir)
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, target_inumber);
     write_lock_rwlock(inode_lock);
 
     // gets the target inode and checks if its valid
-    inode_t *target_inode = inode_get(target_inumber);
+    inode_t *target_inode = inode_get(fs, target_inumber);
     if (target_inode == NULL) {
-        unlock_rwlock(inode_lock); // unlocks the latch
+        unlock_rwlock(inode_lock); // unlocks the latches
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
         return -1;
     }
 
     // blocks any try to make a hard link with a sym link
     if (target_inode->i_node_type & T_SYMLINK) {
-        unlock_rwlock(inode_lock); // unlocks the latch
+        unlock_rwlock(inode_lock); // unlocks the latches
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
         return -1;
     }
 
     // adds the directory entry on the root,
     // with the link name and the target inumber
-    int link = add_dir_entry(root, link_name + 1, target_inumber);
+    int link = add_dir_entry(fs, root, link_name + 1, target_inumber);
     if (link == -1) {
-        unlock_rwlock(inode_lock); // unlocks the latch
+        unlock_rwlock(inode_lock); // unlocks the latches
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
         return -1;
     }
 
     // increments the target_inode hard link counter
     target_inode->i_hardlink_counter++;
-    unlock_rwlock(inode_lock); // unlocks the latch
+    unlock_rwlock(inode_lock); // unlocks the latches
+    unlock_rwlock(batch_lock);
+    volume_exit(fs);
     return 0;
 }
 
-int tfs_close(int fhandle) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
-        return -1; // invalid fd
+int tfsi_clone(tfs_instance_t *fs, char const *source_path,
+               char const *dest_path) {
+    inode_t *root = inode_get(fs, ROOT_DIR_INUM); // gets the root inode
+    if (root == NULL || !valid_pathname(dest_path)) {
+        return -1;
     }
 
-    remove_from_open_file_table(fhandle);
-
-    return 0;
-}
-
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
+    // like tfs_open, clones the target of a symbolic link, which is pinned so
+    // that its inode is not reused by another file until it is shared
+    int src_inumber = lookup_and_pin_file(fs, source_path);
+    if (src_inumber == -1) {
         return -1;
     }
+    inode_t *src_inode = inode_get(fs, src_inumber);
+
+    int result = -1;
+    volume_enter(fs);
+    // the destination must not exist, also when the entry is added
+    pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+    write_lock_rwlock(batch_lock);
+    int dest_inumber =
+        tfsi_lookup(fs, dest_path) == -1 ? inode_create(fs, T_FILE) : -1;
+    if (dest_inumber != -1) {
+        inode_t *dest_inode = inode_get(fs, dest_inumber);
+
+        // shares the data blocks, instead of copying them
+        pthread_rwlock_t *src_lock = get_inode_table_lock(fs, src_inumber);
+        read_lock_rwlock(src_lock); // keeps writers out while sharing
+        inode_share_blocks(fs, src_inode, dest_inode);
+        unlock_rwlock(src_lock);
+
+        if (add_dir_entry(fs, root, dest_path + 1, dest_inumber) == -1) {
+            inode_delete(fs, dest_inumber); // no space in directory
+        } else {
+            result = 0;
+        }
+    }
+    unlock_rwlock(batch_lock);
+    volume_exit(fs);
 
-    pthread_rwlock_t *file_lock = get_open_file_table_lock(fhandle);
-    write_lock_rwlock(file_lock); // locks the latch of the file
+    inode_drop(fs, src_inumber);
+    return result;
+}
 
+/**
+ * Write to an open file, starting at the current offset (see tfs_write).
+ * The caller must hold the volume lock and the lock of the file handle.
+ *
+ * Returns the number of bytes that were written, or -1 in case of error.
+ */
+static ssize_t file_write(tfs_instance_t *fs, open_file_entry_t *file,
+                          void const *buffer, size_t to_write) {
     //  From the open file table entry, we get the inode
-    inode_t *inode = inode_get(file->of_inumber);
+    inode_t *inode = inode_get(fs, file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
 
-    pthread_rwlock_t *inode_lock = get_inode_table_lock(file->of_inumber);
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, file->of_inumber);
     write_lock_rwlock(inode_lock); // locks the latch of the inode
 
-    // Determine how many bytes to write
-    size_t block_size = state_block_size();
-    if (to_write + file->of_offset > block_size) {
-        to_write = block_size - file->of_offset;
-    }
-
     if (to_write > 0) {
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                unlock_rwlock(file_lock); // unlocks the latches
-                unlock_rwlock(inode_lock);
-                return -1; // no space
-            }
+        // Allocate the blocks missing to hold the data (if any)
+        size_t block_size = state_block_size(fs);
+        size_t end = file->of_offset + to_write;
+        size_t block_count = inode_block_count(inode);
+        size_t needed = (end + block_size - 1) / block_size;
+        if (needed > block_count) {
+            block_count += inode_alloc_blocks(fs, inode, needed - block_count);
+        }
 
-            inode->i_data_block = bnum;
+        // Determine how many bytes to write
+        size_t capacity = block_count * block_size;
+        if (capacity <= file->of_offset) {
+            unlock_rwlock(inode_lock); // unlocks the latch
+            return -1;                 // no space
+        }
+        if (end > capacity) {
+            to_write = capacity - file->of_offset;
+        }
+
+        // Blocks shared with clones of the file are copied before writing
+        // (from the end of the file, if there is a gap to zero-fill)
+        size_t first_pos = file->of_offset;
+        if (inode->i_size < first_pos) {
+            first_pos = inode->i_size;
+        }
+        size_t last_pos = file->of_offset + to_write - 1;
+        if (!inode_unshare_blocks(fs, inode, first_pos / block_size,
+                                  last_pos / block_size)) {
+            unlock_rwlock(inode_lock); // unlocks the latch
+            return -1;                 // no space
         }
 
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
+        // Zero-fill the gap left if the file shrank below our offset (e.g.
+        // truncated through another handle), which may hold stale data
+        for (size_t pos = inode->i_size; pos < file->of_offset;) {
+            size_t run;
+            int bnum = inode_block_run(inode, pos / block_size, &run);
+            char *block = data_block_get(fs, bnum);
+            size_t chunk = run * block_size - pos % block_size;
+            if (chunk > file->of_offset - pos) {
+                chunk = file->of_offset - pos;
+            }
+            memset(block + pos % block_size, 0, chunk);
+            pos += chunk;
+        }
 
-        // Perform the actual write
-        memcpy(block + file->of_offset, buffer, to_write);
+        // Perform the actual write, one copy per run of contiguous blocks
+        for (size_t done = 0; done < to_write;) {
+            size_t pos = file->of_offset + done;
+            size_t run;
+            int bnum = inode_block_run(inode, pos / block_size, &run);
+            char *block = data_block_get(fs, bnum);
+            ALWAYS_ASSERT(block != NULL,
+                          "tfs_write: data block deleted mid-write");
+
+            size_t chunk = run * block_size - pos % block_size;
+            if (chunk > to_write - done) {
+                chunk = to_write - done;
+            }
+            memcpy(block + pos % block_size, (char const *)buffer + done,
+                   chunk);
+            done += chunk;
+        }
 
         // The offset associated with the file handle is incremented accordingly
         file->of_offset += to_write;
@@ -306,42 +622,297 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
             inode->i_size = file->of_offset;
         }
     }
+    unlock_rwlock(inode_lock); // unlocks the latch
+
+    return (ssize_t)to_write;
+}
+
+/**
+ * Write the contents of the write buffer of a file handle to the file.
+ * The caller must hold the volume lock and the lock of the file handle.
+ *
+ * Returns 0 if successful, -1 otherwise (the buffered bytes that could not
+ * be written are dropped).
+ */
+static int file_flush(tfs_instance_t *fs, open_file_entry_t *file) {
+    size_t len = file->of_wbuf_len;
+    file->of_wbuf_len = 0;
+    if (len > 0 && file_write(fs, file, file->of_wbuf, len) != (ssize_t)len) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes to an open file (see tfs_write), without measuring it (for the
+ * writes made by other operations)
+ */
+static ssize_t write_untimed(tfs_instance_t *fs, int fhandle,
+                             void const *buffer, size_t to_write) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    pthread_rwlock_t *file_lock = get_open_file_table_lock(fs, fhandle);
+
+    if (atomic_load(&file->of_buffered)) {
+        // Small writes to a buffered handle only take the handle's lock
+        write_lock_rwlock(file_lock);
+        if (!atomic_load(&file->of_open)) {
+            unlock_rwlock(file_lock);
+            return -1; // closed meanwhile
+        }
+        if (file->of_wbuf != NULL &&
+            file->of_wbuf_len + to_write <= WRITE_BUFFER_SIZE) {
+            memcpy(file->of_wbuf + file->of_wbuf_len, buffer, to_write);
+            file->of_wbuf_len += to_write;
+            unlock_rwlock(file_lock);
+            return (ssize_t)to_write;
+        }
+        unlock_rwlock(file_lock); // the volume lock must be taken first
+    }
+
+    volume_enter(fs);
+    write_lock_rwlock(file_lock); // locks the latch of the file
+
+    ssize_t written;
+    if (!atomic_load(&file->of_open)) {
+        written = -1; // closed meanwhile
+    } else if (file->of_wbuf == NULL) {
+        written = file_write(fs, file, buffer, to_write);
+    } else if (file_flush(fs, file) == -1) {
+        written = -1; // no space for the buffered bytes
+    } else if (to_write >= WRITE_BUFFER_SIZE) {
+        written = file_write(fs, file, buffer, to_write);
+    } else {
+        memcpy(file->of_wbuf, buffer, to_write);
+        file->of_wbuf_len = to_write;
+        written = (ssize_t)to_write;
+    }
+
+    unlock_rwlock(file_lock); // unlocks the latches
+    volume_exit(fs);
+    return written;
+}
+
+ssize_t tfsi_write(tfs_instance_t *fs, int fhandle, void const *buffer,
+                   size_t to_write) {
+    uint64_t start = op_stats_begin(fs, TFS_STATS_WRITE);
+    ssize_t written = write_untimed(fs, fhandle, buffer, to_write);
+    op_stats_end(fs, TFS_STATS_WRITE, start, written);
+    return written;
+}
+
+int tfsi_flush(tfs_instance_t *fs, int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    if (!atomic_load(&file->of_buffered)) {
+        return 0; // not buffered
+    }
+
+    volume_enter(fs);
+    pthread_rwlock_t *file_lock = get_open_file_table_lock(fs, fhandle);
+    write_lock_rwlock(file_lock);
+    int result = -1; // closed meanwhile
+    if (atomic_load(&file->of_open)) {
+        result = file->of_wbuf != NULL ? file_flush(fs, file) : 0;
+    }
+    unlock_rwlock(file_lock);
+    volume_exit(fs);
+    return result;
+}
+
+int tfsi_close(tfs_instance_t *fs, int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1; // invalid fd
+    }
+
+    volume_enter(fs);
+    pthread_rwlock_t *file_lock = get_open_file_table_lock(fs, fhandle);
+    write_lock_rwlock(file_lock); // no other operation uses the handle
+    if (!atomic_load(&file->of_open)) {
+        unlock_rwlock(file_lock);
+        volume_exit(fs);
+        return -1; // closed meanwhile
+    }
+
+    // writes the buffered bytes (if any) before closing
+    int result = file->of_wbuf != NULL ? file_flush(fs, file) : 0;
+    int inumber = file->of_inumber;
+    remove_from_open_file_table(fs, fhandle);
+    unlock_rwlock(file_lock);
+    volume_exit(fs);
+
+    // the preallocated blocks that were not used are released once no other
+    // handle (which may have preallocated them) is open on the file
+    inode_drop(fs, inumber);
+
+    return result;
+}
+
+int tfsi_fallocate(tfs_instance_t *fs, int fhandle, size_t offset, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    size_t block_size = state_block_size(fs);
+    if (offset > SIZE_MAX - len || offset + len > SIZE_MAX - block_size) {
+        return -1; // the end of the range does not fit in a size_t
+    }
+    if (len == 0) {
+        return 0; // nothing to preallocate
+    }
+
+    volume_enter(fs);
+    pthread_rwlock_t *file_lock = get_open_file_table_lock(fs, fhandle);
+    write_lock_rwlock(file_lock); // locks the latch of the file
+    if (!atomic_load(&file->of_open)) {
+        unlock_rwlock(file_lock);
+        volume_exit(fs);
+        return -1; // closed meanwhile
+    }
+
+    inode_t *inode = inode_get(fs, file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_fallocate: inode of open file deleted");
+
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, file->of_inumber);
+    write_lock_rwlock(inode_lock); // locks the latch of the inode
+
+    // Allocate the blocks missing to hold offset + len bytes (if any)
+    size_t needed = (offset + len + block_size - 1) / block_size;
+    size_t block_count = inode_block_count(inode);
+    if (needed > block_count) {
+        block_count += inode_alloc_blocks(fs, inode, needed - block_count);
+    }
+    inode_mark_preallocated(fs, file->of_inumber);
+
     unlock_rwlock(file_lock); // unlocks the latches
     unlock_rwlock(inode_lock);
+    volume_exit(fs);
 
-    return (ssize_t)to_write;
+    return block_count >= needed ? 0 : -1;
 }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
+/**
+ * Prefetch the blocks that a sequential reader of a file is about to read.
+ *
+ * A read is sequential if it starts where the previous read on the same file
+ * handle stopped. The window of blocks kept prefetched past the last block
+ * read doubles on each sequential read (up to the readahead_blocks
+ * parameter), and any other read turns readahead off until reads are
+ * sequential again.
+ *
+ * Input:
+ *   - file: the open file entry (locked by the caller)
+ *   - inode: its inode (locked by the caller)
+ *   - first, last: range of blocks of the file just read
+ */
+static void readahead(tfs_instance_t *fs, open_file_entry_t *file,
+                      inode_t const *inode, size_t first, size_t last) {
+    if (first != file->of_ra_next) {
+        file->of_ra_window = 0;
+        file->of_ra_end = 0;
+        return;
+    }
+    size_t max_window = state_readahead_blocks(fs);
+    if (file->of_ra_window == 0) {
+        file->of_ra_window = READAHEAD_MIN_BLOCKS;
+    } else {
+        file->of_ra_window *= 2;
+    }
+    if (file->of_ra_window > max_window) {
+        file->of_ra_window = max_window;
+    }
+
+    // only the blocks not requested yet, within the file
+    size_t block_size = state_block_size(fs);
+    size_t file_blocks = (inode->i_size + block_size - 1) / block_size;
+    size_t from = file->of_ra_end > last + 1 ? file->of_ra_end : last + 1;
+    size_t to = last + 1 + file->of_ra_window;
+    if (to > file_blocks) {
+        to = file_blocks;
+    }
+    for (size_t b = from; b < to;) {
+        size_t run;
+        int bnum = inode_block_run(inode, b, &run);
+        if (run > to - b) {
+            run = to - b;
+        }
+        data_blocks_prefetch(fs, bnum, run);
+        b += run;
+    }
+    if (to > file->of_ra_end) {
+        file->of_ra_end = to;
+    }
+}
+
+/*
+ * Reads from an open file (see tfs_read), without measuring it
+ */
+static ssize_t read_untimed(tfs_instance_t *fs, int fhandle, void *buffer,
+                            size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
     if (file == NULL) {
         return -1;
     }
-    pthread_rwlock_t *file_lock = get_open_file_table_lock(fhandle);
+    // reads past the bytes buffered by this handle
+    if (atomic_load(&file->of_buffered) && tfsi_flush(fs, fhandle) == -1) {
+        return -1;
+    }
+    pthread_rwlock_t *file_lock = get_open_file_table_lock(fs, fhandle);
     write_lock_rwlock(file_lock); // locks the latch of the file for writing
+    if (!atomic_load(&file->of_open)) {
+        unlock_rwlock(file_lock);
+        return -1; // closed meanwhile
+    }
 
     // From the open file table entry, we get the inode
-    inode_t const *inode = inode_get(file->of_inumber);
+    inode_t const *inode = inode_get(fs, file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
 
-    pthread_rwlock_t *inode_lock = get_inode_table_lock(file->of_inumber);
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, file->of_inumber);
     write_lock_rwlock(inode_lock); // locks the latch of the inode for writing
 
     // Determine how many bytes to read
-    size_t to_read = inode->i_size - file->of_offset;
+    size_t to_read = 0;
+    if (file->of_offset < inode->i_size) {
+        to_read = inode->i_size - file->of_offset;
+    }
     if (to_read > len) {
         to_read = len;
     }
 
     if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
+        // Perform the actual read, one copy per run of contiguous blocks
+        size_t block_size = state_block_size(fs);
+        for (size_t done = 0; done < to_read;) {
+            size_t pos = file->of_offset + done;
+            size_t run;
+            int bnum = inode_block_run(inode, pos / block_size, &run);
+
+            size_t chunk = run * block_size - pos % block_size;
+            if (chunk > to_read - done) {
+                chunk = to_read - done;
+            }
+            size_t blocks = (pos % block_size + chunk - 1) / block_size + 1;
+            char const *block = data_blocks_read(fs, bnum, blocks);
+            ALWAYS_ASSERT(block != NULL,
+                          "tfs_read: data block deleted mid-read");
+
+            memcpy((char *)buffer + done, block + pos % block_size, chunk);
+            done += chunk;
+        }
+
+        readahead(fs, file, inode, file->of_offset / block_size,
+                  (file->of_offset + to_read - 1) / block_size);
 
-        // Perform the actual read
-        memcpy(buffer, block + file->of_offset, to_read);
         // The offs´et associated with the file handle is incremented
         // accordingly
         file->of_offset += to_read;
+        file->of_ra_next = file->of_offset / block_size;
     }
 
     unlock_rwlock(file_lock); // unlocks the latches
@@ -349,18 +920,40 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
     return (ssize_t)to_read;
 }
 
-int tfs_unlink(char const *target) {
-    inode_t *root = inode_get(ROOT_DIR_INUM); // 0 - root inumber
-    int target_inumber = tfs_lookup(target);  // ve se o target existe
-    if (root == NULL || target_inumber == -1) {
+ssize_t tfsi_read(tfs_instance_t *fs, int fhandle, void *buffer, size_t len) {
+    uint64_t start = op_stats_begin(fs, TFS_STATS_READ);
+    ssize_t read_bytes = read_untimed(fs, fhandle, buffer, len);
+    op_stats_end(fs, TFS_STATS_READ, start, read_bytes);
+    return read_bytes;
+}
+
+/*
+ * Removes a name (see tfs_unlink), without measuring it
+ */
+static int unlink_untimed(tfs_instance_t *fs, char const *target) {
+    inode_t *root = inode_get(fs, ROOT_DIR_INUM); // 0 - root inumber
+    if (root == NULL) {
+        return -1;
+    }
+    volume_enter(fs);
+    // the name is looked up and cleared with no other change to the
+    // directory in between (which tfs_opendir also waits for)
+    pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+    write_lock_rwlock(batch_lock);
+    int target_inumber = tfsi_lookup(fs, target); // ve se o target existe
+    if (target_inumber == -1) {
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
         return -1;
     }
-    pthread_rwlock_t *inode_lock = get_inode_table_lock(target_inumber);
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, target_inumber);
     write_lock_rwlock(inode_lock); // locks the latch of the inode for writing
 
-    inode_t *target_inode = inode_get(target_inumber);
+    inode_t *target_inode = inode_get(fs, target_inumber);
     if (target_inode == NULL) {
         unlock_rwlock(inode_lock); // unlocks the latches
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
         return -1;
     }
     if (target_inode->i_hardlink_counter >= 1 &&
@@ -368,81 +961,1339 @@ int tfs_unlink(char const *target) {
         // here the target file itself is a file or a hard link
         target_inode->i_hardlink_counter--;
         if (target_inode->i_hardlink_counter == 0) {
-            // if it hits zero then the inode is deleted
-            clear_dir_entry(root, target + 1); // clear the directory entry
-            inode_delete(target_inumber);      // deletes the inode
-            unlock_rwlock(inode_lock);         // unlocks the latches
+            // if it hits zero then the inode is deleted (by the last close,
+            // if it is open)
+            clear_dir_entry(fs, root, target + 1); // clear the directory entry
+            if (inode_unlink(fs, target_inumber)) {
+                inode_delete(fs, target_inumber); // deletes the inode
+            }
+            unlock_rwlock(inode_lock); // unlocks the latches
+            unlock_rwlock(batch_lock);
+            volume_exit(fs);
             return 0;
         }
         // if not, it just clears the directory and unlocks the inode latch
-        clear_dir_entry(root, target + 1);
+        clear_dir_entry(fs, root, target + 1);
         unlock_rwlock(inode_lock);
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
         return 0;
     } else if (target_inode->i_node_type & T_SYMLINK) {
-        // if the target is a sym link then it deletes the inode
-        // and clears the respective directory entry
-        clear_dir_entry(root, target + 1);
-        inode_delete(target_inumber);
+        // if the target is a sym link then it deletes the inode (unless it is
+        // pinned while being followed) and clears the respective directory
+        // entry
+        clear_dir_entry(fs, root, target + 1);
+        if (inode_unlink(fs, target_inumber)) {
+            inode_delete(fs, target_inumber);
+        }
         unlock_rwlock(inode_lock); // unlocks the latch
-        return -1;
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
+        return 0;
     } else {
         unlock_rwlock(inode_lock); // unlocks the latch
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
         return -1;
     }
 }
 
-int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
-    FILE *source_file = fopen(source_path, "r");
-    if (source_file == NULL) {
-        return -1;
+int tfsi_unlink(tfs_instance_t *fs, char const *target) {
+    uint64_t start = op_stats_begin(fs, TFS_STATS_UNLINK);
+    int result = unlink_untimed(fs, target);
+    op_stats_end(fs, TFS_STATS_UNLINK, start, result);
+    return result;
+}
+
+/**
+ * Look up several absolute path names in the root directory, in a single
+ * pass (see find_in_dir_many).
+ *
+ * Input:
+ *   - names: absolute path names
+ *   - count: number of names
+ *   - sub_names: where to store the names without the initial '/' (NULL for
+ *     invalid names, which are not looked up)
+ *
+ * Returns the lookups (to be freed by the caller), or NULL in case of error.
+ */
+static dir_lookup_t *lookup_many(tfs_instance_t *fs, char const *const *names,
+                                 size_t count, char const **sub_names) {
+    dir_lookup_t *lookups = malloc(count * sizeof(dir_lookup_t));
+    if (lookups == NULL) {
+        return NULL;
+    }
+    for (size_t j = 0; j < count; j++) {
+        sub_names[j] = NULL;
+        if (valid_pathname(names[j]) &&
+            strlen(names[j] + 1) <= MAX_FILE_NAME - 1) {
+            sub_names[j] = names[j] + 1;
+        }
+    }
+    if (find_in_dir_many(fs, inode_get(fs, ROOT_DIR_INUM), sub_names, count,
+                         lookups) == -1) {
+        free(lookups);
+        return NULL;
+    }
+    return lookups;
+}
+
+int tfsi_create_many(tfs_instance_t *fs, char const *const *names,
+                     size_t count, int *results) {
+    for (size_t j = 0; j < count; j++) {
+        results[j] = -1;
+    }
+    char const **sub_names = malloc(count * sizeof(char const *));
+    dir_entry_t *entries = malloc(count * sizeof(dir_entry_t));
+    int *inumbers = malloc(count * sizeof(int));
+    if (count == 0 || sub_names == NULL || entries == NULL ||
+        inumbers == NULL) {
+        free(sub_names);
+        free(entries);
+        free(inumbers);
+        return count == 0 ? 0 : -1;
     }
 
-    int dest_handle = tfs_open(dest_path, TFS_O_CREAT | TFS_O_TRUNC);
-    if (dest_handle == -1) {
+    volume_enter(fs);
+    // no other name is added from the lookup until the missing names are, and
+    // the batch is listed entirely or not at all
+    pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+    write_lock_rwlock(batch_lock);
+    dir_lookup_t *lookups = lookup_many(fs, names, count, sub_names);
+    if (lookups == NULL) {
+        unlock_rwlock(batch_lock);
+        volume_exit(fs);
+        free(sub_names);
+        free(entries);
+        free(inumbers);
         return -1;
     }
 
-    open_file_entry_t *dest_file = get_open_file_entry(dest_handle);
-    if (dest_file == NULL) {
-        return -1;
+    // creates the missing files (once per name), and adds them all at once
+    size_t missing = 0;
+    for (size_t j = 0; j < count; j++) {
+        if (sub_names[j] != NULL && lookups[j].dl_inumber == -1 &&
+            lookups[j].dl_first == j) {
+            dir_entry_t *entry = &entries[missing++];
+            memset(entry->d_name, 0, MAX_FILE_NAME);
+            memcpy(entry->d_name, sub_names[j], strlen(sub_names[j]));
+        }
+    }
+    size_t created = inodes_create(fs, T_FILE, inumbers, missing);
+    for (size_t k = 0; k < created; k++) {
+        entries[k].d_inumber = inumbers[k];
+    }
+    size_t added =
+        add_dir_entries(fs, inode_get(fs, ROOT_DIR_INUM), entries, created);
+    unlock_rwlock(batch_lock);
+    for (size_t k = added; k < created; k++) {
+        inode_delete(fs, inumbers[k]); // no space in directory
+    }
+    volume_exit(fs);
+
+    // the files added are the first missing ones, in order
+    size_t k = 0;
+    for (size_t j = 0; j < count; j++) {
+        if (sub_names[j] != NULL && lookups[j].dl_inumber == -1 &&
+            lookups[j].dl_first == j) {
+            if (k < added) {
+                lookups[j].dl_inumber = inumbers[k];
+            }
+            k++;
+        }
+    }
+    int result = 0;
+    for (size_t j = 0; j < count; j++) {
+        if (sub_names[j] != NULL &&
+            lookups[lookups[j].dl_first].dl_inumber != -1) {
+            results[j] = 0;
+        } else {
+            result = -1;
+        }
     }
 
-    int dest_inum = dest_file->of_inumber;
-    inode_t *dest_inode = inode_get(dest_inum);
-    if (dest_inode == NULL) {
-        return -1;
+    free(lookups);
+    free(sub_names);
+    free(entries);
+    free(inumbers);
+    return result;
+}
+
+int tfsi_unlink_many(tfs_instance_t *fs, char const *const *names,
+                     size_t count, int *results) {
+    for (size_t j = 0; j < count; j++) {
+        results[j] = -1;
+    }
+    char const **sub_names = malloc(count * sizeof(char const *));
+    if (count == 0 || sub_names == NULL) {
+        free(sub_names);
+        return count == 0 ? 0 : -1;
     }
 
-    size_t bytes_read;
-    void *buffer;
-    buffer = malloc(tfs_default_params().block_size);
-    if (buffer == NULL) {
+    volume_enter(fs);
+    dir_lookup_t *lookups = lookup_many(fs, names, count, sub_names);
+    if (lookups == NULL) {
+        volume_exit(fs);
+        free(sub_names);
         return -1;
     }
 
-    do {
-        memset(buffer, 0, tfs_default_params().block_size);
-        bytes_read =
-            fread(buffer, 1, tfs_default_params().block_size, source_file);
-        if (bytes_read == -1) {
-            free(buffer);
-            return -1;
+    int result = 0;
+    inode_t *root = inode_get(fs, ROOT_DIR_INUM);
+    pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+    write_lock_rwlock(batch_lock); // listed entirely or not at all
+    for (size_t j = 0; j < count; j++) {
+        int inumber = lookups[j].dl_inumber;
+        if (inumber == -1 || lookups[j].dl_first != j) {
+            result = -1;
+            continue;
         }
-        size_t bytes_to_be_written = bytes_read;
-        ssize_t bytes_written = tfs_write(dest_handle, buffer, bytes_read);
-        if (bytes_written != bytes_to_be_written) {
-            free(buffer);
-            return -1;
+        pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inumber);
+        write_lock_rwlock(inode_lock);
+        // the entry may have been removed since it was looked up
+        if (clear_dir_entry_at(fs, root, &lookups[j], sub_names[j]) == 0) {
+            inode_t *inode = inode_get(fs, inumber);
+            if ((inode->i_node_type == T_SYMLINK ||
+                 --inode->i_hardlink_counter == 0) &&
+                inode_unlink(fs, inumber)) {
+                inode_delete(fs, inumber); // or by the last close, if open
+            }
+            results[j] = 0;
+        } else {
+            result = -1;
         }
-    } while (bytes_read ==
-             tfs_default_params()
-                 .block_size); // stops when it reads less than BLOCK_SIZE bytes
+        unlock_rwlock(inode_lock);
+    }
+    unlock_rwlock(batch_lock);
+    volume_exit(fs);
 
-    free(buffer);
+    free(lookups);
+    free(sub_names);
+    return result;
+}
 
-    fclose(source_file);
-    if (tfs_close(dest_handle) == -1) {
-        return -1;
+/**
+ * Obtain the status of a file.
+ *
+ * Input:
+ *   - inumber: the file's inumber
+ *   - stat: where to store its status
+ */
+static void inode_stat(tfs_instance_t *fs, int inumber, tfs_stat_t *stat) {
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inumber);
+    read_lock_rwlock(inode_lock);
+    inode_t const *inode = inode_get(fs, inumber);
+    stat->st_inumber = inumber;
+    switch (inode->i_node_type) {
+    case T_FILE:
+        stat->st_type = TFS_T_FILE;
+        break;
+    case T_DIRECTORY:
+        stat->st_type = TFS_T_DIRECTORY;
+        break;
+    case T_SYMLINK:
+        stat->st_type = TFS_T_SYMLINK;
+        break;
+    default:
+        PANIC("inode_stat: unknown file type");
     }
+    stat->st_size = inode->i_size;
+    stat->st_blocks = inode_block_count(inode);
+    stat->st_nlink = inode->i_hardlink_counter;
+    unlock_rwlock(inode_lock);
+}
+
+int tfsi_stat_many(tfs_instance_t *fs, char const *const *names, size_t count,
+                   tfs_stat_t *stats) {
+    char const **sub_names = malloc(count * sizeof(char const *));
+    if (count == 0 || sub_names == NULL) {
+        free(sub_names);
+        return count == 0 ? 0 : -1;
+    }
+    dir_lookup_t *lookups = lookup_many(fs, names, count, sub_names);
+    if (lookups == NULL) {
+        free(sub_names);
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t j = 0; j < count; j++) {
+        if (lookups[j].dl_inumber == -1) {
+            memset(&stats[j], 0, sizeof(tfs_stat_t));
+            stats[j].st_inumber = -1;
+            result = -1;
+        } else {
+            inode_stat(fs, lookups[j].dl_inumber, &stats[j]);
+        }
+    }
+
+    free(lookups);
+    free(sub_names);
+    return result;
+}
+
+int tfsi_stat(tfs_instance_t *fs, char const *name, tfs_stat_t *stat) {
+    int inumber = tfsi_lookup(fs, name);
+    if (inumber == -1) {
+        return -1;
+    }
+    inode_stat(fs, inumber, stat);
     return 0;
 }
+
+/*
+ * Open directory (see tfs_opendir): a copy of the directory block
+ */
+struct tfs_dir {
+    size_t d_entry_count;
+    size_t d_next; // next entry to check
+    tfs_dirent_t d_current;
+    dir_entry_t d_entries[];
+};
+
+tfs_dir_t *tfsi_opendir(tfs_instance_t *fs, char const *path) {
+    if (path == NULL || strcmp(path, "/") != 0) {
+        return NULL; // only the root directory exists
+    }
+    size_t entry_count = state_block_size(fs) / sizeof(dir_entry_t);
+    tfs_dir_t *dir =
+        malloc(sizeof(tfs_dir_t) + entry_count * sizeof(dir_entry_t));
+    if (dir == NULL) {
+        return NULL;
+    }
+    dir->d_entry_count = entry_count;
+    dir->d_next = 0;
+
+    // no change to the entries is copied halfway
+    pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+    read_lock_rwlock(batch_lock);
+    copy_dir_entries(fs, inode_get(fs, ROOT_DIR_INUM), dir->d_entries);
+    unlock_rwlock(batch_lock);
+    return dir;
+}
+
+tfs_dirent_t const *tfs_readdir(tfs_dir_t *dir) {
+    while (dir->d_next < dir->d_entry_count) {
+        dir_entry_t const *entry = &dir->d_entries[dir->d_next++];
+        if (entry->d_inumber != -1) {
+            memcpy(dir->d_current.d_name, entry->d_name, MAX_FILE_NAME);
+            dir->d_current.d_inumber = entry->d_inumber;
+            return &dir->d_current;
+        }
+    }
+    return NULL;
+}
+
+void tfs_closedir(tfs_dir_t *dir) { free(dir); }
+
+/**
+ * Write the whole contents of a host file descriptor to an open file, with
+ * large reads (for sources that cannot be mapped, e.g. pipes).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int copy_from_fd(tfs_instance_t *fs, int source_fd, int dest_handle) {
+    size_t buffer_size = COPY_BUFFER_BLOCKS * state_block_size(fs);
+    char *buffer = malloc(buffer_size);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    for (;;) {
+        ssize_t bytes_read = read(source_fd, buffer, buffer_size);
+        if (bytes_read <= 0) {
+            result = bytes_read == 0 ? 0 : -1; // stops at the end of the file
+            break;
+        }
+        if (write_untimed(fs, dest_handle, buffer, (size_t)bytes_read) !=
+            bytes_read) {
+            result = -1; // no space
+            break;
+        }
+    }
+
+    free(buffer);
+    return result;
+}
+
+/**
+ * Copy the contents of an open host file to a file in TécnicoFS (see
+ * tfs_copy_from_external_fs).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int copy_from_source(tfs_instance_t *fs, int source_fd,
+                            char const *dest_path) {
+    struct stat source_stat;
+    if (fstat(source_fd, &source_stat) == -1) {
+        return -1;
+    }
+
+    int dest_handle = open_untimed(fs, dest_path, TFS_O_CREAT | TFS_O_TRUNC);
+    if (dest_handle == -1) {
+        return -1;
+    }
+
+    int result = 0;
+    size_t size = (size_t)source_stat.st_size;
+    if (S_ISREG(source_stat.st_mode) && size > 0) {
+        // maps the source, so that tfs_write copies it straight to the data
+        // blocks (all allocated at once, one copy per run of blocks)
+        void *source = mmap(NULL, size, PROT_READ, MAP_PRIVATE, source_fd, 0);
+        if (source == MAP_FAILED) {
+            result = copy_from_fd(fs, source_fd, dest_handle);
+        } else {
+            posix_madvise(source, size, POSIX_MADV_SEQUENTIAL);
+            if (write_untimed(fs, dest_handle, source, size) !=
+                (ssize_t)size) {
+                result = -1; // no space
+            }
+            munmap(source, size);
+        }
+    } else if (!S_ISREG(source_stat.st_mode)) {
+        result = copy_from_fd(fs, source_fd, dest_handle);
+    }
+
+    if (tfsi_close(fs, dest_handle) == -1) {
+        return -1;
+    }
+    return result;
+}
+
+int tfsi_copy_from_external_fs(tfs_instance_t *fs, char const *source_path,
+                               char const *dest_path) {
+    uint64_t start = op_stats_begin(fs, TFS_STATS_COPY_FROM_EXTERNAL_FS);
+    int result = -1;
+    int source_fd = open(source_path, O_RDONLY);
+    if (source_fd != -1) {
+        result = copy_from_source(fs, source_fd, dest_path);
+        close(source_fd);
+    }
+    op_stats_end(fs, TFS_STATS_COPY_FROM_EXTERNAL_FS, start, result);
+    return result;
+}
+
+/*
+ * Bulk import (see tfs_bulk_import): the workers claim the next import from a
+ * shared counter
+ */
+typedef struct {
+    tfs_instance_t *fs;
+    tfs_import_t *imports;
+    size_t count;
+    atomic_size_t next;
+} bulk_import_t;
+
+/**
+ * Open the source of an import, and start reading it in the background.
+ *
+ * Returns the file descriptor, or -1 if it cannot be opened.
+ */
+static int bulk_import_open(tfs_import_t const *import) {
+    int fd = open(import->source_path, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    return fd;
+}
+
+static void *bulk_import_worker(void *arg) {
+    bulk_import_t *bulk = (bulk_import_t *)arg;
+    tfs_instance_t *fs = bulk->fs;
+
+    // the next source is opened (and read ahead by the OS) before the current
+    // one is copied, so host reads overlap with the writes to TécnicoFS
+    size_t current = atomic_fetch_add(&bulk->next, 1);
+    int current_fd = -1;
+    if (current < bulk->count) {
+        current_fd = bulk_import_open(&bulk->imports[current]);
+    }
+    while (current < bulk->count) {
+        size_t next = atomic_fetch_add(&bulk->next, 1);
+        int next_fd = -1;
+        if (next < bulk->count) {
+            next_fd = bulk_import_open(&bulk->imports[next]);
+        }
+
+        tfs_import_t *import = &bulk->imports[current];
+        import->result = -1;
+        if (current_fd != -1) {
+            import->result =
+                copy_from_source(fs, current_fd, import->dest_path);
+            close(current_fd);
+        }
+
+        current = next;
+        current_fd = next_fd;
+    }
+    return NULL;
+}
+
+int tfsi_bulk_import(tfs_instance_t *fs, tfs_import_t *imports, size_t count,
+                     size_t worker_count) {
+    if (count == 0) {
+        return 0;
+    }
+    bulk_import_t bulk = {.fs = fs, .imports = imports, .count = count};
+    atomic_init(&bulk.next, 0);
+
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+    if (worker_count > count) {
+        worker_count = count;
+    }
+    pthread_t *workers = malloc(worker_count * sizeof(pthread_t));
+    if (workers == NULL) {
+        return -1;
+    }
+
+    // the calling thread is one of the workers
+    size_t started = 1;
+    for (; started < worker_count; started++) {
+        if (pthread_create(&workers[started], NULL, bulk_import_worker,
+                           &bulk) != 0) {
+            break; // the workers started so far do the whole job
+        }
+    }
+    bulk_import_worker(&bulk);
+    for (size_t i = 1; i < started; i++) {
+        if (pthread_join(workers[i], NULL) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(workers);
+
+    int result = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (imports[i].result != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+int tfsi_copy_to_external_fs(tfs_instance_t *fs, char const *source_path,
+                             char const *dest_path) {
+    // like tfs_open, copies the target of a symbolic link, which is pinned so
+    // that its inode is not reused by another file until it is shared
+    int inumber = lookup_and_pin_file(fs, source_path);
+    if (inumber == -1) {
+        return -1;
+    }
+    inode_t *inode = inode_get(fs, inumber);
+
+    // shares the blocks of the file with a private copy of the inode, so that
+    // the (slow) writes to the host do not hold the inode lock: writers copy
+    // the blocks they change meanwhile (see inode_unshare_blocks)
+    inode_t copy = {.i_node_type = T_FILE, .i_extent_count = 0};
+    volume_enter(fs);
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inumber);
+    read_lock_rwlock(inode_lock);
+    inode_share_blocks(fs, inode, &copy);
+    unlock_rwlock(inode_lock);
+    volume_exit(fs);
+    inode_drop(fs, inumber);
+
+    size_t block_size = state_block_size(fs);
+    inode_trim_blocks(fs, &copy, (copy.i_size + block_size - 1) / block_size);
+
+    int result = -1;
+    int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dest_fd != -1) {
+        result = 0;
+        // one write per run of contiguous blocks, straight from the blocks
+        // (in order, so that the destination may also be a pipe)
+        for (size_t pos = 0; pos < copy.i_size && result == 0;) {
+            size_t run;
+            int bnum = inode_block_run(&copy, pos / block_size, &run);
+            char const *block = data_block_get(fs, bnum);
+            size_t chunk = run * block_size - pos % block_size;
+            if (chunk > copy.i_size - pos) {
+                chunk = copy.i_size - pos;
+            }
+
+            ssize_t written = write(dest_fd, block + pos % block_size, chunk);
+            if (written > 0) {
+                pos += (size_t)written; // may be a partial write
+            } else if (written == 0 || errno != EINTR) {
+                result = -1;
+            }
+        }
+        if (close(dest_fd) != 0) {
+            result = -1;
+        }
+    }
+
+    inode_free_blocks(fs, &copy);
+    return result;
+}
+
+/*
+ * Volume snapshot: a copy of the root directory and of the inodes it refers
+ * to. The data blocks are not copied but shared (see inode_share_blocks), so
+ * writers copy a block the first time they change it after the snapshot.
+ */
+typedef struct {
+    inode_t sf_inode; // only the type, size and extents are used
+    char sf_symlink_target[MAX_FILE_NAME];
+} snapshot_file_t;
+
+struct tfs_snapshot {
+    tfs_instance_t *s_fs; // the volume the blocks belong to
+    size_t s_entry_count;
+    dir_entry_t *s_entries;   // copy of the root directory
+    snapshot_file_t *s_files; // one per (used) directory entry
+};
+
+tfs_snapshot_t *tfsi_snapshot(tfs_instance_t *fs) {
+    size_t block_size = state_block_size(fs);
+    size_t entry_count = block_size / sizeof(dir_entry_t);
+
+    tfs_snapshot_t *snapshot = malloc(sizeof(tfs_snapshot_t));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->s_fs = fs;
+    snapshot->s_entry_count = entry_count;
+    snapshot->s_entries = malloc(entry_count * sizeof(dir_entry_t));
+    snapshot->s_files =
+        aligned_alloc(CACHE_LINE_SIZE, entry_count * sizeof(snapshot_file_t));
+    if (snapshot->s_entries == NULL || snapshot->s_files == NULL) {
+        free(snapshot->s_entries);
+        free(snapshot->s_files);
+        free(snapshot);
+        return NULL;
+    }
+
+    volume_freeze(fs); // while the metadata is copied
+
+    inode_t const *root = inode_get(fs, ROOT_DIR_INUM);
+    memcpy(snapshot->s_entries,
+           data_block_get(fs, root->i_extents[0].e_start),
+           entry_count * sizeof(dir_entry_t));
+
+    for (size_t i = 0; i < entry_count; i++) {
+        int inumber = snapshot->s_entries[i].d_inumber;
+        if (inumber == -1) {
+            continue;
+        }
+
+        // hard links are captured once per name
+        inode_t const *inode = inode_get(fs, inumber);
+        inode_t *copy = &snapshot->s_files[i].sf_inode;
+        copy->i_node_type = inode->i_node_type;
+        copy->i_hardlink_counter = 1;
+        copy->i_size = 0;
+        copy->i_extent_count = 0;
+        if (inode->i_node_type == T_SYMLINK) {
+            memcpy(snapshot->s_files[i].sf_symlink_target,
+                   inode_symlink_target(fs, inumber), MAX_FILE_NAME);
+            continue;
+        }
+
+        pthread_rwlock_t *inode_lock = get_inode_table_lock(fs, inumber);
+        read_lock_rwlock(inode_lock); // readers may still hold it
+        inode_share_blocks(fs, inode, copy);
+        unlock_rwlock(inode_lock);
+
+        // preallocated blocks past the end of the file are not captured
+        inode_trim_blocks(fs, copy,
+                          (copy->i_size + block_size - 1) / block_size);
+    }
+
+    volume_thaw(fs);
+    return snapshot;
+}
+
+/**
+ * Find a name in the root directory of a snapshot.
+ *
+ * Returns the captured file, or NULL if there is no such name.
+ */
+static snapshot_file_t const *snapshot_find(tfs_snapshot_t const *snapshot,
+                                            char const *name) {
+    if (!valid_pathname(name)) {
+        return NULL;
+    }
+    // skip the initial '/' character
+    name++;
+
+    for (size_t i = 0; i < snapshot->s_entry_count; i++) {
+        dir_entry_t const *entry = &snapshot->s_entries[i];
+        if (entry->d_inumber != -1 &&
+            strncmp(entry->d_name, name, MAX_FILE_NAME) == 0) {
+            return &snapshot->s_files[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Copy bytes of a captured file, one copy per run of contiguous blocks.
+ * The blocks of a snapshot are never written to, so no locks are needed.
+ */
+static size_t snapshot_copy(tfs_instance_t *fs, inode_t const *inode,
+                            size_t offset, void *buffer, size_t len) {
+    if (offset >= inode->i_size) {
+        return 0;
+    }
+    if (len > inode->i_size - offset) {
+        len = inode->i_size - offset;
+    }
+
+    size_t block_size = state_block_size(fs);
+    for (size_t done = 0; done < len;) {
+        size_t pos = offset + done;
+        size_t run;
+        int bnum = inode_block_run(inode, pos / block_size, &run);
+        char const *block = data_block_get(fs, bnum);
+
+        size_t chunk = run * block_size - pos % block_size;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        memcpy((char *)buffer + done, block + pos % block_size, chunk);
+        done += chunk;
+    }
+    return len;
+}
+
+ssize_t tfs_snapshot_read(tfs_snapshot_t const *snapshot, char const *name,
+                          size_t offset, void *buffer, size_t len) {
+    tfs_instance_t *fs = snapshot->s_fs;
+    snapshot_file_t const *file = snapshot_find(snapshot, name);
+    if (file != NULL && file->sf_inode.i_node_type == T_SYMLINK) {
+        // like tfs_open, reads the target of a symbolic link
+        file = snapshot_find(snapshot, file->sf_symlink_target);
+    }
+    if (file == NULL || file->sf_inode.i_node_type != T_FILE) {
+        return -1;
+    }
+    return (ssize_t)snapshot_copy(fs, &file->sf_inode, offset, buffer, len);
+}
+
+int tfs_snapshot_export(tfs_snapshot_t const *snapshot, char const *dest_dir) {
+    tfs_instance_t *fs = snapshot->s_fs;
+    size_t block_size = state_block_size(fs);
+    int result = 0;
+    for (size_t i = 0; i < snapshot->s_entry_count && result == 0; i++) {
+        dir_entry_t const *entry = &snapshot->s_entries[i];
+        if (entry->d_inumber == -1) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%.*s", dest_dir, MAX_FILE_NAME,
+                     entry->d_name) >= sizeof(path)) {
+            result = -1;
+            break;
+        }
+
+        snapshot_file_t const *file = &snapshot->s_files[i];
+        if (file->sf_inode.i_node_type == T_SYMLINK) {
+            // the links stay relative to the exported root directory
+            if (symlink(file->sf_symlink_target + 1, path) != 0) {
+                result = -1;
+            }
+            continue;
+        }
+
+        FILE *dest = fopen(path, "w");
+        if (dest == NULL) {
+            result = -1;
+            break;
+        }
+        // one write per run of contiguous blocks, straight from the blocks
+        inode_t const *inode = &file->sf_inode;
+        for (size_t pos = 0; pos < inode->i_size;) {
+            size_t run;
+            int bnum = inode_block_run(inode, pos / block_size, &run);
+            size_t chunk = run * block_size;
+            if (chunk > inode->i_size - pos) {
+                chunk = inode->i_size - pos;
+            }
+            if (fwrite(data_block_get(fs, bnum), 1, chunk, dest) != chunk) {
+                result = -1;
+                break;
+            }
+            pos += chunk;
+        }
+        if (fclose(dest) != 0) {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+void tfs_snapshot_release(tfs_snapshot_t *snapshot) {
+    tfs_instance_t *fs = snapshot->s_fs;
+    for (size_t i = 0; i < snapshot->s_entry_count; i++) {
+        if (snapshot->s_entries[i].d_inumber != -1) {
+            // drops the snapshot's references to the shared blocks
+            inode_free_blocks(fs, &snapshot->s_files[i].sf_inode);
+        }
+    }
+    free(snapshot->s_entries);
+    free(snapshot->s_files);
+    free(snapshot);
+}
+
+/*
+ * Volume image (see tfs_dump): a header followed by one entry per name of the
+ * root directory, each followed by its data (the contents of a file, or the
+ * target of a symbolic link). Hard links to a file already in the image carry
+ * no data. Integers are in the host's byte order.
+ */
+#define IMAGE_MAGIC "TFSIMG1"
+
+typedef struct {
+    char ih_magic[8];
+    uint64_t ih_entry_count;
+} image_header_t;
+
+typedef struct {
+    char ie_name[MAX_FILE_NAME];
+    int32_t ie_type;    // inode_type
+    int32_t ie_link_of; // index of an earlier entry with the same file, or -1
+    uint64_t ie_size;   // bytes of data following the entry
+} image_entry_t;
+
+int tfsi_dump(tfs_instance_t *fs, char const *image_path) {
+    tfs_snapshot_t *snapshot = tfsi_snapshot(fs);
+    if (snapshot == NULL) {
+        return -1;
+    }
+
+    // index in the image of the first name of each inode (for hard links)
+    int max_inumber = -1;
+    image_header_t header = {.ih_magic = IMAGE_MAGIC, .ih_entry_count = 0};
+    for (size_t i = 0; i < snapshot->s_entry_count; i++) {
+        int inumber = snapshot->s_entries[i].d_inumber;
+        if (inumber != -1) {
+            header.ih_entry_count++;
+        }
+        if (inumber > max_inumber) {
+            max_inumber = inumber;
+        }
+    }
+    int *image_index = NULL;
+    if (max_inumber >= 0) { // an empty volume has no inode to index
+        image_index = malloc((size_t)(max_inumber + 1) * sizeof(int));
+    }
+    FILE *image = fopen(image_path, "w");
+    if ((max_inumber >= 0 && image_index == NULL) || image == NULL) {
+        free(image_index);
+        if (image != NULL) {
+            fclose(image);
+        }
+        tfs_snapshot_release(snapshot);
+        return -1;
+    }
+    for (int i = 0; i <= max_inumber; i++) {
+        image_index[i] = -1;
+    }
+
+    size_t block_size = state_block_size(fs);
+    int result = fwrite(&header, sizeof(header), 1, image) == 1 ? 0 : -1;
+    int32_t written = 0;
+    for (size_t i = 0; i < snapshot->s_entry_count && result == 0; i++) {
+        dir_entry_t const *dir_entry = &snapshot->s_entries[i];
+        if (dir_entry->d_inumber == -1) {
+            continue;
+        }
+        snapshot_file_t const *file = &snapshot->s_files[i];
+        inode_t const *inode = &file->sf_inode;
+
+        image_entry_t entry = {0};
+        memcpy(entry.ie_name, dir_entry->d_name, MAX_FILE_NAME);
+        entry.ie_type = inode->i_node_type;
+        entry.ie_link_of = image_index[dir_entry->d_inumber];
+        if (inode->i_node_type == T_SYMLINK) {
+            entry.ie_size = strnlen(file->sf_symlink_target, MAX_FILE_NAME);
+        } else if (entry.ie_link_of == -1) {
+            entry.ie_size = inode->i_size;
+        }
+        image_index[dir_entry->d_inumber] = written++;
+
+        if (fwrite(&entry, sizeof(entry), 1, image) != 1) {
+            result = -1;
+            break;
+        }
+        if (inode->i_node_type == T_SYMLINK) {
+            if (fwrite(file->sf_symlink_target, 1, entry.ie_size, image) !=
+                entry.ie_size) {
+                result = -1;
+            }
+            continue;
+        }
+
+        // one write per run of contiguous blocks, straight from the blocks
+        for (size_t pos = 0; pos < entry.ie_size;) {
+            size_t run;
+            int bnum = inode_block_run(inode, pos / block_size, &run);
+            size_t chunk = run * block_size;
+            if (chunk > entry.ie_size - pos) {
+                chunk = entry.ie_size - pos;
+            }
+            if (fwrite(data_block_get(fs, bnum), 1, chunk, image) != chunk) {
+                result = -1;
+                break;
+            }
+            pos += chunk;
+        }
+    }
+
+    if (fclose(image) != 0) {
+        result = -1;
+    }
+    free(image_index);
+    tfs_snapshot_release(snapshot);
+    return result;
+}
+
+/**
+ * Give a new inode (not reachable yet) the given contents.
+ *
+ * Returns true if successful, false if there is no space for them.
+ */
+static bool image_load_data(tfs_instance_t *fs, inode_t *inode,
+                            char const *data, size_t size) {
+    size_t block_size = state_block_size(fs);
+    size_t needed = (size + block_size - 1) / block_size;
+    if (inode_alloc_blocks(fs, inode, needed) < needed) {
+        return false;
+    }
+
+    // one copy per run of contiguous blocks
+    for (size_t done = 0; done < size;) {
+        size_t run;
+        int bnum = inode_block_run(inode, done / block_size, &run);
+        size_t chunk = run * block_size;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        memcpy(data_block_get(fs, bnum), data + done, chunk);
+        done += chunk;
+    }
+    inode->i_size = size;
+    return true;
+}
+
+int tfsi_load(tfs_instance_t *fs, char const *image_path) {
+    // reads the whole image at once
+    FILE *image = fopen(image_path, "r");
+    if (image == NULL) {
+        return -1;
+    }
+    long image_size = -1;
+    if (fseek(image, 0, SEEK_END) == 0) {
+        image_size = ftell(image);
+    }
+    char *buffer = NULL;
+    if (image_size >= (long)sizeof(image_header_t) &&
+        fseek(image, 0, SEEK_SET) == 0) {
+        buffer = malloc((size_t)image_size);
+    }
+    if (buffer == NULL ||
+        fread(buffer, 1, (size_t)image_size, image) != (size_t)image_size) {
+        free(buffer);
+        fclose(image);
+        return -1;
+    }
+    fclose(image);
+
+    image_header_t header;
+    memcpy(&header, buffer, sizeof(header));
+    if (memcmp(header.ih_magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+        header.ih_entry_count > (size_t)image_size / sizeof(image_entry_t)) {
+        free(buffer);
+        return -1; // not an image
+    }
+    dir_entry_t *entries = malloc(header.ih_entry_count * sizeof(dir_entry_t));
+    if (entries == NULL && header.ih_entry_count > 0) {
+        free(buffer);
+        return -1;
+    }
+
+    volume_enter(fs);
+
+    // the root directory must be empty, so that the names need not be looked
+    // up (nobody else may use the volume until the load completes)
+    inode_t *root = inode_get(fs, ROOT_DIR_INUM);
+    dir_entry_t const *root_entries =
+        data_block_get(fs, root->i_extents[0].e_start);
+    int result = 0;
+    for (size_t i = 0; i < state_block_size(fs) / sizeof(dir_entry_t); i++) {
+        if (root_entries[i].d_inumber != -1) {
+            result = -1;
+        }
+    }
+
+    // creates the inodes, and then adds all the names in a single pass
+    size_t loaded = 0; // entries with an inode (or a link to one)
+    size_t pos = sizeof(header);
+    for (size_t i = 0; i < header.ih_entry_count && result == 0; i++) {
+        image_entry_t entry;
+        if ((size_t)image_size - pos < sizeof(entry)) {
+            result = -1; // truncated image
+            break;
+        }
+        memcpy(&entry, buffer + pos, sizeof(entry));
+        pos += sizeof(entry);
+        if ((size_t)image_size - pos < entry.ie_size ||
+            entry.ie_link_of >= (int64_t)i || entry.ie_name[0] == '\0') {
+            result = -1; // truncated or corrupted image
+            break;
+        }
+        char const *data = buffer + pos;
+        pos += entry.ie_size;
+
+        dir_entry_t *dir_entry = &entries[i];
+        memcpy(dir_entry->d_name, entry.ie_name, MAX_FILE_NAME);
+        dir_entry->d_name[MAX_FILE_NAME - 1] = '\0';
+
+        if (entry.ie_type == T_FILE && entry.ie_link_of >= 0) {
+            // a hard link to a file loaded before
+            dir_entry->d_inumber = entries[entry.ie_link_of].d_inumber;
+            inode_t *inode = inode_get(fs, dir_entry->d_inumber);
+            if (inode->i_node_type != T_FILE) {
+                result = -1;
+                break;
+            }
+            inode->i_hardlink_counter++;
+            loaded = i + 1;
+        } else if (entry.ie_type == T_FILE || entry.ie_type == T_SYMLINK) {
+            dir_entry->d_inumber = inode_create(fs, (inode_type)entry.ie_type);
+            if (dir_entry->d_inumber == -1) {
+                result = -1; // no space in inode table
+                break;
+            }
+            loaded = i + 1;
+
+            inode_t *inode = inode_get(fs, dir_entry->d_inumber);
+            if (entry.ie_type == T_FILE) {
+                if (!image_load_data(fs, inode, data, entry.ie_size)) {
+                    result = -1; // no space in the volume
+                }
+            } else if (entry.ie_size < MAX_FILE_NAME) {
+                char *target = inode_symlink_target(fs, dir_entry->d_inumber);
+                memcpy(target, data, entry.ie_size);
+                target[entry.ie_size] = '\0';
+            } else {
+                result = -1; // corrupted image
+            }
+        } else {
+            result = -1; // corrupted image
+        }
+    }
+
+    size_t added = 0;
+    if (result == 0) {
+        pthread_rwlock_t *batch_lock = get_dir_batch_lock(fs);
+        write_lock_rwlock(batch_lock);
+        added = add_dir_entries(fs, root, entries, loaded);
+        unlock_rwlock(batch_lock);
+        if (added < loaded) {
+            result = -1; // no space in directory
+        }
+    }
+
+    // drops the inodes (and links) that could not be added, links first
+    for (size_t i = loaded; i-- > added;) {
+        inode_t *inode = inode_get(fs, entries[i].d_inumber);
+        if (--inode->i_hardlink_counter == 0) {
+            inode_delete(fs, entries[i].d_inumber);
+        }
+    }
+
+    volume_exit(fs);
+    free(entries);
+    free(buffer);
+    return result;
+}
+
+/*
+ * Asynchronous ring (see tfs_ring_create): both rings hold up to r_entries
+ * items, and at most r_entries requests are in flight, so completions always
+ * fit in their ring
+ */
+struct tfs_ring {
+    tfs_instance_t *r_fs; // the volume the requests are carried out on
+    size_t r_entries;
+    tfs_request_t *r_requests; // submitted and not started yet (ring)
+    size_t r_request_head;
+    size_t r_request_count;
+    tfs_completion_t *r_completions; // not reaped yet (ring)
+    size_t r_completion_head;
+    size_t r_completion_count;
+    size_t r_in_flight; // submitted and not reaped yet
+    bool r_stopping;
+
+    pthread_t *r_workers;
+    size_t r_worker_count;
+    pthread_mutex_t r_lock;
+    pthread_cond_t r_submitted;
+    pthread_cond_t r_completed;
+};
+
+/**
+ * Carry out a request of an asynchronous ring.
+ *
+ * Returns what the operation returned.
+ */
+static ssize_t ring_execute(tfs_instance_t *fs, tfs_request_t const *request) {
+    switch (request->op) {
+    case TFS_OP_OPEN:
+        return tfsi_open(fs, request->name, request->mode);
+    case TFS_OP_CLOSE:
+        return tfsi_close(fs, request->fhandle);
+    case TFS_OP_READ:
+        return tfsi_read(fs, request->fhandle, request->buffer, request->len);
+    case TFS_OP_WRITE:
+        return tfsi_write(fs, request->fhandle, request->buffer, request->len);
+    default:
+        return -1;
+    }
+}
+
+static void *ring_worker(void *arg) {
+    tfs_ring_t *ring = (tfs_ring_t *)arg;
+    tfs_instance_t *fs = ring->r_fs;
+
+    lock_mutex(&ring->r_lock);
+    for (;;) {
+        if (ring->r_request_count == 0) {
+            if (ring->r_stopping) {
+                break;
+            }
+            if (pthread_cond_wait(&ring->r_submitted, &ring->r_lock) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        tfs_request_t request = ring->r_requests[ring->r_request_head];
+        ring->r_request_head = (ring->r_request_head + 1) % ring->r_entries;
+        ring->r_request_count--;
+        unlock_mutex(&ring->r_lock);
+
+        tfs_completion_t completion = {.user_data = request.user_data,
+                                       .result = ring_execute(fs, &request)};
+
+        lock_mutex(&ring->r_lock);
+        ring->r_completions[(ring->r_completion_head +
+                             ring->r_completion_count) %
+                            ring->r_entries] = completion;
+        ring->r_completion_count++;
+        if (pthread_cond_signal(&ring->r_completed) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    unlock_mutex(&ring->r_lock);
+    return NULL;
+}
+
+tfs_ring_t *tfsi_ring_create(tfs_instance_t *fs, size_t entries,
+                             size_t worker_count) {
+    if (entries == 0 || worker_count == 0) {
+        return NULL;
+    }
+    tfs_ring_t *ring = calloc(1, sizeof(tfs_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->r_fs = fs;
+    ring->r_entries = entries;
+    ring->r_requests = malloc(entries * sizeof(tfs_request_t));
+    ring->r_completions = malloc(entries * sizeof(tfs_completion_t));
+    ring->r_workers = malloc(worker_count * sizeof(pthread_t));
+    if (ring->r_requests == NULL || ring->r_completions == NULL ||
+        ring->r_workers == NULL) {
+        free(ring->r_requests);
+        free(ring->r_completions);
+        free(ring->r_workers);
+        free(ring);
+        return NULL;
+    }
+    init_mutex(&ring->r_lock);
+    if (pthread_cond_init(&ring->r_submitted, NULL) != 0 ||
+        pthread_cond_init(&ring->r_completed, NULL) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    for (; ring->r_worker_count < worker_count; ring->r_worker_count++) {
+        if (pthread_create(&ring->r_workers[ring->r_worker_count], NULL,
+                           ring_worker, ring) != 0) {
+            break; // the workers started so far serve the ring
+        }
+    }
+    if (ring->r_worker_count == 0) {
+        tfs_ring_destroy(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+size_t tfs_ring_submit(tfs_ring_t *ring, tfs_request_t const *requests,
+                       size_t count) {
+    lock_mutex(&ring->r_lock);
+    size_t submitted = ring->r_entries - ring->r_in_flight;
+    if (submitted > count) {
+        submitted = count;
+    }
+    for (size_t i = 0; i < submitted; i++) {
+        ring->r_requests[(ring->r_request_head + ring->r_request_count) %
+                         ring->r_entries] = requests[i];
+        ring->r_request_count++;
+    }
+    ring->r_in_flight += submitted;
+    if (submitted > 0 && pthread_cond_broadcast(&ring->r_submitted) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    unlock_mutex(&ring->r_lock);
+    return submitted;
+}
+
+size_t tfs_ring_reap(tfs_ring_t *ring, tfs_completion_t *completions,
+                     size_t max, size_t min) {
+    if (min > max) {
+        min = max;
+    }
+
+    lock_mutex(&ring->r_lock);
+    while (ring->r_completion_count < min &&
+           ring->r_completion_count < ring->r_in_flight) {
+        if (pthread_cond_wait(&ring->r_completed, &ring->r_lock) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t reaped = ring->r_completion_count;
+    if (reaped > max) {
+        reaped = max;
+    }
+    for (size_t i = 0; i < reaped; i++) {
+        completions[i] = ring->r_completions[ring->r_completion_head];
+        ring->r_completion_head =
+            (ring->r_completion_head + 1) % ring->r_entries;
+    }
+    ring->r_completion_count -= reaped;
+    ring->r_in_flight -= reaped;
+    unlock_mutex(&ring->r_lock);
+    return reaped;
+}
+
+void tfs_ring_destroy(tfs_ring_t *ring) {
+    // the workers carry out the pending requests before stopping
+    lock_mutex(&ring->r_lock);
+    ring->r_stopping = true;
+    if (pthread_cond_broadcast(&ring->r_submitted) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    unlock_mutex(&ring->r_lock);
+    for (size_t i = 0; i < ring->r_worker_count; i++) {
+        if (pthread_join(ring->r_workers[i], NULL) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    destroy_mutex(&ring->r_lock);
+    if (pthread_cond_destroy(&ring->r_submitted) != 0 ||
+        pthread_cond_destroy(&ring->r_completed) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    free(ring->r_requests);
+    free(ring->r_completions);
+    free(ring->r_workers);
+    free(ring);
+}
+
+/*
+ * Operations on the default instance
+ */
+void tfs_statfs(tfs_statfs_t *stat) { tfsi_statfs(default_fs, stat); }
+
+void tfs_get_stats(tfs_stats_t *stats) { tfsi_get_stats(default_fs, stats); }
+
+int tfs_open(char const *name, tfs_file_mode_t mode) {
+    return tfsi_open(default_fs, name, mode);
+}
+
+int tfs_sym_link(char const *target, char const *link_name) {
+    return tfsi_sym_link(default_fs, target, link_name);
+}
+
+int tfs_link(char const *target, char const *link_name) {
+    return tfsi_link(default_fs, target, link_name);
+}
+
+int tfs_clone(char const *source_path, char const *dest_path) {
+    return tfsi_clone(default_fs, source_path, dest_path);
+}
+
+int tfs_lookup(char const *name) { return tfsi_lookup(default_fs, name); }
+
+int tfs_close(int fhandle) { return tfsi_close(default_fs, fhandle); }
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t len) {
+    return tfsi_write(default_fs, fhandle, buffer, len);
+}
+
+int tfs_flush(int fhandle) { return tfsi_flush(default_fs, fhandle); }
+
+int tfs_fallocate(int fhandle, size_t offset, size_t len) {
+    return tfsi_fallocate(default_fs, fhandle, offset, len);
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    return tfsi_read(default_fs, fhandle, buffer, len);
+}
+
+int tfs_unlink(char const *target) { return tfsi_unlink(default_fs, target); }
+
+int tfs_create_many(char const *const *names, size_t count, int *results) {
+    return tfsi_create_many(default_fs, names, count, results);
+}
+
+int tfs_unlink_many(char const *const *names, size_t count, int *results) {
+    return tfsi_unlink_many(default_fs, names, count, results);
+}
+
+int tfs_stat_many(char const *const *names, size_t count, tfs_stat_t *stats) {
+    return tfsi_stat_many(default_fs, names, count, stats);
+}
+
+int tfs_stat(char const *name, tfs_stat_t *stat) {
+    return tfsi_stat(default_fs, name, stat);
+}
+
+tfs_dir_t *tfs_opendir(char const *path) {
+    return tfsi_opendir(default_fs, path);
+}
+
+int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
+    return tfsi_copy_from_external_fs(default_fs, source_path, dest_path);
+}
+
+int tfs_bulk_import(tfs_import_t *imports, size_t count, size_t worker_count) {
+    return tfsi_bulk_import(default_fs, imports, count, worker_count);
+}
+
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
+    return tfsi_copy_to_external_fs(default_fs, source_path, dest_path);
+}
+
+tfs_snapshot_t *tfs_snapshot(void) { return tfsi_snapshot(default_fs); }
+
+int tfs_dump(char const *image_path) {
+    return tfsi_dump(default_fs, image_path);
+}
+
+int tfs_load(char const *image_path) {
+    return tfsi_load(default_fs, image_path);
+}
+
+tfs_ring_t *tfs_ring_create(size_t entries, size_t worker_count) {
+    return tfsi_ring_create(default_fs, entries, worker_count);
+}
@@ -2,17 +2,46 @@
 #define OPERATIONS_H
 
 #include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+/**
+ * Placement of the data blocks on NUMA hosts. It is only a hint: it is
+ * ignored where NUMA is not supported.
+ */
+typedef enum {
+    TFS_NUMA_DEFAULT,    // the process' policy (usually the node that first
+                         // touches each page)
+    TFS_NUMA_LOCAL,      // the node of the thread that creates the volume
+    TFS_NUMA_INTERLEAVE, // interleaved across all nodes (page by page)
+} tfs_numa_policy;
+
 /**
  * TécnicoFS parameters.
  */
 typedef struct {
+    // maximum sizes of the tables, which start small and grow on demand
     size_t max_inode_count;
     size_t max_block_count;
     size_t max_open_files_count;
 
     size_t block_size;
+
+    // maximum readahead window of sequential readers, in blocks (0 disables
+    // readahead)
+    size_t readahead_blocks;
+
+    // back the data blocks with huge pages (of HUGE_PAGE_SIZE), which cuts
+    // the TLB misses of accesses to random blocks of large volumes; they are
+    // taken from the reserved pool (hugetlbfs) if it has enough pages, and
+    // are transparent huge pages otherwise
+    bool huge_pages;
+    tfs_numa_policy numa_policy;
+
+    // count the opens, reads, writes, unlinks and copies from the host, and
+    // measure their latency (see tfs_get_stats)
+    bool op_stats;
 } tfs_params;
 
 /**
@@ -28,10 +57,110 @@ int tfs_init(tfs_params const *params);
 
 /**
  * Destroy tecnicofs.
+ * If built with the lock profiler (make LOCK_PROFILE=yes), it also prints
+ * the lock contention report to stderr.
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_destroy();
 
+/**
+ * TécnicoFS instance: an independent volume, with its own tables, locks and
+ * background threads (instances share no state, so operations on different
+ * instances never contend). Every operation has a tfsi_ variant (see the end
+ * of this file) that takes the instance as its first argument; the tfs_
+ * functions operate on the default instance, created by tfs_init.
+ */
+typedef struct tfs_instance tfs_instance_t;
+
+/**
+ * Create an instance, optionally with a given configuration.
+ * Each live instance uses two process-wide thread-specific data keys (for its
+ * per-thread allocation caches and statistics), so at most about
+ * PTHREAD_KEYS_MAX / 2 instances (fewer if the process uses keys of its own)
+ * may exist at once; the keys are released by tfs_instance_destroy.
+ * Returns the instance, or NULL in case of error.
+ */
+tfs_instance_t *tfs_instance_create(tfs_params const *params);
+
+/**
+ * Destroy an instance (no operations on it may be in progress).
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_instance_destroy(tfs_instance_t *fs);
+
+/**
+ * Return the default instance (NULL if tecnicofs is not initialized).
+ */
+tfs_instance_t *tfs_default_instance(void);
+
+/**
+ * Usage of the volume (see tfs_statfs).
+ */
+typedef struct {
+    size_t f_block_size;
+    size_t f_blocks;            // data blocks
+    size_t f_blocks_free;       // including those still being reclaimed
+    size_t f_blocks_reclaiming; // freed, still queued for the reclaimer
+    size_t f_inodes;
+    size_t f_inodes_free;
+} tfs_statfs_t;
+
+/**
+ * Obtain the usage of the volume. It is kept up to date by every allocation
+ * and release, so this takes constant time (and no locks), but it is only
+ * exact when no other operations are in progress.
+ *
+ * Input:
+ *   - stat: where to store the usage
+ */
+void tfs_statfs(tfs_statfs_t *stat);
+
+/**
+ * Operations measured when the op_stats parameter is set (see
+ * tfs_get_stats).
+ */
+typedef enum {
+    TFS_STATS_OPEN,
+    TFS_STATS_READ,
+    TFS_STATS_WRITE,
+    TFS_STATS_UNLINK,
+    TFS_STATS_COPY_FROM_EXTERNAL_FS,
+    TFS_STATS_OP_COUNT,
+} tfs_stats_op_t;
+
+/**
+ * Statistics of an operation (see tfs_get_stats).
+ */
+typedef struct {
+    size_t s_ops;
+    size_t s_errors; // calls that returned -1
+    size_t s_bytes;  // read or written (by reads and writes only)
+    // latency percentiles and maximum, in ns
+    uint64_t s_p50_ns;
+    uint64_t s_p99_ns;
+    uint64_t s_p999_ns;
+    uint64_t s_max_ns;
+} tfs_op_stats_t;
+
+typedef struct {
+    tfs_op_stats_t st_ops[TFS_STATS_OP_COUNT]; // indexed by the operation
+} tfs_stats_t;
+
+/**
+ * Obtain the number of calls, errors, bytes and latency percentiles of each
+ * measured operation since the volume was created (all zero unless it was
+ * created with the op_stats parameter set). Each thread records its calls in
+ * histograms of its own, which are only added up here. To keep the clock
+ * reads off most calls, the latencies are those of a sample of the calls
+ * (one in OP_STATS_SAMPLE_PERIOD, see config.h), and the percentiles are
+ * within 1/8 of the exact values (see OP_STATS_SUB_BITS); the counts cover
+ * every call.
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ */
+void tfs_get_stats(tfs_stats_t *stats);
+
 /**
  * TécnicoFS file opening modes.
  */
@@ -39,6 +168,7 @@ typedef enum {
     TFS_O_CREAT = 0b001,
     TFS_O_TRUNC = 0b010,
     TFS_O_APPEND = 0b100,
+    TFS_O_BUFFERED = 0b1000,
 } tfs_file_mode_t;
 
 /**
@@ -50,6 +180,10 @@ typedef enum {
  *     - append mode (TFS_O_APPEND)
  *     - truncate file contents (TFS_O_TRUNC)
  *     - create file if it does not exist (TFS_O_CREAT)
+ *     - buffer small writes (TFS_O_BUFFERED): writes are gathered in a
+ *       buffer of the file handle, and only written to the file when it
+ *       fills up, on tfs_flush, and on tfs_close (or before a tfs_read on the
+ *       same handle); other handles do not see the buffered bytes until then
  *
  * Returns file handle of the opened file if successful, -1 otherwise.
  */
@@ -77,6 +211,21 @@ int tfs_sym_link(char const *target, char const *link_name);
  */
 int tfs_link(char const *target, char const *link_name);
 
+/**
+ * Clone a file: create a new file with the same contents, sharing the data
+ * blocks of the source instead of copying them. A shared block is only
+ * copied when one of the files writes to it (copy-on-write), so cloning does
+ * not copy any file data.
+ *
+ * Input:
+ *   - source_path: absolute path name of the file to clone (if it is a
+ *     symbolic link, its target is cloned)
+ *   - dest_path: absolute path name of the clone, which must not exist
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(char const *source_path, char const *dest_path);
+
 /**
  * Looks for a file.
  *
@@ -96,7 +245,8 @@ int tfs_lookup(char const *name);
  * Input:
  *   - fhandle: file handle (obtained from a previous call to tfs_open)
  *
- * Returns 0 if successful, -1 otherwise.
+ * Returns 0 if successful, -1 otherwise (including if the bytes it buffered
+ * could not be written; the file is closed anyway).
  */
 int tfs_close(int fhandle);
 
@@ -109,10 +259,44 @@ int tfs_close(int fhandle);
  *   - len: length of the buffer contents (in bytes)
  *
  * Returns the number of bytes that were written (can be lower than 'len' if the
- * maximum file size is exceeded), or -1 in case of error.
+ * maximum file size is exceeded), or -1 in case of error. On a handle opened
+ * with TFS_O_BUFFERED, bytes that are only buffered count as written, and
+ * running out of space is only reported when they are flushed.
  */
 ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
 
+/**
+ * Write the bytes buffered by a file handle (see TFS_O_BUFFERED) to the file.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if successful (or if the handle is not buffered), -1 otherwise
+ * (e.g. no space for all the buffered bytes, which are then dropped).
+ */
+int tfs_flush(int fhandle);
+
+/**
+ * Preallocate data blocks for an open file, so that later writes up to
+ * offset + len do not need to allocate blocks.
+ *
+ * The file size is not changed. Bytes past the end of the file are never
+ * returned by tfs_read (and tfs_write zero-fills any gap it leaves), so the
+ * preallocated blocks are not zeroed. Preallocated blocks that are still
+ * unused (past the end of the file) are released when the last file handle
+ * open on the file is closed.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: start of the range to preallocate
+ *   - len: length of the range to preallocate (in bytes)
+ *
+ * Returns 0 if successful (an empty range preallocates nothing), -1 otherwise
+ * (e.g. no space in the volume, the file would need too many extents, or the
+ * range ends past SIZE_MAX; part of the range may be allocated).
+ */
+int tfs_fallocate(int fhandle, size_t offset, size_t len);
+
 /**
  * Read from an open file, starting at the current offset.
  *
@@ -128,7 +312,8 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
 /**
  * Delete a link, or a file if the number of hard links reaches 0, that
- * exists in TécnicoFS.
+ * exists in TécnicoFS. A file that is still open is only deleted when its
+ * last file handle is closed (until then, its handles can still be used).
  *
  * Input:
  *   - target: path name of the target (in TécnicoFS)
@@ -137,6 +322,127 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_unlink(char const *target);
 
+/**
+ * TécnicoFS file types.
+ */
+typedef enum {
+    TFS_T_FILE,
+    TFS_T_DIRECTORY,
+    TFS_T_SYMLINK,
+} tfs_file_type_t;
+
+/**
+ * Status of a file (see tfs_stat_many).
+ */
+typedef struct {
+    int st_inumber; // -1 if there is no such file
+    tfs_file_type_t st_type;
+    size_t st_size;   // in bytes
+    size_t st_blocks; // number of data blocks
+    int st_nlink;     // number of hard links
+} tfs_stat_t;
+
+/**
+ * Create several (empty) files, as tfs_open with TFS_O_CREAT would (without
+ * opening them). The names are looked up in a single pass over the
+ * directory, the inodes are allocated together, and the new names are added
+ * in a single pass, holding the directory locked (for adding names) from the
+ * lookup on, so that no name is added twice.
+ *
+ * Input:
+ *   - names: absolute path names of the files (repeated names are created
+ *     once)
+ *   - count: number of names
+ *   - results: where to store, for each name, 0 if the file was created (or
+ *     already existed), -1 otherwise (invalid name or no space)
+ *
+ * Returns 0 if successful for all the names, -1 otherwise.
+ */
+int tfs_create_many(char const *const *names, size_t count, int *results);
+
+/**
+ * Delete several links, as tfs_unlink would. The names are looked up in a
+ * single pass over the directory.
+ *
+ * Input:
+ *   - names: path names of the targets (a repeated name fails after the
+ *     first one, as if deleted one by one)
+ *   - count: number of names
+ *   - results: where to store, for each name, 0 if it was deleted, -1
+ *     otherwise
+ *
+ * Returns 0 if successful for all the names, -1 otherwise.
+ */
+int tfs_unlink_many(char const *const *names, size_t count, int *results);
+
+/**
+ * Obtain the status of several files, looking up the names in a single pass
+ * over the directory. Symbolic links are not followed.
+ *
+ * Input:
+ *   - names: absolute path names of the files
+ *   - count: number of names
+ *   - stats: where to store the status of each file
+ *
+ * Returns 0 if all the files exist, -1 otherwise.
+ */
+int tfs_stat_many(char const *const *names, size_t count, tfs_stat_t *stats);
+
+/**
+ * Obtain the status of a file. Symbolic links are not followed.
+ *
+ * Input:
+ *   - name: absolute path name of the file
+ *   - stat: where to store its status
+ *
+ * Returns 0 if successful, -1 if there is no such file.
+ */
+int tfs_stat(char const *name, tfs_stat_t *stat);
+
+/**
+ * Directory entry (see tfs_readdir).
+ */
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    int d_inumber;
+} tfs_dirent_t;
+
+/**
+ * Open directory (see tfs_opendir).
+ */
+typedef struct tfs_dir tfs_dir_t;
+
+/**
+ * Open a directory to list its entries (with tfs_readdir).
+ *
+ * The entries are copied at once, while no name is being added or removed
+ * (each operation that does so, and each batch of them, see tfs_create_many
+ * and tfs_unlink_many, is listed entirely or not at all), without stopping
+ * the operations on open files. Reading the listing takes no locks; changes
+ * made after tfs_opendir are not listed.
+ *
+ * Input:
+ *   - path: absolute path name of the directory (only the root directory,
+ *     "/", is supported)
+ *
+ * Returns the open directory, or NULL in case of error. It must be closed
+ * with tfs_closedir.
+ */
+tfs_dir_t *tfs_opendir(char const *path);
+
+/**
+ * Read the next entry of an open directory.
+ *
+ * Returns the entry (valid until the next call), or NULL if there are no
+ * more entries.
+ */
+tfs_dirent_t const *tfs_readdir(tfs_dir_t *dir);
+
+/**
+ * Close an open directory.
+ */
+void tfs_closedir(tfs_dir_t *dir);
+
 /**
  * Copy the contents of a file that exists in the OS' file system tree
  * (outside TécnicoFS) to the TécnicoFS.
@@ -150,4 +456,275 @@ int tfs_unlink(char const *target);
  */
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
 
+/**
+ * An import of a file from the OS' file system tree (see tfs_bulk_import).
+ */
+typedef struct {
+    char const *source_path; // path name in the OS' file system
+    char const *dest_path;   // absolute path name in TécnicoFS
+    int result;              // set to 0 if successful, -1 otherwise
+} tfs_import_t;
+
+/**
+ * Copy many files from the OS' file system tree (outside TécnicoFS) to the
+ * TécnicoFS, like tfs_copy_from_external_fs, on a pool of worker threads.
+ * Each worker starts reading its next source file (in the background) before
+ * copying the current one.
+ *
+ * Input:
+ *   - imports: the files to copy; the destinations must be distinct, and the
+ *     result of each copy is stored in it
+ *   - count: number of files to copy
+ *   - worker_count: number of threads that copy files (including the calling
+ *     one); each holds one file open, so it should not exceed the maximum
+ *     number of open files
+ *
+ * Returns 0 if all the files were copied, -1 otherwise.
+ */
+int tfs_bulk_import(tfs_import_t *imports, size_t count, size_t worker_count);
+
+/**
+ * Copy the contents of a file that exists in TécnicoFS to the OS' file system
+ * tree (outside TécnicoFS).
+ *
+ * The contents are written as they were when the copy started, straight from
+ * the data blocks (one write per run of contiguous blocks, continued after a
+ * partial write), without holding any TécnicoFS lock while writing, so writers
+ * to the file are not delayed.
+ *
+ * Input:
+ *   - source_path: absolute path name of the source file (in TécnicoFS); if
+ *     it is a symbolic link, its target is copied
+ *   - dest_path: path name of the destination file (in the OS' file system),
+ *     which is created if needed, and overwritten if it already exists; it
+ *     may also be a named pipe.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
+
+/**
+ * Point-in-time copy of the whole volume (see tfs_snapshot).
+ */
+typedef struct tfs_snapshot tfs_snapshot_t;
+
+/**
+ * Take a snapshot of the volume: the root directory and the files it holds,
+ * as they are between two operations.
+ *
+ * Only the metadata is copied; the data blocks are shared with the live files
+ * and copied by writers when they first change them afterwards
+ * (copy-on-write). Operations that change the volume only wait while the
+ * metadata is copied, so the snapshot can then be read or exported (e.g. by
+ * a background thread) while writes continue.
+ *
+ * Returns the snapshot, or NULL in case of error. It must be freed with
+ * tfs_snapshot_release, before tfs_destroy.
+ */
+tfs_snapshot_t *tfs_snapshot(void);
+
+/**
+ * Read from a file of a snapshot.
+ *
+ * Input:
+ *   - snapshot: the snapshot
+ *   - name: absolute path name of the file (if it is a symbolic link, its
+ *     target is read)
+ *   - offset: where to start reading
+ *   - buffer: destination buffer
+ *   - len: length of the buffer
+ *
+ * Returns the number of bytes copied to the buffer (can be lower than 'len'
+ * if the file size was reached), or -1 if there is no such file.
+ */
+ssize_t tfs_snapshot_read(tfs_snapshot_t const *snapshot, char const *name,
+                          size_t offset, void *buffer, size_t len);
+
+/**
+ * Export a snapshot to a directory in the OS' file system tree (outside
+ * TécnicoFS): each file is written to a file with the same name, and each
+ * symbolic link becomes a (relative) symbolic link. Hard links are exported
+ * as separate copies.
+ *
+ * Input:
+ *   - snapshot: the snapshot
+ *   - dest_dir: path name of an existing directory (in the OS' file system)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_snapshot_export(tfs_snapshot_t const *snapshot, char const *dest_dir);
+
+/**
+ * Release a snapshot, dropping its references to the data blocks.
+ */
+void tfs_snapshot_release(tfs_snapshot_t *snapshot);
+
+/**
+ * Dump the whole volume to an image file in the OS' file system tree (outside
+ * TécnicoFS), so that it can later be restored with tfs_load.
+ *
+ * The image is written sequentially from a snapshot of the volume (see
+ * tfs_snapshot), so writes can continue meanwhile. It only holds the files,
+ * links and data in use (free blocks are skipped).
+ *
+ * Input:
+ *   - image_path: path name of the image (from the OS' file system), which is
+ *     created if needed, and overwritten if it already exists.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_dump(char const *image_path);
+
+/**
+ * Load an image written by tfs_dump (on a host with the same byte order),
+ * reading it with a single read. The volume must be empty (e.g. right after
+ * tfs_init) and not used by other threads until the load completes, so that
+ * the names need not be looked up: they are all added to the root directory
+ * in a single pass.
+ *
+ * Input:
+ *   - image_path: path name of the image (from the OS' file system)
+ *
+ * Returns 0 if successful, -1 otherwise (e.g. the volume is not empty, or the
+ * image is corrupted or does not fit in the volume). Nothing is loaded in
+ * case of error, unless the root directory is the one to fill up.
+ */
+int tfs_load(char const *image_path);
+
+/**
+ * Operations that can be submitted to an asynchronous ring (see
+ * tfs_ring_create).
+ */
+typedef enum {
+    TFS_OP_OPEN,  // tfs_open(name, mode)
+    TFS_OP_CLOSE, // tfs_close(fhandle)
+    TFS_OP_READ,  // tfs_read(fhandle, buffer, len)
+    TFS_OP_WRITE, // tfs_write(fhandle, buffer, len)
+} tfs_op_t;
+
+/**
+ * A request submitted to an asynchronous ring: the operation, its arguments
+ * (those it does not take are ignored) and a value that identifies it in its
+ * completion.
+ */
+typedef struct {
+    tfs_op_t op;
+    char const *name;
+    tfs_file_mode_t mode;
+    int fhandle;
+    void *buffer; // only read by TFS_OP_WRITE
+    size_t len;
+    void *user_data;
+} tfs_request_t;
+
+/**
+ * The completion of a request submitted to an asynchronous ring.
+ */
+typedef struct {
+    void *user_data; // the one of the request
+    ssize_t result;  // what the operation returned
+} tfs_completion_t;
+
+/**
+ * Asynchronous submission/completion ring (see tfs_ring_create).
+ */
+typedef struct tfs_ring tfs_ring_t;
+
+/**
+ * Create an asynchronous ring: requests submitted to it (tfs_ring_submit) are
+ * carried out by a pool of worker threads, and their results are reaped from
+ * it (tfs_ring_reap), so a single thread can keep many operations in flight.
+ *
+ * Requests are started in the order they are submitted, but may complete in
+ * any order; requests that depend on each other (e.g. a write to a file
+ * handle and its close, or two writes to the same handle) must not be in
+ * flight at the same time.
+ *
+ * Input:
+ *   - entries: maximum number of requests in flight (submitted and not
+ *     reaped yet)
+ *   - worker_count: number of worker threads
+ *
+ * Returns the ring, or NULL in case of error. It must be freed with
+ * tfs_ring_destroy, before tfs_destroy.
+ */
+tfs_ring_t *tfs_ring_create(size_t entries, size_t worker_count);
+
+/**
+ * Submit requests to an asynchronous ring.
+ *
+ * Input:
+ *   - ring: the ring
+ *   - requests: the requests (copied to the ring; the names and buffers they
+ *     point to must stay valid until the requests complete)
+ *   - count: number of requests
+ *
+ * Returns the number of requests submitted (the first ones), which is lower
+ * than 'count' if the ring is full.
+ */
+size_t tfs_ring_submit(tfs_ring_t *ring, tfs_request_t const *requests,
+                       size_t count);
+
+/**
+ * Reap completions from an asynchronous ring, waiting for some if needed.
+ *
+ * Input:
+ *   - ring: the ring
+ *   - completions: where to store the completions
+ *   - max: maximum number of completions to reap
+ *   - min: number of completions to wait for (at most the number of requests
+ *     in flight)
+ *
+ * Returns the number of completions reaped.
+ */
+size_t tfs_ring_reap(tfs_ring_t *ring, tfs_completion_t *completions,
+                     size_t max, size_t min);
+
+/**
+ * Destroy an asynchronous ring, after its pending requests are carried out
+ * (completions not reaped yet are discarded).
+ */
+void tfs_ring_destroy(tfs_ring_t *ring);
+
+/*
+ * Operations on a given instance: the same as the tfs_ functions above, which
+ * are shorthands for these on the default instance.
+ */
+void tfsi_statfs(tfs_instance_t *fs, tfs_statfs_t *stat);
+void tfsi_get_stats(tfs_instance_t *fs, tfs_stats_t *stats);
+int tfsi_open(tfs_instance_t *fs, char const *name, tfs_file_mode_t mode);
+int tfsi_sym_link(tfs_instance_t *fs, char const *target,
+                  char const *link_name);
+int tfsi_link(tfs_instance_t *fs, char const *target, char const *link_name);
+int tfsi_clone(tfs_instance_t *fs, char const *source_path,
+               char const *dest_path);
+int tfsi_lookup(tfs_instance_t *fs, char const *name);
+int tfsi_close(tfs_instance_t *fs, int fhandle);
+ssize_t tfsi_write(tfs_instance_t *fs, int fhandle, void const *buffer,
+                   size_t len);
+int tfsi_flush(tfs_instance_t *fs, int fhandle);
+int tfsi_fallocate(tfs_instance_t *fs, int fhandle, size_t offset,
+                   size_t len);
+ssize_t tfsi_read(tfs_instance_t *fs, int fhandle, void *buffer, size_t len);
+int tfsi_unlink(tfs_instance_t *fs, char const *target);
+int tfsi_create_many(tfs_instance_t *fs, char const *const *names,
+                     size_t count, int *results);
+int tfsi_unlink_many(tfs_instance_t *fs, char const *const *names,
+                     size_t count, int *results);
+int tfsi_stat_many(tfs_instance_t *fs, char const *const *names, size_t count,
+                   tfs_stat_t *stats);
+int tfsi_stat(tfs_instance_t *fs, char const *name, tfs_stat_t *stat);
+tfs_dir_t *tfsi_opendir(tfs_instance_t *fs, char const *path);
+int tfsi_copy_from_external_fs(tfs_instance_t *fs, char const *source_path,
+                               char const *dest_path);
+int tfsi_bulk_import(tfs_instance_t *fs, tfs_import_t *imports, size_t count,
+                     size_t worker_count);
+int tfsi_copy_to_external_fs(tfs_instance_t *fs, char const *source_path,
+                             char const *dest_path);
+tfs_snapshot_t *tfsi_snapshot(tfs_instance_t *fs);
+int tfsi_dump(tfs_instance_t *fs, char const *image_path);
+int tfsi_load(tfs_instance_t *fs, char const *image_path);
+tfs_ring_t *tfsi_ring_create(tfs_instance_t *fs, size_t entries,
+                             size_t worker_count);
+
 #endif // OPERATIONS_H
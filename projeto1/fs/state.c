@@ -1,73 +1,286 @@
+// for MAP_ANONYMOUS, MAP_HUGETLB, madvise and syscall (see data_blocks_map)
+#define _DEFAULT_SOURCE
+
 #include "state.h"
 #include "betterassert.h"
 
+#include <limits.h>
+#include <linux/mempolicy.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 /*
- * Persistent FS state
- * (in reality, it should be maintained in secondary memory;
- * for simplicity, this project maintains it in primary memory).
+ * Cold inode fields, kept out of the inode table so that they do not take
+ * space in the cache lines of the hot ones
  */
-static tfs_params fs_params;
-
-// Inode table
-static inode_t *inode_table;
-static allocation_state_t *freeinode_ts;
-static pthread_rwlock_t *inode_table_locks;
+typedef struct {
+    char i_symlink_target[MAX_FILE_NAME];
+} inode_cold_t;
 
-// Data blocks
-static char *fs_data; // # blocks * block size
-static allocation_state_t *free_blocks;
-static pthread_rwlock_t *data_blocks_locks;
+/*
+ * Global allocator for a table (inodes, data blocks or open files)
+ */
+typedef struct {
+    pthread_mutex_t lock; // protects map, cursor and the table's growth
+    allocation_state_t **map;
+    atomic_size_t *size;    // current size of the table
+    size_t const *max_size; // size the table may grow to
+    size_t chunk;           // entries added when the table grows
+    // initializes new entries
+    void (*init)(tfs_instance_t *fs, size_t first, size_t end);
+    size_t cursor; // where the next refill scan starts (next-fit)
+    // the map is volatile state (not in storage, so accessing it has no
+    // storage access delay)
+    bool volatile_map;
+    // numbers in use (handed out and not freed), kept up to date so that
+    // tfs_statfs need not scan the map (nor the magazines)
+    atomic_size_t in_use;
+} allocator_t;
+
+#define MAGAZINE_SIZE (2 * MAGAZINE_BATCH)
 
 /*
- * Volatile FS state
+ * Per-thread allocation cache (magazine)
+ *
+ * Holds numbers that are already marked TAKEN in the global allocation map
+ * but not yet in use, so that allocating and freeing does not touch shared
+ * state. The lock is only contended when another thread steals from it.
  */
-static open_file_entry_t *open_file_table;
-static allocation_state_t *free_open_file_entries;
-static pthread_rwlock_t *open_file_table_locks;
+typedef struct {
+    pthread_mutex_t lock;
+    size_t count;
+    int entries[MAGAZINE_SIZE]; // used as a stack
+} magazine_t;
+
+typedef struct thread_magazines {
+    tfs_instance_t *fs; // whose allocators the numbers belong to
+    magazine_t inodes;
+    magazine_t blocks;
+    magazine_t handles; // of the open file table
+    struct thread_magazines *next;
+} thread_magazines_t;
+
+// latency histograms have a bucket for each value below OP_STATS_SUB_BUCKETS
+// ns, and split each power of two above it in OP_STATS_SUB_BUCKETS buckets
+#define OP_STATS_SUB_BUCKETS (1u << OP_STATS_SUB_BITS)
+#define OP_STATS_BUCKETS ((64 - OP_STATS_SUB_BITS + 1) * OP_STATS_SUB_BUCKETS)
 
-/* Locks for directories */
-static pthread_rwlock_t *dir_entries_locks;
+/*
+ * Statistics of an operation (see tfs_get_stats); each thread only updates
+ * its own, so the counters are atomic just to be read by other threads
+ */
+typedef struct {
+    atomic_ulong ops;
+    atomic_ulong errors;
+    atomic_ulong bytes;
+    atomic_ulong max_ns;
+    atomic_ulong histogram[OP_STATS_BUCKETS]; // of the timed calls
+    unsigned until_sample; // calls to skip before timing one (owner only)
+} op_stats_t;
+
+typedef struct thread_op_stats {
+    tfs_instance_t *fs;
+    op_stats_t ops[TFS_STATS_OP_COUNT];
+    struct thread_op_stats *next;
+} thread_op_stats_t;
 
-pthread_mutex_t open_files_mutex;
-pthread_mutex_t open_file_lock;
+/*
+ * FS instance: the whole state of a volume. Instances share nothing, so
+ * operations on different instances never contend.
+ */
+struct tfs_instance {
+    /*
+     * Persistent FS state
+     * (in reality, it should be maintained in secondary memory;
+     * for simplicity, this project maintains it in primary memory).
+     *
+     * The tables are allocated for their maximum size (tfs_params) up front,
+     * so they never move, but only their first chunk of entries is
+     * initialized (and so backed by memory): each grows by one chunk
+     * whenever it runs out, up to its maximum size (see allocator_grow).
+     */
+    tfs_params fs_params;
+
+    // Number of entries of each table in use (initialized so far)
+    atomic_size_t inode_table_size;
+    atomic_size_t data_blocks_size;
+    atomic_size_t open_file_table_size;
+
+    // Inode table (hot fields and locks, see inode_t)
+    inode_t *inode_table;
+    allocation_state_t *freeinode_ts;
+    inode_cold_t *inode_cold_table;
+
+    // Data blocks
+    char *fs_data;          // # blocks * block size
+    size_t fs_data_mapping; // size of its mapping (0 if malloc'd)
+    allocation_state_t *free_blocks;
+    // number of inodes referencing each block beyond the first (blocks
+    // shared by cloned files, which are copied when written, see
+    // inode_unshare_blocks)
+    atomic_int *block_extra_refs;
+
+    /*
+     * Volatile FS state
+     */
+    open_file_entry_t *open_file_table;
+    allocation_state_t *free_open_file_entries;
+    pthread_rwlock_t *open_file_table_locks;
+    // file handles open on each inode (see inode_pin)
+    atomic_uint *inode_open_refs;
+
+    /* Locks for directories */
+    pthread_rwlock_t *dir_entries_locks;
+    // write-locked while entries are changed (see get_dir_batch_lock)
+    pthread_rwlock_t dir_batch_lock;
+
+    /* Volume lock (see volume_enter) */
+    volume_lock_t volume_lock;
+
+    allocator_t inode_allocator;
+    allocator_t block_allocator;
+    allocator_t open_file_allocator;
+
+    /*
+     * Registry of the magazines of all threads (to steal from and to clear);
+     * each thread finds its own through the key
+     */
+    thread_magazines_t *magazines_list;
+    pthread_mutex_t magazines_list_lock;
+    pthread_key_t magazines_key;
+
+    /*
+     * Operation statistics (only if the op_stats parameter is set): each
+     * thread measures its operations in statistics of its own, found through
+     * the key; those of threads that exited are added up in op_stats_exited
+     */
+    thread_op_stats_t *op_stats_list;
+    op_stats_t op_stats_exited[TFS_STATS_OP_COUNT];
+    pthread_mutex_t op_stats_lock; // protects both
+    pthread_key_t op_stats_key;
+
+    /*
+     * Deferred block reclamation
+     *
+     * Truncate and unlink only queue the runs of blocks to free; a background
+     * reclaimer thread returns them to the map in batches, paying a single
+     * storage access delay per batch.
+     */
+    extent_t *reclaim_queue; // pending runs (at most one per block)
+    extent_t *reclaim_batch; // runs being freed
+    size_t reclaim_queue_count;
+    atomic_size_t reclaim_backlog; // blocks pending or being freed
+    bool reclaim_stopping;
+    pthread_t reclaim_thread;
+    pthread_mutex_t reclaim_lock;
+    pthread_cond_t reclaim_cond;
+    // serializes the freeing of batches (by the reclaimer or an allocator)
+    pthread_mutex_t reclaim_batch_lock;
+
+    /*
+     * Simulated block cache
+     *
+     * Blocks read through data_blocks_read only pay the storage access delay
+     * when they are not cached; the cache holds the last BLOCK_CACHE_BLOCKS
+     * blocks brought in (FIFO). A prefetcher thread brings in the blocks that
+     * sequential readers are about to read (see data_blocks_prefetch), paying
+     * the delays in the background.
+     */
+    atomic_bool *block_cached;
+    int block_cache_slots[BLOCK_CACHE_BLOCKS]; // cached blocks (ring)
+    size_t block_cache_hand;                   // next slot to replace
+    pthread_mutex_t block_cache_lock;
+
+    extent_t prefetch_queue[PREFETCH_QUEUE_SIZE]; // pending runs (ring)
+    size_t prefetch_head;
+    size_t prefetch_count;
+    bool prefetch_stopping;
+    pthread_t prefetch_thread;
+    pthread_mutex_t prefetch_lock;
+    pthread_cond_t prefetch_cond;
+};
+
+static void inode_table_init(tfs_instance_t *fs, size_t first, size_t end);
+static void data_blocks_init(tfs_instance_t *fs, size_t first, size_t end);
+static bool allocator_grow(tfs_instance_t *fs, allocator_t *allocator,
+                           size_t seen_size);
+static void open_file_table_init(tfs_instance_t *fs, size_t first,
+                                 size_t end);
+static void magazines_release(void *arg);
+static void op_stats_release(void *arg);
+static void *reclaimer_fn(void *arg);
+static void *prefetcher_fn(void *arg);
 
 // Convenience macros
-#define INODE_TABLE_SIZE (fs_params.max_inode_count)
-#define DATA_BLOCKS (fs_params.max_block_count)
-#define MAX_OPEN_FILES (fs_params.max_open_files_count)
-#define BLOCK_SIZE (fs_params.block_size)
+#define MAX_INODES (fs->fs_params.max_inode_count)
+#define MAX_DATA_BLOCKS (fs->fs_params.max_block_count)
+#define MAX_OPEN_FILES (fs->fs_params.max_open_files_count)
+#define INODE_TABLE_SIZE (atomic_load(&fs->inode_table_size))
+#define DATA_BLOCKS (atomic_load(&fs->data_blocks_size))
+#define OPEN_FILE_TABLE_SIZE (atomic_load(&fs->open_file_table_size))
+#define BLOCK_SIZE (fs->fs_params.block_size)
 #define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
 
-static inline bool valid_inumber(int inumber) {
+// inode_open_refs holds INODE_HANDLE_REF times the number of file handles
+// open on the inode, plus INODE_UNLINKED once its last name was removed (or
+// while it is free), so that closing the last handle and removing the last
+// name agree on who deletes it, plus INODE_PREALLOCATED while it has blocks
+// preallocated through a handle (released by the last handle closed)
+#define INODE_UNLINKED (1u)
+#define INODE_PREALLOCATED (2u)
+#define INODE_HANDLE_REF (4u)
+
+static inline bool valid_inumber(tfs_instance_t *fs, int inumber) {
     return inumber >= 0 && inumber < INODE_TABLE_SIZE;
 }
 
-static inline bool valid_block_number(int block_number) {
+static inline bool valid_block_number(tfs_instance_t *fs, int block_number) {
     return block_number >= 0 && block_number < DATA_BLOCKS;
 }
 
-static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
+static inline bool valid_file_handle(tfs_instance_t *fs, int file_handle) {
+    return file_handle >= 0 && file_handle < OPEN_FILE_TABLE_SIZE;
 }
 
-size_t state_block_size(void) { return BLOCK_SIZE; }
+size_t state_block_size(tfs_instance_t *fs) { return BLOCK_SIZE; }
+
+size_t state_readahead_blocks(tfs_instance_t *fs) {
+    return fs->fs_params.readahead_blocks;
+}
 
 /* Returns the lock associated with the given inumber */
-pthread_rwlock_t *get_inode_table_lock(int inumber) {
-    return &inode_table_locks[inumber];
+pthread_rwlock_t *get_inode_table_lock(tfs_instance_t *fs, int inumber) {
+    return &fs->inode_table[inumber].i_lock;
 }
 
 /* Returns the lock associated with the given file handle */
-pthread_rwlock_t *get_open_file_table_lock(int file_handle) {
-    return &open_file_table_locks[file_handle];
+pthread_rwlock_t *get_open_file_table_lock(tfs_instance_t *fs,
+                                           int file_handle) {
+    return &fs->open_file_table_locks[file_handle];
+}
+
+/*
+ * Returns the lock of the root directory's entries as a whole: every
+ * operation that adds or removes names takes it for writing (around its
+ * lookup too, when it must find a name absent or still there), and a listing
+ * takes it for reading, so that it sees each change (or batch of changes)
+ * entirely or not at all. Lookups only take the lock of each entry.
+ */
+pthread_rwlock_t *get_dir_batch_lock(tfs_instance_t *fs) {
+    return &fs->dir_batch_lock;
 }
 
+/* Returns the volume lock of the given instance */
+volume_lock_t *get_volume_lock(tfs_instance_t *fs) { return &fs->volume_lock; }
+
 /**
  * Do nothing, while preventing the compiler from performing any optimizations.
  *
@@ -99,6 +312,244 @@ static void insert_delay(void) {
     }
 }
 
+/*
+ * Returns the time of the monotonic clock, in ns
+ */
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef LOCK_PROFILE
+/*
+ * Lock profiler: the lock wrappers are called through macros (see state.h)
+ * that give each call site a lock_site_t, in which they count acquisitions,
+ * contended ones (those whose trylock failed first), wait time and hold time.
+ */
+
+// sites that have taken a lock, most recent first
+static _Atomic(lock_site_t *) lock_sites;
+
+/*
+ * A lock held by the calling thread, with the site and time of its
+ * acquisition
+ */
+typedef struct {
+    void const *hl_lock;
+    lock_site_t *hl_site;
+    uint64_t hl_since;
+} held_lock_t;
+
+static _Thread_local held_lock_t held_locks[LOCK_PROFILE_MAX_HELD];
+static _Thread_local size_t held_count;
+
+/*
+ * Returns the wait time histogram bucket of a wait of wait_ns: bucket i
+ * counts the waits shorter than 1024 << (2 * i) ns (~1us, 4us, 16us, ...),
+ * and the last one all the longer ones
+ */
+static size_t lock_profile_bucket(uint64_t wait_ns) {
+    size_t bucket = 0;
+    while (bucket < LOCK_PROFILE_BUCKETS - 1 &&
+           wait_ns >= (uint64_t)1024 << (2 * bucket)) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/*
+ * Raises *max to value, if it is smaller
+ */
+static void lock_profile_max(atomic_ulong *max, uint64_t value) {
+    unsigned long seen = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > seen && !atomic_compare_exchange_weak_explicit(
+                               max, &seen, (unsigned long)value,
+                               memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/*
+ * Records the acquisition of a lock at a site, after waiting wait_ns for it
+ * (if contended), and starts measuring how long the thread holds it
+ */
+static void lock_profile_acquired(void const *lock, lock_site_t *site,
+                                  bool contended, uint64_t wait_ns,
+                                  uint64_t acquired_at) {
+    if (!atomic_exchange(&site->ls_listed, true)) {
+        site->ls_next = atomic_load(&lock_sites);
+        while (!atomic_compare_exchange_weak(&lock_sites, &site->ls_next,
+                                             site)) {
+        }
+    }
+
+    atomic_fetch_add_explicit(&site->ls_acquisitions, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&site->ls_contended, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&site->ls_wait_ns, wait_ns,
+                                  memory_order_relaxed);
+        lock_profile_max(&site->ls_wait_max_ns, wait_ns);
+        atomic_fetch_add_explicit(
+            &site->ls_wait_histogram[lock_profile_bucket(wait_ns)], 1,
+            memory_order_relaxed);
+    }
+
+    // locks past the first LOCK_PROFILE_MAX_HELD are not timed
+    if (held_count < LOCK_PROFILE_MAX_HELD) {
+        held_locks[held_count++] = (held_lock_t){
+            .hl_lock = lock, .hl_site = site, .hl_since = acquired_at};
+    }
+}
+
+/*
+ * Records the release of a lock by the calling thread, adding the time it was
+ * held to the site that acquired it
+ */
+static void lock_profile_released(void const *lock) {
+    for (size_t i = held_count; i-- > 0;) {
+        if (held_locks[i].hl_lock == lock) {
+            lock_site_t *site = held_locks[i].hl_site;
+            uint64_t hold_ns = monotonic_ns() - held_locks[i].hl_since;
+            atomic_fetch_add_explicit(&site->ls_hold_ns, hold_ns,
+                                      memory_order_relaxed);
+            lock_profile_max(&site->ls_hold_max_ns, hold_ns);
+
+            held_count--;
+            memmove(&held_locks[i], &held_locks[i + 1],
+                    (held_count - i) * sizeof(held_lock_t));
+            return;
+        }
+    }
+}
+
+/*
+ * Locks (and checks for errors) a given mutex, recording it at site
+ */
+void lock_mutex_at(pthread_mutex_t *mutex, lock_site_t *site) {
+    uint64_t start = monotonic_ns();
+    bool contended = pthread_mutex_trylock(mutex) != 0;
+    if (contended && pthread_mutex_lock(mutex) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    uint64_t acquired_at = contended ? monotonic_ns() : start;
+    lock_profile_acquired(mutex, site, contended, acquired_at - start,
+                          acquired_at);
+}
+
+/*
+ * Read-locks (and checks for errors) a given rwlock, recording it at site
+ */
+void read_lock_rwlock_at(pthread_rwlock_t *rwlock, lock_site_t *site) {
+    uint64_t start = monotonic_ns();
+    bool contended = pthread_rwlock_tryrdlock(rwlock) != 0;
+    if (contended && pthread_rwlock_rdlock(rwlock) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    uint64_t acquired_at = contended ? monotonic_ns() : start;
+    lock_profile_acquired(rwlock, site, contended, acquired_at - start,
+                          acquired_at);
+}
+
+/*
+ * Write-locks (and checks for errors) a given rwlock, recording it at site
+ */
+void write_lock_rwlock_at(pthread_rwlock_t *rwlock, lock_site_t *site) {
+    uint64_t start = monotonic_ns();
+    bool contended = pthread_rwlock_trywrlock(rwlock) != 0;
+    if (contended && pthread_rwlock_wrlock(rwlock) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    uint64_t acquired_at = contended ? monotonic_ns() : start;
+    lock_profile_acquired(rwlock, site, contended, acquired_at - start,
+                          acquired_at);
+}
+
+/*
+ * Orders sites by total wait time and then by total hold time, longest first
+ * (for qsort)
+ */
+static int lock_site_compare(void const *a, void const *b) {
+    lock_site_t *site_a = *(lock_site_t *const *)a;
+    lock_site_t *site_b = *(lock_site_t *const *)b;
+    unsigned long wait_a = atomic_load(&site_a->ls_wait_ns);
+    unsigned long wait_b = atomic_load(&site_b->ls_wait_ns);
+    if (wait_a != wait_b) {
+        return wait_a < wait_b ? 1 : -1;
+    }
+    unsigned long hold_a = atomic_load(&site_a->ls_hold_ns);
+    unsigned long hold_b = atomic_load(&site_b->ls_hold_ns);
+    return (hold_a < hold_b) - (hold_a > hold_b);
+}
+
+/**
+ * Print the lock profile: for each site that has taken a lock, the number of
+ * acquisitions, how many of them were contended, the wait time (total,
+ * maximum and histogram of the contended acquisitions) and the hold time
+ * (average and maximum), with the sites that waited longest first (and then
+ * those that held their locks longest).
+ *
+ * The hold time of a mutex waited on with a condition variable includes the
+ * time spent in pthread_cond_wait.
+ *
+ * Input:
+ *   - out: stream to print the report to
+ */
+void lock_profile_report(FILE *out) {
+    size_t count = 0;
+    for (lock_site_t *site = atomic_load(&lock_sites); site != NULL;
+         site = site->ls_next) {
+        count++;
+    }
+    lock_site_t **sites = malloc(count * sizeof(lock_site_t *));
+    if (count > 0 && sites == NULL) {
+        return;
+    }
+    count = 0;
+    for (lock_site_t *site = atomic_load(&lock_sites); site != NULL;
+         site = site->ls_next) {
+        sites[count++] = site;
+    }
+    qsort(sites, count, sizeof(lock_site_t *), lock_site_compare);
+
+    fprintf(out, "lock profile: %zu sites, by total wait time\n", count);
+    for (size_t i = 0; i < count; i++) {
+        lock_site_t *site = sites[i];
+        unsigned long acquisitions = atomic_load(&site->ls_acquisitions);
+        unsigned long contended = atomic_load(&site->ls_contended);
+        fprintf(out, "%s:%d %s (%s)\n", site->ls_file, site->ls_line,
+                site->ls_func, site->ls_mode);
+        fprintf(out,
+                "    acquired %lu, contended %lu (%.2f%%), wait %.1f us total "
+                "(max %.1f us), hold %.2f us avg (max %.1f us)\n",
+                acquisitions, contended,
+                100.0 * (double)contended / (double)acquisitions,
+                (double)atomic_load(&site->ls_wait_ns) / 1e3,
+                (double)atomic_load(&site->ls_wait_max_ns) / 1e3,
+                (double)atomic_load(&site->ls_hold_ns) / 1e3 /
+                    (double)acquisitions,
+                (double)atomic_load(&site->ls_hold_max_ns) / 1e3);
+        if (contended == 0) {
+            continue;
+        }
+        fprintf(out, "    waits:");
+        for (size_t b = 0; b < LOCK_PROFILE_BUCKETS; b++) {
+            double bound_us = (double)((uint64_t)1024 << (2 * b)) / 1e3;
+            if (b < LOCK_PROFILE_BUCKETS - 1 && bound_us < 1e3) {
+                fprintf(out, " <%.0fus: %lu", bound_us,
+                        atomic_load(&site->ls_wait_histogram[b]));
+            } else if (b < LOCK_PROFILE_BUCKETS - 1) {
+                fprintf(out, " <%.1fms: %lu", bound_us / 1e3,
+                        atomic_load(&site->ls_wait_histogram[b]));
+            } else {
+                fprintf(out, " longer: %lu\n",
+                        atomic_load(&site->ls_wait_histogram[b]));
+            }
+        }
+    }
+    free(sites);
+}
+#else
 /*
  * Locks (and checks for errors) a given mutex
  */
@@ -125,11 +576,15 @@ void write_lock_rwlock(pthread_rwlock_t *rwlock) {
         exit(EXIT_FAILURE);
     }
 }
+#endif
 
 /*
  * Unlocks (and checks for errors) a given mutex
  */
 void unlock_mutex(pthread_mutex_t *mutex) {
+#ifdef LOCK_PROFILE
+    lock_profile_released(mutex);
+#endif
     if (pthread_mutex_unlock(mutex) != 0) {
         exit(EXIT_FAILURE);
     }
@@ -139,6 +594,9 @@ void unlock_mutex(pthread_mutex_t *mutex) {
  * Unlocks (and checks for errors) a given rwlock
  */
 void unlock_rwlock(pthread_rwlock_t *rwlock) {
+#ifdef LOCK_PROFILE
+    lock_profile_released(rwlock);
+#endif
     if (pthread_rwlock_unlock(rwlock) != 0) {
         exit(EXIT_FAILURE);
     }
@@ -180,109 +638,725 @@ void destroy_rwlock(pthread_rwlock_t *rwlock) {
     }
 }
 
+// Number of NUMA nodes covered by the node masks of data_blocks_place
+#define NUMA_MAX_NODES (1024)
+#define NODE_MASK_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+/*
+ * Sets the NUMA policy of the instance on the mapping of the data blocks,
+ * which must not have been touched yet. Failures are ignored (the policy is
+ * only a hint, e.g. the kernel may not support NUMA).
+ */
+static void data_blocks_place(tfs_instance_t *fs, void *data, size_t size) {
+    unsigned long nodes[NUMA_MAX_NODES / NODE_MASK_BITS] = {0};
+    // the kernel reads one bit less than it is told
+    unsigned long max_node = NUMA_MAX_NODES + 1;
+    int mode;
+
+    switch (fs->fs_params.numa_policy) {
+    case TFS_NUMA_LOCAL: {
+        unsigned int cpu, node;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+            node >= NUMA_MAX_NODES) {
+            return;
+        }
+        nodes[node / NODE_MASK_BITS] |= 1UL << (node % NODE_MASK_BITS);
+        mode = MPOL_PREFERRED; // other nodes once it runs out of memory
+        break;
+    }
+    case TFS_NUMA_INTERLEAVE:
+        // the nodes the process may allocate from
+        if (syscall(SYS_get_mempolicy, NULL, nodes, max_node, NULL,
+                    MPOL_F_MEMS_ALLOWED) != 0) {
+            return;
+        }
+        mode = MPOL_INTERLEAVE;
+        break;
+    case TFS_NUMA_DEFAULT:
+    default:
+        return;
+    }
+
+    syscall(SYS_mbind, data, size, mode, nodes, max_node, 0);
+}
+
+/*
+ * Allocates the data blocks as set by the parameters of the instance. They
+ * are mapped, rather than malloc'd, when they are to be backed by huge pages
+ * or placed on NUMA nodes; huge pages come from the reserved pool if it has
+ * enough of them, and otherwise the mapping is aligned to them and advised to
+ * use transparent huge pages.
+ *
+ * Returns the data blocks, or NULL in case of error.
+ */
+static char *data_blocks_map(tfs_instance_t *fs) {
+    size_t size = MAX_DATA_BLOCKS * BLOCK_SIZE;
+    if (!fs->fs_params.huge_pages &&
+        fs->fs_params.numa_policy == TFS_NUMA_DEFAULT) {
+        return malloc(size);
+    }
+
+    int const prot = PROT_READ | PROT_WRITE;
+    int const flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *data = MAP_FAILED;
+    size_t align = (size_t)sysconf(_SC_PAGESIZE);
+    if (fs->fs_params.huge_pages) {
+        align = HUGE_PAGE_SIZE;
+        size = (size + align - 1) / align * align;
+        data = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+    }
+
+    if (data == MAP_FAILED) {
+        // maps an extra huge page, to trim it down to an aligned mapping
+        size_t extra = fs->fs_params.huge_pages ? align : 0;
+        char *mapping = mmap(NULL, size + extra, prot, flags, -1, 0);
+        if (mapping == MAP_FAILED) {
+            return NULL;
+        }
+        size_t head = (align - (uintptr_t)mapping % align) % align;
+        if (head > 0) {
+            munmap(mapping, head);
+        }
+        if (extra > head) {
+            munmap(mapping + head + size, extra - head);
+        }
+        data = mapping + head;
+        if (fs->fs_params.huge_pages) {
+            madvise(data, size, MADV_HUGEPAGE);
+        }
+    }
+
+    data_blocks_place(fs, data, size);
+    fs->fs_data_mapping = size;
+    return data;
+}
+
+/*
+ * Frees the tables of an instance, and the instance itself
+ */
+static void state_free(tfs_instance_t *fs) {
+    free(fs->inode_table);
+    free(fs->freeinode_ts);
+    free(fs->inode_cold_table);
+    if (fs->fs_data_mapping > 0) {
+        munmap(fs->fs_data, fs->fs_data_mapping);
+    } else {
+        free(fs->fs_data);
+    }
+    free(fs->free_blocks);
+    free(fs->block_extra_refs);
+    free(fs->block_cached);
+    free(fs->reclaim_queue);
+    free(fs->reclaim_batch);
+    free(fs->open_file_table);
+    free(fs->free_open_file_entries);
+    free(fs->open_file_table_locks);
+    free(fs->inode_open_refs);
+    free(fs->dir_entries_locks);
+    free(fs);
+}
+
+/*
+ * Initializes (and checks for errors) a given condition variable
+ */
+static void init_cond(pthread_cond_t *cond) {
+    if (pthread_cond_init(cond, NULL) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Destroys (and checks for errors) a given condition variable
+ */
+static void destroy_cond(pthread_cond_t *cond) {
+    if (pthread_cond_destroy(cond) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Stops the reclaimer (pending blocks need not be freed anymore)
+ */
+static void reclaimer_stop(tfs_instance_t *fs) {
+    lock_mutex(&fs->reclaim_lock);
+    fs->reclaim_stopping = true;
+    if (pthread_cond_signal(&fs->reclaim_cond) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    unlock_mutex(&fs->reclaim_lock);
+    if (pthread_join(fs->reclaim_thread, NULL) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Stops the prefetcher (pending requests are dropped)
+ */
+static void prefetcher_stop(tfs_instance_t *fs) {
+    lock_mutex(&fs->prefetch_lock);
+    fs->prefetch_stopping = true;
+    if (pthread_cond_signal(&fs->prefetch_cond) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    unlock_mutex(&fs->prefetch_lock);
+    if (pthread_join(fs->prefetch_thread, NULL) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Destroys the locks of an instance (once its background threads stopped),
+ * and frees it along with the magazines of the threads that used it
+ */
+static void state_teardown(tfs_instance_t *fs) {
+    // the magazines of threads still running are dropped (the key is deleted
+    // first, so that they are not released when those threads exit)
+    if (pthread_key_delete(fs->magazines_key) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    while (fs->magazines_list != NULL) {
+        thread_magazines_t *magazines = fs->magazines_list;
+        fs->magazines_list = magazines->next;
+        destroy_mutex(&magazines->inodes.lock);
+        destroy_mutex(&magazines->blocks.lock);
+        destroy_mutex(&magazines->handles.lock);
+        free(magazines);
+    }
+    // likewise for the statistics
+    if (pthread_key_delete(fs->op_stats_key) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    while (fs->op_stats_list != NULL) {
+        thread_op_stats_t *stats = fs->op_stats_list;
+        fs->op_stats_list = stats->next;
+        free(stats);
+    }
+
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        destroy_rwlock(&fs->inode_table[i].i_lock);
+    }
+    for (size_t i = 0; i < OPEN_FILE_TABLE_SIZE; i++) {
+        destroy_rwlock(&fs->open_file_table_locks[i]);
+    }
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        destroy_rwlock(&fs->dir_entries_locks[i]);
+    }
+    destroy_rwlock(&fs->dir_batch_lock);
+
+    destroy_rwlock(&fs->volume_lock.vl_lock);
+    destroy_mutex(&fs->volume_lock.vl_gate);
+    destroy_mutex(&fs->magazines_list_lock);
+    destroy_mutex(&fs->op_stats_lock);
+    destroy_mutex(&fs->reclaim_lock);
+    destroy_cond(&fs->reclaim_cond);
+    destroy_mutex(&fs->reclaim_batch_lock);
+    destroy_mutex(&fs->block_cache_lock);
+    destroy_mutex(&fs->prefetch_lock);
+    destroy_cond(&fs->prefetch_cond);
+    destroy_mutex(&fs->inode_allocator.lock);
+    destroy_mutex(&fs->block_allocator.lock);
+    destroy_mutex(&fs->open_file_allocator.lock);
+
+    state_free(fs);
+}
+
 /**
- * Initialize FS state.
+ * Initialize the state of a new FS instance.
  *
  * Input:
  *   - params: TécnicoFS parameters
  *
- * Returns 0 if successful, -1 otherwise.
+ * Returns the instance if successful, NULL otherwise.
  *
  * Possible errors:
- *   - TFS already initialized.
  *   - malloc failure when allocating TFS structures.
+ *   - No thread-specific data keys left (see PTHREAD_KEYS_MAX).
+ *   - Failure to start the background threads.
  */
-int state_init(tfs_params params) {
-    init_mutex(&open_files_mutex);
-    init_mutex(&open_file_lock);
-    fs_params = params;
+tfs_instance_t *state_init(tfs_params params) {
+    tfs_instance_t *fs = calloc(1, sizeof(tfs_instance_t));
+    if (fs == NULL) {
+        return NULL;
+    }
+    fs->fs_params = params;
+
+    // allocates the tables for their maximum size (large ones are only
+    // backed by memory as their entries are initialized)
+    // the inode table is cache line aligned (see inode_t)
+    fs->inode_table =
+        aligned_alloc(CACHE_LINE_SIZE, MAX_INODES * sizeof(inode_t));
+    fs->freeinode_ts = malloc(MAX_INODES * sizeof(allocation_state_t));
+    fs->inode_cold_table = malloc(MAX_INODES * sizeof(inode_cold_t));
+    fs->fs_data = data_blocks_map(fs);
+    fs->free_blocks = malloc(MAX_DATA_BLOCKS * sizeof(allocation_state_t));
+    fs->block_extra_refs = malloc(MAX_DATA_BLOCKS * sizeof(atomic_int));
+    fs->block_cached = malloc(MAX_DATA_BLOCKS * sizeof(atomic_bool));
+    fs->reclaim_queue = malloc(MAX_DATA_BLOCKS * sizeof(extent_t));
+    fs->reclaim_batch = malloc(MAX_DATA_BLOCKS * sizeof(extent_t));
+    fs->open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
+    fs->free_open_file_entries =
+        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
+    fs->open_file_table_locks =
+        malloc(MAX_OPEN_FILES * sizeof(pthread_rwlock_t));
+    fs->inode_open_refs = malloc(MAX_INODES * sizeof(atomic_uint));
+    fs->dir_entries_locks = malloc(MAX_DIR_ENTRIES * sizeof(pthread_rwlock_t));
+
+    if (!fs->inode_table || !fs->freeinode_ts || !fs->inode_cold_table ||
+        !fs->fs_data || !fs->free_blocks || !fs->block_extra_refs ||
+        !fs->block_cached || !fs->reclaim_queue || !fs->reclaim_batch ||
+        !fs->open_file_table || !fs->free_open_file_entries ||
+        !fs->open_file_table_locks || !fs->inode_open_refs ||
+        !fs->dir_entries_locks) {
+        state_free(fs);
+        return NULL; // allocation failed
+    }
 
-    if (inode_table != NULL) {
-        return -1; // already initialized
+    // the per-thread magazines and statistics of the instance
+    if (pthread_key_create(&fs->magazines_key, magazines_release) != 0) {
+        state_free(fs);
+        return NULL; // no keys left
+    }
+    if (pthread_key_create(&fs->op_stats_key, op_stats_release) != 0) {
+        if (pthread_key_delete(fs->magazines_key) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        state_free(fs);
+        return NULL; // no keys left
     }
 
-    // sets all the locks, tables and file entries
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    inode_table_locks = malloc(INODE_TABLE_SIZE * sizeof(pthread_rwlock_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    data_blocks_locks = malloc(DATA_BLOCKS * sizeof(pthread_rwlock_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    free_open_file_entries =
-        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
-    open_file_table_locks = malloc(MAX_OPEN_FILES * sizeof(pthread_rwlock_t));
-    dir_entries_locks = malloc(MAX_DIR_ENTRIES * sizeof(pthread_rwlock_t));
+    init_rwlock(&fs->volume_lock.vl_lock);
+    init_mutex(&fs->volume_lock.vl_gate);
+    atomic_init(&fs->volume_lock.vl_freeze_pending, false);
+    init_mutex(&fs->magazines_list_lock);
+    init_mutex(&fs->op_stats_lock);
+    init_mutex(&fs->reclaim_lock);
+    init_cond(&fs->reclaim_cond);
+    init_mutex(&fs->reclaim_batch_lock);
+    init_mutex(&fs->block_cache_lock);
+    init_mutex(&fs->prefetch_lock);
+    init_cond(&fs->prefetch_cond);
+
+    fs->inode_allocator = (allocator_t){
+        .map = &fs->freeinode_ts,
+        .size = &fs->inode_table_size,
+        .max_size = &fs->fs_params.max_inode_count,
+        .chunk = INODE_TABLE_CHUNK,
+        .init = inode_table_init,
+    };
+    fs->block_allocator = (allocator_t){
+        .map = &fs->free_blocks,
+        .size = &fs->data_blocks_size,
+        .max_size = &fs->fs_params.max_block_count,
+        .chunk = DATA_BLOCKS_CHUNK,
+        .init = data_blocks_init,
+    };
+    fs->open_file_allocator = (allocator_t){
+        .map = &fs->free_open_file_entries,
+        .size = &fs->open_file_table_size,
+        .max_size = &fs->fs_params.max_open_files_count,
+        .chunk = OPEN_FILES_CHUNK,
+        .init = open_file_table_init,
+        .volatile_map = true,
+    };
+    init_mutex(&fs->inode_allocator.lock);
+    init_mutex(&fs->block_allocator.lock);
+    init_mutex(&fs->open_file_allocator.lock);
+
+    // sets the locks and entries of the first chunk of each table
+    allocator_grow(fs, &fs->inode_allocator, 0);
+    allocator_grow(fs, &fs->block_allocator, 0);
+    allocator_grow(fs, &fs->open_file_allocator, 0);
+
+    for (size_t i = 0; i < BLOCK_CACHE_BLOCKS; i++) {
+        fs->block_cache_slots[i] = -1;
+    }
 
-    if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !open_file_table || !free_open_file_entries) {
-        return -1; // allocation failed
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        init_rwlock(&fs->dir_entries_locks[i]);
     }
+    init_rwlock(&fs->dir_batch_lock);
 
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        init_rwlock(&inode_table_locks[i]);
-        freeinode_ts[i] = FREE;
+    if (pthread_create(&fs->reclaim_thread, NULL, reclaimer_fn, fs) != 0) {
+        state_teardown(fs);
+        return NULL;
     }
+    if (pthread_create(&fs->prefetch_thread, NULL, prefetcher_fn, fs) != 0) {
+        reclaimer_stop(fs);
+        state_teardown(fs);
+        return NULL;
+    }
+
+    return fs;
+}
 
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        init_rwlock(&data_blocks_locks[i]);
-        free_blocks[i] = FREE;
+/**
+ * Destroy the state of an FS instance (and the instance itself).
+ *
+ * Returns 0 if succesful, -1 otherwise.
+ */
+int state_destroy(tfs_instance_t *fs) {
+    reclaimer_stop(fs);
+    prefetcher_stop(fs);
+    state_teardown(fs);
+    return 0;
+}
+
+/**
+ * Queue a run of blocks to be freed by the reclaimer.
+ */
+static void reclaim_defer(tfs_instance_t *fs, int start, int len) {
+    lock_mutex(&fs->reclaim_lock);
+    fs->reclaim_queue[fs->reclaim_queue_count].e_start = start;
+    fs->reclaim_queue[fs->reclaim_queue_count].e_len = len;
+    fs->reclaim_queue_count++;
+    atomic_fetch_add(&fs->reclaim_backlog, (size_t)len);
+    atomic_fetch_sub(&fs->block_allocator.in_use, (size_t)len);
+    if (pthread_cond_signal(&fs->reclaim_cond) != 0) {
+        exit(EXIT_FAILURE);
     }
+    unlock_mutex(&fs->reclaim_lock);
+}
 
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        init_rwlock(&open_file_table_locks[i]);
-        free_open_file_entries[i] = FREE;
+/**
+ * Free all the runs of blocks queued so far, as one batch. Called by the
+ * reclaimer, and by allocators that would otherwise fail. The caller must not
+ * hold the block allocator's lock.
+ *
+ * Returns the number of blocks freed.
+ */
+static size_t reclaim_process(tfs_instance_t *fs) {
+    lock_mutex(&fs->reclaim_batch_lock);
+
+    lock_mutex(&fs->reclaim_lock);
+    extent_t *batch = fs->reclaim_queue;
+    size_t count = fs->reclaim_queue_count;
+    fs->reclaim_queue = fs->reclaim_batch;
+    fs->reclaim_batch = batch;
+    fs->reclaim_queue_count = 0;
+    unlock_mutex(&fs->reclaim_lock);
+
+    size_t freed = 0;
+    if (count > 0) {
+        lock_mutex(&fs->block_allocator.lock);
+        insert_delay(); // simulate storage access delay to free_blocks
+        for (size_t i = 0; i < count; i++) {
+            for (int b = batch[i].e_start;
+                 b < batch[i].e_start + batch[i].e_len; b++) {
+                fs->free_blocks[b] = FREE;
+            }
+            freed += (size_t)batch[i].e_len;
+        }
+        unlock_mutex(&fs->block_allocator.lock);
+
+        atomic_fetch_sub(&fs->reclaim_backlog, freed);
     }
 
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        init_rwlock(&dir_entries_locks[i]);
+    unlock_mutex(&fs->reclaim_batch_lock);
+    return freed;
+}
+
+/*
+ * Background reclaimer: frees queued blocks until the state is destroyed
+ */
+static void *reclaimer_fn(void *arg) {
+    tfs_instance_t *fs = (tfs_instance_t *)arg;
+
+    lock_mutex(&fs->reclaim_lock);
+    while (!fs->reclaim_stopping) {
+        if (fs->reclaim_queue_count == 0) {
+            if (pthread_cond_wait(&fs->reclaim_cond, &fs->reclaim_lock) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        unlock_mutex(&fs->reclaim_lock);
+        reclaim_process(fs);
+        lock_mutex(&fs->reclaim_lock);
     }
+    unlock_mutex(&fs->reclaim_lock);
+    return NULL;
+}
 
-    return 0;
+/*
+ * Initializes inodes first to end - 1 (as free)
+ */
+static void inode_table_init(tfs_instance_t *fs, size_t first, size_t end) {
+    for (size_t i = first; i < end; i++) {
+        init_rwlock(&fs->inode_table[i].i_lock);
+        fs->freeinode_ts[i] = FREE;
+        // free inodes count as unlinked, so they cannot be pinned
+        atomic_init(&fs->inode_open_refs[i], INODE_UNLINKED);
+    }
+}
+
+/*
+ * Initializes data blocks first to end - 1 (as free)
+ */
+static void data_blocks_init(tfs_instance_t *fs, size_t first, size_t end) {
+    for (size_t i = first; i < end; i++) {
+        fs->free_blocks[i] = FREE;
+        atomic_init(&fs->block_extra_refs[i], 0);
+        atomic_init(&fs->block_cached[i], false);
+    }
+}
+
+/*
+ * Initializes open file entries first to end - 1 (as free)
+ */
+static void open_file_table_init(tfs_instance_t *fs, size_t first,
+                                 size_t end) {
+    for (size_t i = first; i < end; i++) {
+        init_rwlock(&fs->open_file_table_locks[i]);
+        fs->free_open_file_entries[i] = FREE;
+        atomic_init(&fs->open_file_table[i].of_buffered, false);
+        atomic_init(&fs->open_file_table[i].of_open, false);
+    }
 }
 
 /**
- * Destroy FS state.
+ * Grow the table of an allocator by one chunk (up to its maximum size), if
+ * it still has the size the caller found to be full. The caller must hold
+ * the allocator's lock.
  *
- * Returns 0 if succesful, -1 otherwise.
+ * Returns true if the table is now larger than seen_size.
  */
-int state_destroy(void) {
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        destroy_rwlock(&inode_table_locks[i]);
+static bool allocator_grow_locked(tfs_instance_t *fs, allocator_t *allocator,
+                                  size_t seen_size) {
+    size_t size = atomic_load(allocator->size);
+    if (size == seen_size && size < *allocator->max_size) {
+        size_t end = size + allocator->chunk;
+        if (end > *allocator->max_size) {
+            end = *allocator->max_size;
+        }
+        allocator->init(fs, size, end);
+        allocator->cursor = size; // the next refill starts in the new chunk
+        atomic_store(allocator->size, end);
     }
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        destroy_rwlock(&data_blocks_locks[i]);
+    return atomic_load(allocator->size) > seen_size;
+}
+
+static bool allocator_grow(tfs_instance_t *fs, allocator_t *allocator,
+                           size_t seen_size) {
+    lock_mutex(&allocator->lock);
+    bool grown = allocator_grow_locked(fs, allocator, seen_size);
+    unlock_mutex(&allocator->lock);
+    return grown;
+}
+
+/**
+ * Move up to MAGAZINE_BATCH free numbers from the global map into a magazine.
+ * The caller must hold the magazine's lock.
+ */
+static void allocator_refill(tfs_instance_t *fs, allocator_t *allocator,
+                             magazine_t *magazine) {
+    int batch[MAGAZINE_BATCH];
+    size_t found = 0;
+    size_t size = atomic_load(allocator->size);
+
+    lock_mutex(&allocator->lock);
+    allocation_state_t *map = *allocator->map;
+    size_t start = allocator->cursor;
+    for (size_t n = 0; n < size && found < MAGAZINE_BATCH; n++) {
+        size_t i = (start + n) % size;
+        if (!allocator->volatile_map &&
+            (n == 0 || (i * sizeof(allocation_state_t) % BLOCK_SIZE) == 0)) {
+            insert_delay(); // simulate storage access delay (to the map)
+        }
+
+        if (map[i] == FREE) {
+            map[i] = TAKEN;
+            batch[found++] = (int)i;
+            allocator->cursor = (i + 1) % size;
+        }
     }
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        destroy_rwlock(&open_file_table_locks[i]);
+    unlock_mutex(&allocator->lock);
+
+    // pushed in reverse, so that the lowest numbers are handed out first
+    while (found > 0) {
+        magazine->entries[magazine->count++] = batch[--found];
     }
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        destroy_rwlock(&dir_entries_locks[i]);
-    }
-
-    free(inode_table);
-    free(freeinode_ts);
-    free(fs_data);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
-    free(inode_table_locks);
-    free(data_blocks_locks);
-    free(open_file_table_locks);
-    free(dir_entries_locks);
-
-    inode_table = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    free_open_file_entries = NULL;
-    inode_table_locks = NULL;
-    data_blocks_locks = NULL;
-    open_file_table_locks = NULL;
-    dir_entries_locks = NULL;
+}
 
-    return 0;
+/**
+ * Return the first count numbers of a magazine to the global map.
+ * The caller must hold the magazine's lock.
+ */
+static void allocator_drain(allocator_t *allocator, magazine_t *magazine,
+                            size_t count) {
+    lock_mutex(&allocator->lock);
+    if (!allocator->volatile_map) {
+        insert_delay(); // simulate storage access delay (to the map)
+    }
+    allocation_state_t *map = *allocator->map;
+    for (size_t i = 0; i < count; i++) {
+        map[magazine->entries[i]] = FREE;
+    }
+    unlock_mutex(&allocator->lock);
+
+    magazine->count -= count;
+    memmove(magazine->entries, magazine->entries + count,
+            magazine->count * sizeof(int));
+}
+
+/*
+ * Returns the magazine, among a thread's magazines, for the given allocator
+ */
+static magazine_t *magazine_of(tfs_instance_t *fs,
+                               thread_magazines_t *magazines,
+                               allocator_t const *allocator) {
+    if (allocator == &fs->inode_allocator) {
+        return &magazines->inodes;
+    }
+    if (allocator == &fs->block_allocator) {
+        return &magazines->blocks;
+    }
+    return &magazines->handles;
+}
+
+/*
+ * Returns a thread's magazines to the global maps when it exits
+ */
+static void magazines_release(void *arg) {
+    thread_magazines_t *magazines = (thread_magazines_t *)arg;
+    tfs_instance_t *fs = magazines->fs;
+
+    lock_mutex(&fs->magazines_list_lock);
+    for (thread_magazines_t **m = &fs->magazines_list; *m != NULL;
+         m = &(*m)->next) {
+        if (*m == magazines) {
+            *m = magazines->next;
+            break;
+        }
+    }
+    lock_mutex(&magazines->inodes.lock);
+    allocator_drain(&fs->inode_allocator, &magazines->inodes,
+                    magazines->inodes.count);
+    unlock_mutex(&magazines->inodes.lock);
+    lock_mutex(&magazines->blocks.lock);
+    allocator_drain(&fs->block_allocator, &magazines->blocks,
+                    magazines->blocks.count);
+    unlock_mutex(&magazines->blocks.lock);
+    lock_mutex(&magazines->handles.lock);
+    allocator_drain(&fs->open_file_allocator, &magazines->handles,
+                    magazines->handles.count);
+    unlock_mutex(&magazines->handles.lock);
+    unlock_mutex(&fs->magazines_list_lock);
+
+    destroy_mutex(&magazines->inodes.lock);
+    destroy_mutex(&magazines->blocks.lock);
+    destroy_mutex(&magazines->handles.lock);
+    free(magazines);
+}
+
+/*
+ * Returns the calling thread's magazine for the given allocator, creating
+ * (and registering) the thread's magazines on first use
+ */
+static magazine_t *thread_magazine(tfs_instance_t *fs,
+                                   allocator_t const *allocator) {
+    thread_magazines_t *magazines = pthread_getspecific(fs->magazines_key);
+    if (magazines == NULL) {
+        magazines = malloc(sizeof(thread_magazines_t));
+        ALWAYS_ASSERT(magazines != NULL,
+                      "thread_magazine: failed to allocate magazines");
+        magazines->fs = fs;
+        init_mutex(&magazines->inodes.lock);
+        magazines->inodes.count = 0;
+        init_mutex(&magazines->blocks.lock);
+        magazines->blocks.count = 0;
+        init_mutex(&magazines->handles.lock);
+        magazines->handles.count = 0;
+
+        if (pthread_setspecific(fs->magazines_key, magazines) != 0) {
+            exit(EXIT_FAILURE);
+        }
+
+        lock_mutex(&fs->magazines_list_lock);
+        magazines->next = fs->magazines_list;
+        fs->magazines_list = magazines;
+        unlock_mutex(&fs->magazines_list_lock);
+    }
+
+    return magazine_of(fs, magazines, allocator);
+}
+
+/**
+ * Take a number cached by some other thread, when the global map is
+ * exhausted.
+ *
+ * Returns the number, or -1 if no thread has one cached.
+ */
+static int allocator_steal(tfs_instance_t *fs, allocator_t const *allocator) {
+    int number = -1;
+
+    lock_mutex(&fs->magazines_list_lock);
+    for (thread_magazines_t *m = fs->magazines_list;
+         m != NULL && number == -1; m = m->next) {
+        magazine_t *magazine = magazine_of(fs, m, allocator);
+        lock_mutex(&magazine->lock);
+        if (magazine->count > 0) {
+            number = magazine->entries[--magazine->count];
+        }
+        unlock_mutex(&magazine->lock);
+    }
+    unlock_mutex(&fs->magazines_list_lock);
+
+    return number;
+}
+
+/**
+ * Allocate a number (inode, block or file handle), from the calling thread's
+ * magazine whenever possible.
+ *
+ * Returns the number, or -1 if there are no free entries.
+ */
+static int allocator_alloc(tfs_instance_t *fs, allocator_t *allocator) {
+    magazine_t *magazine = thread_magazine(fs, allocator);
+    size_t seen_size = atomic_load(allocator->size);
+    int number = -1;
+
+    lock_mutex(&magazine->lock);
+    if (magazine->count == 0) {
+        allocator_refill(fs, allocator, magazine);
+    }
+    if (magazine->count > 0) {
+        number = magazine->entries[--magazine->count];
+    }
+    unlock_mutex(&magazine->lock);
+
+    if (number == -1) {
+        // must not hold our own magazine's lock while stealing
+        number = allocator_steal(fs, allocator);
+    }
+    if (number == -1 && allocator == &fs->block_allocator &&
+        reclaim_process(fs) > 0) {
+        // blocks pending reclamation were freed, so try again
+        return allocator_alloc(fs, allocator);
+    }
+    if (number == -1 && allocator_grow(fs, allocator, seen_size)) {
+        return allocator_alloc(fs, allocator); // the table grew, so try again
+    }
+    if (number != -1) {
+        atomic_fetch_add(&allocator->in_use, 1);
+    }
+    return number;
+}
+
+/**
+ * Free a number (inode, block or file handle) into the calling thread's
+ * magazine, returning a batch to the global map if the magazine is full.
+ */
+static void allocator_free(tfs_instance_t *fs, allocator_t *allocator,
+                           int number) {
+    magazine_t *magazine = thread_magazine(fs, allocator);
+    atomic_fetch_sub(&allocator->in_use, 1);
+
+    lock_mutex(&magazine->lock);
+    if (magazine->count == MAGAZINE_SIZE) {
+        allocator_drain(allocator, magazine, MAGAZINE_BATCH);
+    }
+    magazine->entries[magazine->count++] = number;
+    unlock_mutex(&magazine->lock);
 }
 
 /**
@@ -294,26 +1368,8 @@ int state_destroy(void) {
  * Possible errors:
  *   - No free slots in inode table.
  */
-static int inode_alloc(void) {
-    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
-
-        write_lock_rwlock(&inode_table_locks[inumber]); // locks for writing
-        // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            //  Found a free entry, so takes it for the new inode
-            freeinode_ts[inumber] = TAKEN;
-            unlock_rwlock(
-                &inode_table_locks[inumber]); // if free, then unlocks the latch
-
-            return (int)inumber;
-        }
-        unlock_rwlock(&inode_table_locks[inumber]); // unlocks the latch
-    }
-    // no free inodes
-    return -1;
+static int inode_alloc(tfs_instance_t *fs) {
+    return allocator_alloc(fs, &fs->inode_allocator);
 }
 
 /**
@@ -321,8 +1377,8 @@ static int inode_alloc(void) {
  *
  * Allocates and initializes a new inode.
  * Directories will have their data block allocated and initialized, with i_size
- * set to BLOCK_SIZE. Regular files will not have their data block allocated
- * (i_size will be set to 0, i_data_block to -1).
+ * set to BLOCK_SIZE. Regular files will not have any data block allocated
+ * (i_size and i_extent_count will be set to 0).
  *
  * Input:
  *   - i_type: the type of the node (file or directory)
@@ -333,102 +1389,671 @@ static int inode_alloc(void) {
  *   - No free slots in inode table.
  *   - (if creating a directory) No free data blocks.
  */
-int inode_create(inode_type i_type) {
-    int inumber = inode_alloc();
+int inode_create(tfs_instance_t *fs, inode_type i_type) {
+    int inumber = inode_alloc(fs);
     if (inumber == -1) {
         return -1; // no free slots in inode table
     }
 
-    inode_t *inode = &inode_table[inumber];
+    inode_t *inode = &fs->inode_table[inumber];
     insert_delay(); // simulate storage access delay (to inode)
 
     inode->i_node_type = i_type;
+    atomic_store(&fs->inode_open_refs[inumber], 0);
     switch (i_type) {
     case T_DIRECTORY: {
         // Initializes directory (filling its block with empty entries, labeled
         // with inumber==-1)
-        int b = data_block_alloc();
+        int b = data_block_alloc(fs);
         if (b == -1) {
             // ensure fields are initialized
             inode->i_size = 0;
-            inode->i_data_block = -1;
+            inode->i_extent_count = 0;
 
             // run regular deletion process
-            inode_delete(inumber);
+            inode_delete(fs, inumber);
             return -1;
         }
 
-        inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
-        inode_table[inumber].i_hardlink_counter = 1;
+        fs->inode_table[inumber].i_size = BLOCK_SIZE;
+        fs->inode_table[inumber].i_extents[0].e_start = b;
+        fs->inode_table[inumber].i_extents[0].e_len = 1;
+        fs->inode_table[inumber].i_extent_count = 1;
+        fs->inode_table[inumber].i_hardlink_counter = 1;
 
-        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
+        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(fs, b);
         ALWAYS_ASSERT(dir_entry != NULL,
                       "inode_create: data block freed while in use");
 
         for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
             dir_entry[i].d_inumber = -1;
         }
-    } break;
-    case T_FILE:
-        // In case of a new file, simply sets its size to 0
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        inode_table[inumber].i_hardlink_counter = 1;
-        break;
-    case T_SYMLINK:
-        // In case of a new Symbolic Link
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        inode_table[inumber].i_hardlink_counter = 1;
-        break;
-    default:
-        PANIC("inode_create: unknown file type");
+    } break;
+    case T_FILE:
+        // In case of a new file, simply sets its size to 0
+        fs->inode_table[inumber].i_size = 0;
+        fs->inode_table[inumber].i_extent_count = 0;
+        fs->inode_table[inumber].i_hardlink_counter = 1;
+        break;
+    case T_SYMLINK:
+        // In case of a new Symbolic Link
+        fs->inode_table[inumber].i_size = 0;
+        fs->inode_table[inumber].i_extent_count = 0;
+        fs->inode_table[inumber].i_hardlink_counter = 1;
+        break;
+    default:
+        PANIC("inode_create: unknown file type");
+    }
+
+    return inumber;
+}
+
+/**
+ * Create several regular files or symbolic links in the inode table, like
+ * inode_create, paying a single storage access delay for all of them.
+ *
+ * Input:
+ *   - i_type: the type of the nodes (file or symbolic link)
+ *   - inumbers: where to store the inumbers of the new inodes
+ *   - count: number of inodes to create
+ *
+ * Returns the number of inodes created (lower than count if the inode table
+ * is full).
+ */
+size_t inodes_create(tfs_instance_t *fs, inode_type i_type, int *inumbers,
+                     size_t count) {
+    ALWAYS_ASSERT(i_type != T_DIRECTORY,
+                  "inodes_create: directories are not supported");
+
+    insert_delay(); // simulate storage access delay (to the inodes)
+
+    size_t created = 0;
+    for (; created < count; created++) {
+        int inumber = inode_alloc(fs);
+        if (inumber == -1) {
+            break; // no free slots in inode table
+        }
+        inode_t *inode = &fs->inode_table[inumber];
+        inode->i_node_type = i_type;
+        inode->i_size = 0;
+        inode->i_extent_count = 0;
+        inode->i_hardlink_counter = 1;
+        atomic_store(&fs->inode_open_refs[inumber], 0);
+        inumbers[created] = inumber;
+    }
+    return created;
+}
+
+/**
+ * Delete an inode.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_delete(tfs_instance_t *fs, int inumber) {
+    // simulate storage access delay (to inode; freeinode_ts is only touched
+    // when the thread's magazine is drained)
+    insert_delay();
+
+    ALWAYS_ASSERT(valid_inumber(fs, inumber), "inode_delete: invalid inumber");
+
+    ALWAYS_ASSERT(fs->freeinode_ts[inumber] == TAKEN,
+                  "inode_delete: inode already freed");
+
+    inode_free_blocks(fs, &fs->inode_table[inumber]);
+    // a free inode cannot be pinned (also if it never had a name, e.g. when
+    // adding its name failed), until inode_create reuses it
+    atomic_store(&fs->inode_open_refs[inumber], INODE_UNLINKED);
+    allocator_free(fs, &fs->inode_allocator, inumber);
+}
+
+/**
+ * Pin an inode for a new file handle: all the handles open on an inode share
+ * it (each with its own offset), and it is not deleted until the last of them
+ * is closed, even if its last name is removed meanwhile (see inode_unlink).
+ * Takes no locks.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns true if successful, false if its last name was already removed.
+ */
+bool inode_pin(tfs_instance_t *fs, int inumber) {
+    ALWAYS_ASSERT(valid_inumber(fs, inumber), "inode_pin: invalid inumber");
+
+    atomic_uint *refs = &fs->inode_open_refs[inumber];
+    unsigned int seen = atomic_load(refs);
+    do {
+        if (seen & INODE_UNLINKED) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(refs, &seen,
+                                           seen + INODE_HANDLE_REF));
+    return true;
+}
+
+/**
+ * Unpin an inode when one of its file handles is closed (see inode_pin).
+ * The last pin of an inode marked as having preallocated blocks (see
+ * inode_mark_preallocated) is not dropped, but the mark is cleared instead,
+ * in the same step, so that exactly one caller releases the blocks; it must
+ * then unpin the inode again. Takes no locks.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns UNPIN_DELETE if it was the last handle of an inode whose last name
+ * was removed, which the caller must then delete, UNPIN_TRIM if the caller
+ * must release the unused preallocated blocks (and unpin again), and
+ * UNPIN_DONE otherwise.
+ */
+unpin_result_t inode_unpin(tfs_instance_t *fs, int inumber) {
+    ALWAYS_ASSERT(valid_inumber(fs, inumber), "inode_unpin: invalid inumber");
+
+    atomic_uint *refs = &fs->inode_open_refs[inumber];
+    unsigned int seen = atomic_load(refs);
+    unsigned int next;
+    bool trim;
+    do {
+        ALWAYS_ASSERT(seen >= INODE_HANDLE_REF, "inode_unpin: inode not pinned");
+        bool last = seen < 2 * INODE_HANDLE_REF;
+        trim = last && (seen & INODE_PREALLOCATED) && !(seen & INODE_UNLINKED);
+        if (trim) {
+            next = seen & ~INODE_PREALLOCATED; // keeps the pin for the trim
+        } else if (last) {
+            // (the blocks of an unlinked inode are freed along with it)
+            next = (seen - INODE_HANDLE_REF) & ~INODE_PREALLOCATED;
+        } else {
+            next = seen - INODE_HANDLE_REF;
+        }
+    } while (!atomic_compare_exchange_weak(refs, &seen, next));
+
+    if (trim) {
+        return UNPIN_TRIM;
+    }
+    return next == INODE_UNLINKED ? UNPIN_DELETE : UNPIN_DONE;
+}
+
+/**
+ * Mark a pinned inode as having preallocated blocks (see tfs_fallocate),
+ * which are kept until the last of its file handles is closed.
+ * Takes no locks.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_mark_preallocated(tfs_instance_t *fs, int inumber) {
+    ALWAYS_ASSERT(valid_inumber(fs, inumber),
+                  "inode_mark_preallocated: invalid inumber");
+
+    atomic_fetch_or(&fs->inode_open_refs[inumber], INODE_PREALLOCATED);
+}
+
+/**
+ * Mark an inode as having had its last name removed, so that no more file
+ * handles are opened on it. Takes no locks.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns true if no handles are open on it, in which case the caller must
+ * delete it now; otherwise, it is deleted when its last handle is closed
+ * (see inode_unpin).
+ */
+bool inode_unlink(tfs_instance_t *fs, int inumber) {
+    ALWAYS_ASSERT(valid_inumber(fs, inumber), "inode_unlink: invalid inumber");
+
+    unsigned int refs =
+        atomic_fetch_or(&fs->inode_open_refs[inumber], INODE_UNLINKED);
+    return (refs & ~INODE_PREALLOCATED) == 0;
+}
+
+/**
+ * Obtain a pointer to an inode from its inumber.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns pointer to inode.
+ */
+inode_t *inode_get(tfs_instance_t *fs, int inumber) {
+    ALWAYS_ASSERT(valid_inumber(fs, inumber), "inode_get: invalid inumber");
+
+    insert_delay(); // simulate storage access delay to inode
+    return &fs->inode_table[inumber];
+}
+
+/**
+ * Obtain a pointer to the symlink target of an inode from its inumber.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns pointer to the (MAX_FILE_NAME sized) symlink target buffer.
+ */
+char *inode_symlink_target(tfs_instance_t *fs, int inumber) {
+    ALWAYS_ASSERT(valid_inumber(fs, inumber),
+                  "inode_symlink_target: invalid inumber");
+
+    return fs->inode_cold_table[inumber].i_symlink_target;
+}
+
+/**
+ * Obtain the number of data blocks of an inode.
+ *
+ * Input:
+ *   - inode: the inode
+ */
+size_t inode_block_count(inode_t const *inode) {
+    size_t count = 0;
+    for (int i = 0; i < inode->i_extent_count; i++) {
+        count += (size_t)inode->i_extents[i].e_len;
+    }
+    return count;
+}
+
+/**
+ * Locate the data block holding a given block of a file.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - file_block: index of the block within the file
+ *   - run: where to store the number of contiguous blocks (in the file and on
+ *     the volume) starting at the returned block
+ *
+ * Returns the block number, or -1 if the file has no such block.
+ */
+int inode_block_run(inode_t const *inode, size_t file_block, size_t *run) {
+    for (int i = 0; i < inode->i_extent_count; i++) {
+        extent_t const *extent = &inode->i_extents[i];
+        if (file_block < (size_t)extent->e_len) {
+            *run = (size_t)extent->e_len - file_block;
+            return extent->e_start + (int)file_block;
+        }
+        file_block -= (size_t)extent->e_len;
+    }
+    return -1;
+}
+
+/**
+ * Mark as TAKEN the free blocks starting at start, stopping at the first
+ * taken block or after count blocks. The caller must hold the block
+ * allocator's lock.
+ *
+ * Returns the number of blocks taken.
+ */
+static size_t blocks_take_run(tfs_instance_t *fs, size_t start, size_t count) {
+    size_t taken = 0;
+    while (taken < count && start + taken < DATA_BLOCKS &&
+           fs->free_blocks[start + taken] == FREE) {
+        fs->free_blocks[start + taken] = TAKEN;
+        taken++;
+    }
+    atomic_fetch_add(&fs->block_allocator.in_use, taken);
+    return taken;
+}
+
+/**
+ * Find the smallest run of free blocks with at least count blocks (best-fit),
+ * or the largest run if there is no such run. The caller must hold the block
+ * allocator's lock.
+ *
+ * Returns the length of the run found (0 if there are no free blocks).
+ */
+static size_t blocks_best_fit(tfs_instance_t *fs, size_t count, size_t *start) {
+    size_t best_len = 0;
+    size_t best_start = 0;
+
+    insert_delay(); // simulate storage access delay to free_blocks
+    for (size_t i = 0; i < DATA_BLOCKS;) {
+        if (fs->free_blocks[i] != FREE) {
+            i++;
+            continue;
+        }
+        size_t len = 0;
+        while (i + len < DATA_BLOCKS && fs->free_blocks[i + len] == FREE) {
+            len++;
+        }
+        bool fits = len >= count;
+        bool best_fits = best_len >= count;
+        if ((fits && (!best_fits || len < best_len)) ||
+            (!fits && !best_fits && len > best_len)) {
+            best_len = len;
+            best_start = i;
+        }
+        if (len == count) {
+            break; // exact fit
+        }
+        i += len;
+    }
+
+    *start = best_start;
+    return best_len;
+}
+
+/**
+ * Take blocks start, start + 1, ... from the top of the calling thread's
+ * magazine, while they are there.
+ *
+ * Returns the number of blocks taken.
+ */
+static size_t magazine_take_run(tfs_instance_t *fs, int start, size_t count) {
+    magazine_t *magazine = thread_magazine(fs, &fs->block_allocator);
+    size_t taken = 0;
+
+    lock_mutex(&magazine->lock);
+    while (taken < count && magazine->count > 0 &&
+           magazine->entries[magazine->count - 1] == start + (int)taken) {
+        magazine->count--;
+        taken++;
+    }
+    unlock_mutex(&magazine->lock);
+    atomic_fetch_add(&fs->block_allocator.in_use, taken);
+    return taken;
+}
+
+/**
+ * Append a run of blocks to an inode, merging it into the last extent when
+ * contiguous.
+ *
+ * Returns false if the inode has no free extent slot for it.
+ */
+static bool inode_append_run(inode_t *inode, int start, size_t len) {
+    if (inode->i_extent_count > 0) {
+        extent_t *last = &inode->i_extents[inode->i_extent_count - 1];
+        if (last->e_start + last->e_len == start) {
+            last->e_len += (int)len;
+            return true;
+        }
+    }
+    if (inode->i_extent_count == INODE_MAX_EXTENTS) {
+        return false;
+    }
+    inode->i_extents[inode->i_extent_count].e_start = start;
+    inode->i_extents[inode->i_extent_count].e_len = (int)len;
+    inode->i_extent_count++;
+    return true;
+}
+
+/**
+ * Allocate data blocks at the end of a file, keeping them as contiguous as
+ * possible: the last extent is grown in place whenever the following blocks
+ * are free, and new extents are placed in the best fitting run of free
+ * blocks. A single block for an empty file comes from the thread's magazine.
+ *
+ * Input:
+ *   - inode: the inode (write-locked by the caller)
+ *   - count: number of blocks to add
+ *
+ * Returns the number of blocks allocated, which is lower than count if the
+ * volume is full or the inode ran out of extents.
+ */
+size_t inode_alloc_blocks(tfs_instance_t *fs, inode_t *inode, size_t count) {
+    size_t added = 0;
+
+    if (count == 1 && inode->i_extent_count == 0) {
+        int b = data_block_alloc(fs);
+        if (b == -1) {
+            return 0;
+        }
+        inode_append_run(inode, b, 1);
+        return 1;
+    }
+
+    if (inode->i_extent_count > 0) {
+        // first, try to grow the last extent in place
+        extent_t *last = &inode->i_extents[inode->i_extent_count - 1];
+        added += magazine_take_run(fs, last->e_start + last->e_len, count);
+        last->e_len += (int)added;
+    }
+
+    lock_mutex(&fs->block_allocator.lock);
+    if (inode->i_extent_count > 0 && added < count) {
+        extent_t *last = &inode->i_extents[inode->i_extent_count - 1];
+        size_t grown = blocks_take_run(
+            fs, (size_t)(last->e_start + last->e_len), count - added);
+        last->e_len += (int)grown;
+        added += grown;
+    }
+    while (added < count && inode->i_extent_count < INODE_MAX_EXTENTS) {
+        // look for room to (at least) double the file, so that later appends
+        // can keep growing the new extent in place
+        size_t want = count - added;
+        size_t size_hint = inode_block_count(inode);
+        size_t start;
+        size_t seen_size = DATA_BLOCKS;
+        size_t len = blocks_best_fit(
+            fs, want > size_hint ? want : size_hint, &start);
+        if (len == 0) {
+            // no free runs left, unless there are blocks pending reclamation
+            // or the table can grow
+            unlock_mutex(&fs->block_allocator.lock);
+            bool reclaimed = reclaim_process(fs) > 0;
+            lock_mutex(&fs->block_allocator.lock);
+            if (!reclaimed &&
+                !allocator_grow_locked(fs, &fs->block_allocator, seen_size)) {
+                break;
+            }
+            continue;
+        }
+        if (len > want) {
+            len = want;
+        }
+        blocks_take_run(fs, start, len);
+        inode_append_run(inode, (int)start, len);
+        added += len;
+    }
+    unlock_mutex(&fs->block_allocator.lock);
+
+    // the map is exhausted: use single blocks cached by threads, if any
+    while (added < count) {
+        int b = data_block_alloc(fs);
+        if (b == -1) {
+            break;
+        }
+        if (!inode_append_run(inode, b, 1)) {
+            data_block_free(fs, b);
+            break;
+        }
+        added++;
+    }
+
+    return added;
+}
+
+/**
+ * Drop an inode's reference to a run of blocks: blocks shared with other
+ * inodes lose one reference, the others are queued for the reclaimer.
+ */
+static void blocks_release(tfs_instance_t *fs, int start, int len) {
+    int free_start = start;
+    for (int b = start; b <= start + len; b++) {
+        bool shared = false;
+        if (b < start + len) {
+            int refs = atomic_load(&fs->block_extra_refs[b]);
+            while (refs > 0 &&
+                   !atomic_compare_exchange_weak(&fs->block_extra_refs[b],
+                                                 &refs, refs - 1)) {
+            }
+            shared = refs > 0;
+        }
+
+        // queues the run of unshared blocks that ends here (if any)
+        if (shared || b == start + len) {
+            if (b > free_start) {
+                reclaim_defer(fs, free_start, b - free_start);
+            }
+            free_start = b + 1;
+        }
+    }
+}
+
+/**
+ * Free the data blocks of an inode past its first keep blocks. The blocks are
+ * only queued for the reclaimer, so this returns immediately.
+ *
+ * Input:
+ *   - inode: the inode (write-locked by the caller, or not reachable)
+ *   - keep: number of blocks to keep at the start of the file
+ */
+void inode_trim_blocks(tfs_instance_t *fs, inode_t *inode, size_t keep) {
+    int kept_extents = 0;
+    for (int i = 0; i < inode->i_extent_count; i++) {
+        extent_t *extent = &inode->i_extents[i];
+        if (keep >= (size_t)extent->e_len) {
+            keep -= (size_t)extent->e_len;
+            kept_extents++;
+            continue;
+        }
+
+        blocks_release(fs, extent->e_start + (int)keep,
+                       extent->e_len - (int)keep);
+        if (keep > 0) {
+            extent->e_len = (int)keep;
+            kept_extents++;
+            keep = 0;
+        }
     }
+    inode->i_extent_count = kept_extents;
+}
 
-    return inumber;
+/**
+ * Free all data blocks of an inode.
+ *
+ * Input:
+ *   - inode: the inode (write-locked by the caller, or not reachable)
+ */
+void inode_free_blocks(tfs_instance_t *fs, inode_t *inode) {
+    inode_trim_blocks(fs, inode, 0);
 }
 
 /**
- * Delete an inode.
+ * Make an inode share the data blocks (and size) of another one, which is
+ * much cheaper than copying them: each block gains one reference and is only
+ * copied when one of the inodes writes to it.
  *
  * Input:
- *   - inumber: inode's number
+ *   - src: the inode to share the blocks of (locked by the caller)
+ *   - dest: the inode to receive them (without blocks, not reachable)
  */
-void inode_delete(int inumber) {
-    // simulate storage access delay (to inode and freeinode_ts)
-    insert_delay();
-    insert_delay();
+void inode_share_blocks(tfs_instance_t *fs, inode_t const *src, inode_t *dest) {
+    for (int i = 0; i < src->i_extent_count; i++) {
+        extent_t const *extent = &src->i_extents[i];
+        for (int b = extent->e_start; b < extent->e_start + extent->e_len;
+             b++) {
+            atomic_fetch_add(&fs->block_extra_refs[b], 1);
+        }
+        dest->i_extents[i] = *extent;
+    }
+    dest->i_extent_count = src->i_extent_count;
+    dest->i_size = src->i_size;
+}
 
-    ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
+/**
+ * Allocate a run of contiguous blocks.
+ *
+ * Returns the first block of the run, or -1 if there is no such run.
+ */
+static int blocks_alloc_run(tfs_instance_t *fs, size_t len) {
+    if (len == 1) {
+        return data_block_alloc(fs);
+    }
 
-    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
-                  "inode_delete: inode already freed");
+    for (;;) {
+        lock_mutex(&fs->block_allocator.lock);
+        size_t start;
+        size_t seen_size = DATA_BLOCKS;
+        bool found = blocks_best_fit(fs, len, &start) >= len;
+        if (found) {
+            blocks_take_run(fs, start, len);
+        }
+        unlock_mutex(&fs->block_allocator.lock);
 
-    // here it uses the latches to ensure the safety of the changes made
-    // with write locks
-    if (inode_table[inumber].i_size > 0) {
-        write_lock_rwlock(
-            &data_blocks_locks[inode_table[inumber].i_data_block]);
-        data_block_free(inode_table[inumber].i_data_block);
-        unlock_rwlock(&data_blocks_locks[inode_table[inumber].i_data_block]);
+        if (found) {
+            return (int)start;
+        }
+        if (reclaim_process(fs) == 0 &&
+            !allocator_grow(fs, &fs->block_allocator, seen_size)) {
+            return -1;
+        }
     }
-    freeinode_ts[inumber] = FREE;
+}
+
+static inline bool block_shared(tfs_instance_t *fs, int block_number) {
+    return atomic_load(&fs->block_extra_refs[block_number]) > 0;
 }
 
 /**
- * Obtain a pointer to an inode from its inumber.
+ * Give an inode private copies of the shared blocks among blocks first to
+ * last (inclusive) of its file, before writing to them (copy-on-write).
+ *
+ * Each run of shared blocks is copied to a new run, splitting its extent; if
+ * the inode has no extent slots left for that, the whole extent is copied.
  *
  * Input:
- *   - inumber: inode's number
+ *   - inode: the inode (write-locked by the caller)
+ *   - first, last: range of blocks of the file about to be written
  *
- * Returns pointer to inode.
+ * Returns true if successful, false if there was no space for the copies.
  */
-inode_t *inode_get(int inumber) {
-    ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
-
-    insert_delay(); // simulate storage access delay to inode
-    return &inode_table[inumber];
+bool inode_unshare_blocks(tfs_instance_t *fs, inode_t *inode, size_t first,
+                          size_t last) {
+    size_t base = 0; // index in the file of the first block of the extent
+    for (int i = 0; i < inode->i_extent_count && base <= last; i++) {
+        extent_t old = inode->i_extents[i];
+        size_t len = (size_t)old.e_len;
+        size_t from = first > base ? first - base : 0;
+        size_t to = last - base + 1 < len ? last - base + 1 : len;
+
+        for (size_t k = from; k < to; k++) {
+            if (!block_shared(fs, old.e_start + (int)k)) {
+                continue;
+            }
+
+            // the run of shared blocks [k, end) is copied
+            size_t end = k + 1;
+            while (end < to && block_shared(fs, old.e_start + (int)end)) {
+                end++;
+            }
+            int extra = (k > 0) + (end < len);
+            if (inode->i_extent_count + extra > INODE_MAX_EXTENTS) {
+                k = 0;
+                end = len;
+                extra = 0;
+            }
+
+            int start = blocks_alloc_run(fs, end - k);
+            if (start == -1) {
+                return false;
+            }
+            memcpy(data_block_get(fs, start),
+                   data_block_get(fs, old.e_start + (int)k),
+                   (end - k) * BLOCK_SIZE);
+            blocks_release(fs, old.e_start + (int)k, (int)(end - k));
+
+            // splits the extent in (up to) 3: before, copy, after
+            extent_t *extents = inode->i_extents;
+            memmove(&extents[i + 1 + extra], &extents[i + 1],
+                    (size_t)(inode->i_extent_count - i - 1) * sizeof(extent_t));
+            inode->i_extent_count += extra;
+            int j = i;
+            if (k > 0) {
+                extents[j].e_start = old.e_start;
+                extents[j++].e_len = (int)k;
+            }
+            extents[j].e_start = start;
+            extents[j++].e_len = (int)(end - k);
+            if (end < len) {
+                extents[j].e_start = old.e_start + (int)end;
+                extents[j].e_len = (int)(len - end);
+            }
+
+            // the extents changed: check the range again from the start
+            return inode_unshare_blocks(fs, inode, first, last);
+        }
+        base += len;
+    }
+    return true;
 }
 
 /**
@@ -444,39 +2069,40 @@ inode_t *inode_get(int inumber) {
  *   - inode is not a directory inode.
  *   - Directory does not contain an entry for sub_name.
  */
-int clear_dir_entry(inode_t *inode, char const *sub_name) {
+int clear_dir_entry(tfs_instance_t *fs, inode_t *inode, char const *sub_name) {
     insert_delay();
 
     // locks for reading, for the safe use of the if statement
-    read_lock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
     if (inode->i_node_type != T_DIRECTORY) {
         // if not a directory, unlocks the latch
-        unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+        unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
         return -1; // not a directory
     }
-    unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
 
     // Locates the block containing the entries of the directory
 
     // locks for reading, for the safe purposes
-    read_lock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_extents[0].e_start);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "clear_dir_entry: directory must have a data block");
-    unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
     // after its use, then its unlocked
 
     for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        write_lock_rwlock(&dir_entries_locks[i]);
+        write_lock_rwlock(&fs->dir_entries_locks[i]);
         // locks for writing, for safely writing in the directory attributes
         if (!strcmp(dir_entry[i].d_name, sub_name)) {
             dir_entry[i].d_inumber = -1;
             memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
-            unlock_rwlock(&dir_entries_locks[i]); // then its unlocked
+            unlock_rwlock(&fs->dir_entries_locks[i]); // then its unlocked
             return 0;
         }
         // then after its use, its unlocked
-        unlock_rwlock(&dir_entries_locks[i]);
+        unlock_rwlock(&fs->dir_entries_locks[i]);
     }
     return -1; // sub_name not found
 }
@@ -496,7 +2122,8 @@ int clear_dir_entry(inode_t *inode, char const *sub_name) {
  *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
  *   - Directory is already full of entries.
  */
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
+int add_dir_entry(tfs_instance_t *fs, inode_t *inode, char const *sub_name,
+                  int sub_inumber) {
     if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
         return -1; // invalid sub_name
     }
@@ -504,41 +2131,112 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
     insert_delay(); // simulate storage access delay to inode with inumber
 
     // locks for reading, for safe purposes
-    read_lock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
     if (inode->i_node_type != T_DIRECTORY) {
-        unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+        unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
         return -1; // not a directory
     }
-    unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
     // after its use in the if statement its unlocked
 
     // Locates the block containing the entries of the directory
     // but first, locks for reading, for safe purposes
-    read_lock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_extents[0].e_start);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "add_dir_entry: directory must have a data block");
-    unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
     // after its use, its unlocked
 
     // Finds and fills the first empty entry
     for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
         // locks for writing, for safely writing in the directory attributes
-        write_lock_rwlock(&dir_entries_locks[i]);
+        write_lock_rwlock(&fs->dir_entries_locks[i]);
         if (dir_entry[i].d_inumber == -1) {
             dir_entry[i].d_inumber = sub_inumber;
             strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
             dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
-            unlock_rwlock(&dir_entries_locks[i]);
+            unlock_rwlock(&fs->dir_entries_locks[i]);
             // then its unlocked
             return 0;
         }
         // even if doesn't enter the if statement, the lock is unlocked
-        unlock_rwlock(&dir_entries_locks[i]);
+        unlock_rwlock(&fs->dir_entries_locks[i]);
     }
     return -1; // no space for entry
 }
 
+/**
+ * Store several entries in a directory, in a single pass over its block
+ * (instead of one pass per entry, as add_dir_entry). The names are not
+ * checked against the existing ones.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - entries: the entries to add (names must be valid)
+ *   - count: number of entries
+ *
+ * Returns the number of entries added (the first ones), which is lower than
+ * count if the directory is full, or not a directory.
+ */
+size_t add_dir_entries(tfs_instance_t *fs, inode_t *inode,
+                       dir_entry_t const *entries, size_t count) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    if (inode->i_node_type != T_DIRECTORY) {
+        unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+        return 0; // not a directory
+    }
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_extents[0].e_start);
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "add_dir_entries: directory must have a data block");
+
+    // Fills the empty entries in order
+    size_t added = 0;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES && added < count; i++) {
+        write_lock_rwlock(&fs->dir_entries_locks[i]);
+        if (dir_entry[i].d_inumber == -1) {
+            dir_entry[i] = entries[added++];
+            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
+        }
+        unlock_rwlock(&fs->dir_entries_locks[i]);
+    }
+    return added;
+}
+
+/**
+ * Copy the entries of a directory, with a single copy of its block.
+ * The caller must hold the batch lock (see get_dir_batch_lock) for reading,
+ * so that no entry changes meanwhile.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - entries: where to copy the entries to (as many as fit in a block)
+ *
+ * Returns 0 if successful, -1 if inode is not a directory inode.
+ */
+int copy_dir_entries(tfs_instance_t *fs, inode_t const *inode,
+                     dir_entry_t *entries) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    if (inode->i_node_type != T_DIRECTORY) {
+        unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+        return -1; // not a directory
+    }
+    dir_entry_t const *dir_entry =
+        (dir_entry_t const *)data_block_get(fs, inode->i_extents[0].e_start);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "copy_dir_entries: directory must have a data block");
+    memcpy(entries, dir_entry, MAX_DIR_ENTRIES * sizeof(dir_entry_t));
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    return 0;
+}
+
 /**
  * Obtain the inumber for a sub file inside a directory.
  *
@@ -552,23 +2250,26 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
  *   - inode is not a directory inode.
  *   - Directory does not contain a file named sub_name.
  */
-int find_in_dir(inode_t const *inode, char const *sub_name) {
+int find_in_dir(tfs_instance_t *fs, inode_t const *inode,
+                char const *sub_name) {
     ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
     ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
 
     insert_delay(); // simulate storage access delay to inode with inumber
 
     // locks for reading safely
-    read_lock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
     if (inode->i_node_type != T_DIRECTORY) {
         // if not a directory, then it unlocks
-        unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]);
+        unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
         return -1; // not a directory
     }
 
     // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    unlock_rwlock(&inode_table_locks[ROOT_DIR_INUM]); // unlocks after its use
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_extents[0].e_start);
+    // unlocks after its use
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "find_in_dir: directory inode must have a data block");
 
@@ -576,42 +2277,166 @@ int find_in_dir(inode_t const *inode, char const *sub_name) {
     // looking for one that has the target name
     for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
         // locks for reading safely the directory attributes
-        read_lock_rwlock(&dir_entries_locks[i]);
+        read_lock_rwlock(&fs->dir_entries_locks[i]);
         if ((dir_entry[i].d_inumber != -1) &&
             (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            unlock_rwlock(&dir_entries_locks[i]); // unlocks after its use
             int sub_inumber = dir_entry[i].d_inumber;
+            unlock_rwlock(&fs->dir_entries_locks[i]); // unlocks after its use
             return sub_inumber;
         }
-        unlock_rwlock(&dir_entries_locks[i]); // then in the end it unlocks
+        unlock_rwlock(&fs->dir_entries_locks[i]); // then in the end it unlocks
     }
     return -1; // entry not found
 }
 
+/*
+ * Hash of a file name (FNV-1a), for find_in_dir_many
+ */
+static size_t name_hash(char const *name) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < MAX_FILE_NAME && name[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
 /**
- * Allocate a new data block.
+ * Obtain the inumbers for several sub files inside a directory, in a single
+ * pass over its entries (instead of one pass per name, as find_in_dir).
  *
- * Returns block number/index if successful, -1 otherwise.
+ * Input:
+ *   - inode: directory inode
+ *   - sub_names: sub file names (NULL ones are not looked up)
+ *   - count: number of names
+ *   - lookups: where to store the result of each name
+ *
+ * Returns 0 if successful, -1 otherwise.
  *
  * Possible errors:
- *   - No free data blocks.
+ *   - inode is not a directory inode.
+ *   - No memory for the lookup.
  */
-int data_block_alloc(void) {
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        // locks for safely writing
-        write_lock_rwlock(&data_blocks_locks[i]);
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
+int find_in_dir_many(tfs_instance_t *fs, inode_t const *inode,
+                     char const *const *sub_names, size_t count,
+                     dir_lookup_t *lookups) {
+    ALWAYS_ASSERT(inode != NULL, "find_in_dir_many: inode must be non-NULL");
+
+    // hash table of the names (indexes plus one, 0 if empty), with at least
+    // twice as many slots as names
+    size_t table_size = 1;
+    while (table_size < 2 * count) {
+        table_size *= 2;
+    }
+    size_t *table = calloc(table_size, sizeof(size_t));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t j = 0; j < count; j++) {
+        lookups[j].dl_inumber = -1;
+        lookups[j].dl_slot = -1;
+        lookups[j].dl_first = j;
+        if (sub_names[j] == NULL) {
+            continue;
+        }
+        size_t h = name_hash(sub_names[j]) & (table_size - 1);
+        for (; table[h] != 0; h = (h + 1) & (table_size - 1)) {
+            if (strncmp(sub_names[table[h] - 1], sub_names[j],
+                        MAX_FILE_NAME) == 0) {
+                lookups[j].dl_first = table[h] - 1; // repeated name
+                break;
+            }
         }
+        if (table[h] == 0) {
+            table[h] = j + 1;
+        }
+    }
+
+    insert_delay(); // simulate storage access delay to inode with inumber
+
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    if (inode->i_node_type != T_DIRECTORY) {
+        unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+        free(table);
+        return -1; // not a directory
+    }
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_extents[0].e_start);
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "find_in_dir_many: directory inode must have a data block");
 
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
-            unlock_rwlock(&data_blocks_locks[i]); // if free, it unlocks safely
-            return (int)i;
+    // looks up the name of each entry among the requested ones
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        read_lock_rwlock(&fs->dir_entries_locks[i]);
+        if (dir_entry[i].d_inumber != -1) {
+            size_t h = name_hash(dir_entry[i].d_name) & (table_size - 1);
+            for (; table[h] != 0; h = (h + 1) & (table_size - 1)) {
+                dir_lookup_t *lookup = &lookups[table[h] - 1];
+                if (strncmp(sub_names[table[h] - 1], dir_entry[i].d_name,
+                            MAX_FILE_NAME) == 0) {
+                    lookup->dl_inumber = dir_entry[i].d_inumber;
+                    lookup->dl_slot = (int)i;
+                    break;
+                }
+            }
         }
-        unlock_rwlock(&data_blocks_locks[i]); // unlocks after its use
+        unlock_rwlock(&fs->dir_entries_locks[i]);
     }
-    return -1;
+    free(table);
+
+    // repeated names have the result of their first occurrence
+    for (size_t j = 0; j < count; j++) {
+        lookups[j].dl_inumber = lookups[lookups[j].dl_first].dl_inumber;
+        lookups[j].dl_slot = lookups[lookups[j].dl_first].dl_slot;
+    }
+    return 0;
+}
+
+/**
+ * Clear a directory entry found by find_in_dir_many, unless it changed
+ * meanwhile.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - lookup: where the entry was found
+ *   - sub_name: sub file name
+ *
+ * Returns 0 if successful, -1 if the entry no longer holds that file.
+ */
+int clear_dir_entry_at(tfs_instance_t *fs, inode_t *inode,
+                       dir_lookup_t const *lookup, char const *sub_name) {
+    ALWAYS_ASSERT(lookup->dl_slot >= 0 &&
+                      (size_t)lookup->dl_slot < MAX_DIR_ENTRIES,
+                  "clear_dir_entry_at: invalid directory entry");
+
+    read_lock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_extents[0].e_start);
+    unlock_rwlock(&fs->inode_table[ROOT_DIR_INUM].i_lock);
+
+    int result = -1;
+    size_t i = (size_t)lookup->dl_slot;
+    write_lock_rwlock(&fs->dir_entries_locks[i]);
+    if (dir_entry[i].d_inumber == lookup->dl_inumber &&
+        strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0) {
+        dir_entry[i].d_inumber = -1;
+        memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
+        result = 0;
+    }
+    unlock_rwlock(&fs->dir_entries_locks[i]);
+    return result;
+}
+
+/**
+ * Allocate a new data block.
+ *
+ * Returns block number/index if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks.
+ */
+int data_block_alloc(tfs_instance_t *fs) {
+    return allocator_alloc(fs, &fs->block_allocator);
 }
 
 /**
@@ -620,13 +2445,13 @@ int data_block_alloc(void) {
  * Input:
  *   - block_number: the block number/index
  */
-void data_block_free(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
+void data_block_free(tfs_instance_t *fs, int block_number) {
+    ALWAYS_ASSERT(valid_block_number(fs, block_number),
                   "data_block_free: invalid block number");
 
-    insert_delay(); // simulate storage access delay to free_blocks
-
-    free_blocks[block_number] = FREE;
+    // the block goes to the thread's magazine; free_blocks (and its
+    // storage access delay) is only touched when the magazine is drained
+    allocator_free(fs, &fs->block_allocator, block_number);
 }
 
 /**
@@ -637,64 +2462,473 @@ void data_block_free(int block_number) {
  *
  * Returns a pointer to the first byte of the block.
  */
-void *data_block_get(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
+void *data_block_get(tfs_instance_t *fs, int block_number) {
+    ALWAYS_ASSERT(valid_block_number(fs, block_number),
                   "data_block_get: invalid block number");
 
     insert_delay(); // simulate storage access delay to block
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+    return &fs->fs_data[(size_t)block_number * BLOCK_SIZE];
+}
+
+/**
+ * Bring a block into the simulated cache, replacing the oldest one.
+ */
+static void block_cache_fill(tfs_instance_t *fs, int block_number) {
+    lock_mutex(&fs->block_cache_lock);
+    if (!atomic_load(&fs->block_cached[block_number])) {
+        int old = fs->block_cache_slots[fs->block_cache_hand];
+        if (old != -1) {
+            atomic_store(&fs->block_cached[old], false);
+        }
+        fs->block_cache_slots[fs->block_cache_hand] = block_number;
+        fs->block_cache_hand = (fs->block_cache_hand + 1) % BLOCK_CACHE_BLOCKS;
+        atomic_store(&fs->block_cached[block_number], true);
+    }
+    unlock_mutex(&fs->block_cache_lock);
+}
+
+/**
+ * Obtain a pointer to the contents of a run of data blocks, to read them.
+ *
+ * Unlike data_block_get, each block that is not in the (simulated) block
+ * cache pays the storage access delay, and is brought into the cache.
+ *
+ * Input:
+ *   - start: the first block of the run
+ *   - count: number of blocks in the run
+ *
+ * Returns a pointer to the first byte of the run.
+ */
+void *data_blocks_read(tfs_instance_t *fs, int start, size_t count) {
+    ALWAYS_ASSERT(valid_block_number(fs, start) &&
+                      valid_block_number(fs, start + (int)count - 1),
+                  "data_blocks_read: invalid block number");
+
+    for (int b = start; b < start + (int)count; b++) {
+        if (!atomic_load(&fs->block_cached[b])) {
+            insert_delay(); // simulate storage access delay to block
+            block_cache_fill(fs, b);
+        }
+    }
+    return &fs->fs_data[(size_t)start * BLOCK_SIZE];
+}
+
+/**
+ * Ask the prefetcher to bring a run of data blocks into the cache, in the
+ * background. This is only a hint: it is dropped if too many are pending.
+ *
+ * Input:
+ *   - start: the first block of the run
+ *   - count: number of blocks in the run
+ */
+void data_blocks_prefetch(tfs_instance_t *fs, int start, size_t count) {
+    lock_mutex(&fs->prefetch_lock);
+    if (fs->prefetch_count < PREFETCH_QUEUE_SIZE) {
+        extent_t *request =
+            &fs->prefetch_queue[(fs->prefetch_head + fs->prefetch_count) %
+                            PREFETCH_QUEUE_SIZE];
+        request->e_start = start;
+        request->e_len = (int)count;
+        fs->prefetch_count++;
+        if (pthread_cond_signal(&fs->prefetch_cond) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    unlock_mutex(&fs->prefetch_lock);
+}
+
+/**
+ * Check whether a data block is in the simulated block cache.
+ */
+bool data_block_cached(tfs_instance_t *fs, int block_number) {
+    ALWAYS_ASSERT(valid_block_number(fs, block_number),
+                  "data_block_cached: invalid block number");
+    return atomic_load(&fs->block_cached[block_number]);
+}
+
+/*
+ * Background prefetcher: brings the requested blocks into the cache until
+ * the state is destroyed
+ */
+static void *prefetcher_fn(void *arg) {
+    tfs_instance_t *fs = (tfs_instance_t *)arg;
+
+    lock_mutex(&fs->prefetch_lock);
+    while (!fs->prefetch_stopping) {
+        if (fs->prefetch_count == 0) {
+            if (pthread_cond_wait(&fs->prefetch_cond,
+                                  &fs->prefetch_lock) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        extent_t request = fs->prefetch_queue[fs->prefetch_head];
+        fs->prefetch_head = (fs->prefetch_head + 1) % PREFETCH_QUEUE_SIZE;
+        fs->prefetch_count--;
+        unlock_mutex(&fs->prefetch_lock);
+
+        // the blocks may have been freed (or reused) meanwhile, which only
+        // means that other blocks are cached
+        for (int b = request.e_start; b < request.e_start + request.e_len;
+             b++) {
+            if (!atomic_load(&fs->block_cached[b])) {
+                insert_delay(); // simulate storage access delay to block
+                block_cache_fill(fs, b);
+            }
+        }
+        lock_mutex(&fs->prefetch_lock);
+    }
+    unlock_mutex(&fs->prefetch_lock);
+    return NULL;
+}
+
+/**
+ * Compute free space fragmentation metrics of the data blocks. Blocks cached
+ * in thread magazines are not counted as free.
+ *
+ * Input:
+ *   - free_count: where to store the number of free blocks
+ *   - free_runs: where to store the number of runs of free blocks
+ *   - largest_free_run: where to store the length of the largest run
+ */
+void data_blocks_fragmentation(tfs_instance_t *fs, size_t *free_count,
+                               size_t *free_runs, size_t *largest_free_run) {
+    *free_count = 0;
+    *free_runs = 0;
+    *largest_free_run = 0;
+
+    lock_mutex(&fs->block_allocator.lock);
+    size_t run = 0;
+    for (size_t i = 0; i <= DATA_BLOCKS; i++) {
+        if (i < DATA_BLOCKS && fs->free_blocks[i] == FREE) {
+            (*free_count)++;
+            run++;
+            continue;
+        }
+        if (run > 0) {
+            (*free_runs)++;
+            if (run > *largest_free_run) {
+                *largest_free_run = run;
+            }
+        }
+        run = 0;
+    }
+    unlock_mutex(&fs->block_allocator.lock);
+}
+
+/**
+ * Obtain the number of freed data blocks not yet returned to the map by the
+ * reclaimer.
+ */
+size_t data_blocks_reclaim_backlog(tfs_instance_t *fs) {
+    return atomic_load(&fs->reclaim_backlog);
+}
+
+/**
+ * Obtain the usage of the inode table and data blocks, from the counters
+ * kept by the allocators (without scanning the allocation maps).
+ *
+ * Input:
+ *   - stat: where to store the usage
+ */
+void state_statfs(tfs_instance_t *fs, tfs_statfs_t *stat) {
+    stat->f_block_size = BLOCK_SIZE;
+    stat->f_blocks = MAX_DATA_BLOCKS;
+    stat->f_blocks_free =
+        MAX_DATA_BLOCKS - atomic_load(&fs->block_allocator.in_use);
+    stat->f_blocks_reclaiming = atomic_load(&fs->reclaim_backlog);
+    stat->f_inodes = MAX_INODES;
+    stat->f_inodes_free = MAX_INODES - atomic_load(&fs->inode_allocator.in_use);
+}
+
+/*
+ * Returns the latency histogram bucket of value (in ns), HDR style: values
+ * below OP_STATS_SUB_BUCKETS have a bucket each, and the others are bucketed
+ * by their most significant bit and the OP_STATS_SUB_BITS bits after it
+ */
+static size_t op_stats_bucket(uint64_t value) {
+    if (value < OP_STATS_SUB_BUCKETS) {
+        return (size_t)value;
+    }
+    unsigned msb = 63u - (unsigned)__builtin_clzll(value);
+    unsigned shift = msb - OP_STATS_SUB_BITS;
+    return (shift + 1) * OP_STATS_SUB_BUCKETS +
+           (size_t)((value >> shift) & (OP_STATS_SUB_BUCKETS - 1));
+}
+
+/*
+ * Returns the largest value (in ns) that falls in the given bucket
+ */
+static uint64_t op_stats_bucket_max(size_t bucket) {
+    if (bucket < OP_STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t shift = bucket / OP_STATS_SUB_BUCKETS - 1;
+    uint64_t first = (uint64_t)(OP_STATS_SUB_BUCKETS +
+                                bucket % OP_STATS_SUB_BUCKETS)
+                     << shift;
+    return first + ((uint64_t)1 << shift) - 1;
+}
+
+/*
+ * Adds value to a counter only updated by the calling thread (a plain load
+ * and store, rather than an atomic read-modify-write)
+ */
+static void op_stats_add(atomic_ulong *counter, uint64_t value) {
+    atomic_store_explicit(
+        counter,
+        atomic_load_explicit(counter, memory_order_relaxed) +
+            (unsigned long)value,
+        memory_order_relaxed);
+}
+
+/*
+ * Adds the statistics of a thread that exits to those of the threads that
+ * exited before
+ */
+static void op_stats_release(void *arg) {
+    thread_op_stats_t *stats = (thread_op_stats_t *)arg;
+    tfs_instance_t *fs = stats->fs;
+
+    lock_mutex(&fs->op_stats_lock);
+    for (thread_op_stats_t **s = &fs->op_stats_list; *s != NULL;
+         s = &(*s)->next) {
+        if (*s == stats) {
+            *s = stats->next;
+            break;
+        }
+    }
+    for (size_t op = 0; op < TFS_STATS_OP_COUNT; op++) {
+        op_stats_t *from = &stats->ops[op];
+        op_stats_t *to = &fs->op_stats_exited[op];
+        atomic_fetch_add(&to->ops, atomic_load(&from->ops));
+        atomic_fetch_add(&to->errors, atomic_load(&from->errors));
+        atomic_fetch_add(&to->bytes, atomic_load(&from->bytes));
+        if (atomic_load(&from->max_ns) > atomic_load(&to->max_ns)) {
+            atomic_store(&to->max_ns, atomic_load(&from->max_ns));
+        }
+        for (size_t b = 0; b < OP_STATS_BUCKETS; b++) {
+            atomic_fetch_add(&to->histogram[b],
+                             atomic_load(&from->histogram[b]));
+        }
+    }
+    unlock_mutex(&fs->op_stats_lock);
+
+    free(stats);
+}
+
+/*
+ * Returns the calling thread's statistics, creating (and registering) them on
+ * first use
+ */
+static thread_op_stats_t *thread_op_stats(tfs_instance_t *fs) {
+    thread_op_stats_t *stats = pthread_getspecific(fs->op_stats_key);
+    if (stats == NULL) {
+        stats = calloc(1, sizeof(thread_op_stats_t));
+        ALWAYS_ASSERT(stats != NULL,
+                      "thread_op_stats: failed to allocate statistics");
+        stats->fs = fs;
+        if (pthread_setspecific(fs->op_stats_key, stats) != 0) {
+            exit(EXIT_FAILURE);
+        }
+
+        lock_mutex(&fs->op_stats_lock);
+        stats->next = fs->op_stats_list;
+        fs->op_stats_list = stats;
+        unlock_mutex(&fs->op_stats_lock);
+    }
+    return stats;
+}
+
+/**
+ * Start measuring an operation (see op_stats_end). Only one in every
+ * OP_STATS_SAMPLE_PERIOD calls of each operation by each thread is timed
+ * (starting with the first), as the clock reads cost more than the rest of
+ * the statistics.
+ *
+ * Input:
+ *   - op: the operation
+ *
+ * Returns the time the operation starts at, or 0 if it is not timed.
+ */
+uint64_t op_stats_begin(tfs_instance_t *fs, tfs_stats_op_t op) {
+    if (!fs->fs_params.op_stats) {
+        return 0;
+    }
+    op_stats_t *stats = &thread_op_stats(fs)->ops[op];
+    if (stats->until_sample > 0) {
+        stats->until_sample--;
+        return 0;
+    }
+    stats->until_sample = OP_STATS_SAMPLE_PERIOD - 1;
+    return monotonic_ns();
+}
+
+/**
+ * Record an operation in the statistics of the calling thread.
+ *
+ * Input:
+ *   - op: the operation
+ *   - start: what op_stats_begin returned when the operation started
+ *   - result: what the operation returned (-1 on errors; the bytes read or
+ *     written for TFS_STATS_READ and TFS_STATS_WRITE)
+ */
+void op_stats_end(tfs_instance_t *fs, tfs_stats_op_t op, uint64_t start,
+                  ssize_t result) {
+    if (!fs->fs_params.op_stats) {
+        return;
+    }
+    uint64_t latency = start != 0 ? monotonic_ns() - start : 0;
+
+    op_stats_t *stats = &thread_op_stats(fs)->ops[op];
+    op_stats_add(&stats->ops, 1);
+    if (result == -1) {
+        op_stats_add(&stats->errors, 1);
+    } else if (op == TFS_STATS_READ || op == TFS_STATS_WRITE) {
+        op_stats_add(&stats->bytes, (uint64_t)result);
+    }
+    if (start != 0) {
+        if (latency >
+            atomic_load_explicit(&stats->max_ns, memory_order_relaxed)) {
+            atomic_store_explicit(&stats->max_ns, latency,
+                                  memory_order_relaxed);
+        }
+        op_stats_add(&stats->histogram[op_stats_bucket(latency)], 1);
+    }
+}
+
+/*
+ * Adds the statistics of an operation of a thread to total, and its latency
+ * histogram to histogram
+ */
+static void op_stats_sum(tfs_op_stats_t *total, unsigned long *histogram,
+                         op_stats_t *stats) {
+    total->s_ops += atomic_load(&stats->ops);
+    total->s_errors += atomic_load(&stats->errors);
+    total->s_bytes += atomic_load(&stats->bytes);
+    if (atomic_load(&stats->max_ns) > total->s_max_ns) {
+        total->s_max_ns = atomic_load(&stats->max_ns);
+    }
+    for (size_t b = 0; b < OP_STATS_BUCKETS; b++) {
+        histogram[b] += atomic_load(&stats->histogram[b]);
+    }
+}
+
+/*
+ * Returns the value (in ns) that permille/1000 of the values of a histogram
+ * do not exceed (at most max)
+ */
+static uint64_t op_stats_percentile(unsigned long const *histogram,
+                                    uint64_t max, unsigned long permille) {
+    unsigned long count = 0;
+    for (size_t b = 0; b < OP_STATS_BUCKETS; b++) {
+        count += histogram[b];
+    }
+    unsigned long rank = (count * permille + 999) / 1000;
+
+    unsigned long seen = 0;
+    for (size_t b = 0; b < OP_STATS_BUCKETS; b++) {
+        seen += histogram[b];
+        if (seen >= rank && seen > 0) {
+            uint64_t value = op_stats_bucket_max(b);
+            return value < max ? value : max;
+        }
+    }
+    return 0; // empty histogram
+}
+
+/**
+ * Obtain the statistics of each measured operation, adding up those of every
+ * thread (the ones running and the ones that exited).
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ */
+void state_get_stats(tfs_instance_t *fs, tfs_stats_t *stats) {
+    memset(stats, 0, sizeof(tfs_stats_t));
+    unsigned long histogram[OP_STATS_BUCKETS];
+
+    lock_mutex(&fs->op_stats_lock);
+    for (size_t op = 0; op < TFS_STATS_OP_COUNT; op++) {
+        tfs_op_stats_t *total = &stats->st_ops[op];
+        memset(histogram, 0, sizeof(histogram));
+
+        op_stats_sum(total, histogram, &fs->op_stats_exited[op]);
+        for (thread_op_stats_t *s = fs->op_stats_list; s != NULL;
+             s = s->next) {
+            op_stats_sum(total, histogram, &s->ops[op]);
+        }
+
+        total->s_p50_ns = op_stats_percentile(histogram, total->s_max_ns, 500);
+        total->s_p99_ns = op_stats_percentile(histogram, total->s_max_ns, 990);
+        total->s_p999_ns =
+            op_stats_percentile(histogram, total->s_max_ns, 999);
+    }
+    unlock_mutex(&fs->op_stats_lock);
 }
 
 /**
  * Add a new entry to the open file table.
  *
+ * The entry is taken from the calling thread's magazine of file handles
+ * (see allocator_alloc), so that opening files from many threads does not
+ * serialize on the table.
+ *
  * Input:
  *   - inumber: inode number of the file to open
  *   - offset: initial offset
+ *   - wbuf: write buffer of the handle (NULL if not buffered), which the
+ *     entry owns once it is added
  *
  * Returns file handle if successful, -1 otherwise.
  *
  * Possible errors:
  *   - No space in open file table for a new open file.
  */
-int add_to_open_file_table(int inumber, size_t offset) {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        // locks for writing safely in the open file table
-        write_lock_rwlock(&open_file_table_locks[i]);
-        if (free_open_file_entries[i] == FREE) {
-            lock_mutex(&open_files_mutex); // locks mutex for even more security
-            free_open_file_entries[i] = TAKEN;
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            unlock_rwlock(&open_file_table_locks[i]); // then its unlocked
-            unlock_mutex(&open_files_mutex);          // then its unlocked
-            return i;
-        }
-        unlock_rwlock(&open_file_table_locks[i]);
+int add_to_open_file_table(tfs_instance_t *fs, int inumber, size_t offset,
+                           char *wbuf) {
+    int fhandle = allocator_alloc(fs, &fs->open_file_allocator);
+    if (fhandle == -1) {
+        return -1;
     }
 
-    return -1;
+    open_file_entry_t *file = &fs->open_file_table[fhandle];
+    write_lock_rwlock(&fs->open_file_table_locks[fhandle]);
+    file->of_inumber = inumber;
+    file->of_offset = offset;
+    file->of_ra_next = offset / BLOCK_SIZE;
+    file->of_ra_end = 0;
+    file->of_ra_window = 0;
+    file->of_wbuf = wbuf;
+    file->of_wbuf_len = 0;
+    atomic_store(&file->of_buffered, wbuf != NULL);
+    atomic_store(&file->of_open, true);
+    unlock_rwlock(&fs->open_file_table_locks[fhandle]);
+    return fhandle;
 }
 
 /**
- * Free an entry from the open file table.
+ * Free an entry from the open file table (into the calling thread's magazine
+ * of file handles), along with its write buffer.
+ * The caller must hold the lock of the handle for writing (so that no other
+ * operation is using the buffer), and have checked that it is open.
  *
  * Input:
  *   - fhandle: file handle to free/close
  */
-void remove_from_open_file_table(int fhandle) {
-    read_lock_rwlock(&open_file_table_locks[fhandle]);
-    // locks for safe reading
-    ALWAYS_ASSERT(valid_file_handle(fhandle),
+void remove_from_open_file_table(tfs_instance_t *fs, int fhandle) {
+    ALWAYS_ASSERT(valid_file_handle(fs, fhandle),
                   "remove_from_open_file_table: file handle must be valid");
-    lock_mutex(
-        &open_files_mutex); // also locks the mutex for even more security
-    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
-                  "remove_from_open_file_table: file handle must be taken");
-
-    free_open_file_entries[fhandle] = FREE;
-    unlock_mutex(&open_files_mutex);                // then after its use,
-    unlock_rwlock(&open_file_table_locks[fhandle]); // both latches are unlocked
+    open_file_entry_t *file = &fs->open_file_table[fhandle];
+    ALWAYS_ASSERT(atomic_load(&file->of_open),
+                  "remove_from_open_file_table: file handle must be open");
+    free(file->of_wbuf);
+    file->of_wbuf = NULL;
+    file->of_wbuf_len = 0;
+    atomic_store(&file->of_buffered, false);
+    atomic_store(&file->of_open, false);
+
+    allocator_free(fs, &fs->open_file_allocator, fhandle);
 }
 
 /**
@@ -704,16 +2938,17 @@ void remove_from_open_file_table(int fhandle) {
  *   - fhandle: file handle
  *
  * Returns pointer to the entry, or NULL if the fhandle is invalid/closed/never
- * opened.
+ * opened. The handle may still be closed by another thread until its lock is
+ * taken, so callers check of_open again once they hold it.
  */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
+open_file_entry_t *get_open_file_entry(tfs_instance_t *fs, int fhandle) {
+    if (!valid_file_handle(fs, fhandle)) {
         return NULL;
     }
 
-    if (free_open_file_entries[fhandle] != TAKEN) {
+    if (!atomic_load(&fs->open_file_table[fhandle].of_open)) {
         return NULL;
     }
 
-    return &open_file_table[fhandle];
+    return &fs->open_file_table[fhandle];
 }
@@ -5,7 +5,9 @@
 #include "operations.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -22,34 +24,136 @@ typedef enum { T_FILE, T_DIRECTORY, T_SYMLINK } inode_type;
 // adicionado um tipo de inode para symlink
 
 /**
- * Inode
+ * Extent (run of contiguous data blocks)
  */
 typedef struct {
-    inode_type i_node_type;
+    int e_start; // first block number
+    int e_len;   // number of blocks
+} extent_t;
 
+/**
+ * Inode
+ *
+ * Only the fields touched by every lookup/open/read/write live here, and each
+ * inode is aligned to a cache line, so that neighbouring inodes never share
+ * lines. The lock comes first and the size (checked by every read and write
+ * once the lock is taken) fills the rest of the first line; the second line
+ * holds the other scalars and the extent map. Rarely used fields (the
+ * symlink target) are kept in a separate table, see inode_symlink_target().
+ */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_rwlock_t i_lock;
     size_t i_size;
-    int i_data_block;
+    inode_type i_node_type;
     int i_hardlink_counter;
-    char i_symlink_target[MAX_FILE_NAME];
+    int i_extent_count;
+    extent_t i_extents[INODE_MAX_EXTENTS]; // data blocks, in file order
     // in a more complete FS, more fields could exist here
 } inode_t;
 
+_Static_assert(offsetof(inode_t, i_size) + sizeof(size_t) <= CACHE_LINE_SIZE,
+               "inode_t: the lock and the size must share the first line");
+_Static_assert(sizeof(inode_t) == 2 * CACHE_LINE_SIZE,
+               "inode_t: an inode must take two cache lines");
+
 typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
 
+// what the caller of inode_unpin must do next
+typedef enum { UNPIN_DONE, UNPIN_TRIM, UNPIN_DELETE } unpin_result_t;
+
+/**
+ * Result of looking up a name in a directory (see find_in_dir_many)
+ */
+typedef struct {
+    int dl_inumber;  // -1 if not found
+    int dl_slot;     // index of the directory entry, -1 if not found
+    size_t dl_first; // index of the first name equal to this one
+} dir_lookup_t;
+
 /**
  * Open file entry (in open file table)
  */
 typedef struct {
     int of_inumber;
     size_t of_offset;
+    // readahead (see tfs_read)
+    size_t of_ra_next;   // file block where the next sequential read starts
+    size_t of_ra_end;    // first file block past those already prefetched
+    size_t of_ra_window; // blocks to keep prefetched, 0 if not sequential
+    // write buffer (only if opened with TFS_O_BUFFERED, see tfs_write)
+    char *of_wbuf;
+    size_t of_wbuf_len; // bytes buffered, to be written at of_offset
+    // of_wbuf != NULL, for the checks made before the handle is locked
+    atomic_bool of_buffered;
+    // handed out by add_to_open_file_table (and not closed); entries that
+    // are free may still be cached in the magazine of some thread. Read
+    // without the lock to reject closed handles early, it is checked again
+    // once the lock of the handle is taken
+    atomic_bool of_open;
 } open_file_entry_t;
 
-pthread_rwlock_t *get_inode_table_lock(int inumber);
-pthread_rwlock_t *get_open_file_table_lock(int file_handle);
-
+/**
+ * Volume lock (see volume_enter in operations.c)
+ */
+typedef struct {
+    pthread_rwlock_t vl_lock;
+    pthread_mutex_t vl_gate;
+    atomic_bool vl_freeze_pending;
+} volume_lock_t;
+
+pthread_rwlock_t *get_inode_table_lock(tfs_instance_t *fs, int inumber);
+pthread_rwlock_t *get_open_file_table_lock(tfs_instance_t *fs,
+                                           int file_handle);
+pthread_rwlock_t *get_dir_batch_lock(tfs_instance_t *fs);
+volume_lock_t *get_volume_lock(tfs_instance_t *fs);
+
+#ifdef LOCK_PROFILE
+/**
+ * Lock profiler call site: a place in the code that takes a lock, with the
+ * statistics of the acquisitions made there (see lock_profile_report)
+ */
+typedef struct lock_site {
+    char const *ls_file;
+    int ls_line;
+    char const *ls_func;
+    char const *ls_mode; // "mutex", "read" or "write"
+    atomic_bool ls_listed;
+    struct lock_site *ls_next; // in the list of sites taken so far
+    atomic_ulong ls_acquisitions;
+    atomic_ulong ls_contended; // acquisitions that had to wait
+    atomic_ulong ls_wait_ns;
+    atomic_ulong ls_wait_max_ns;
+    atomic_ulong ls_hold_ns;
+    atomic_ulong ls_hold_max_ns;
+    // contended acquisitions by wait time (see lock_profile_bucket)
+    atomic_ulong ls_wait_histogram[LOCK_PROFILE_BUCKETS];
+} lock_site_t;
+
+void lock_mutex_at(pthread_mutex_t *mutex, lock_site_t *site);
+void read_lock_rwlock_at(pthread_rwlock_t *rwlock, lock_site_t *site);
+void write_lock_rwlock_at(pthread_rwlock_t *rwlock, lock_site_t *site);
+void lock_profile_report(FILE *out);
+
+// each call of the lock wrappers gets a site of its own
+#define LOCK_AT(function, lock, mode)                                          \
+    do {                                                                       \
+        static lock_site_t lock_site_ = {                                      \
+            .ls_file = __FILE__,                                               \
+            .ls_line = __LINE__,                                               \
+            .ls_func = __func__,                                               \
+            .ls_mode = mode,                                                   \
+        };                                                                     \
+        function(lock, &lock_site_);                                           \
+    } while (0)
+#define lock_mutex(mutex) LOCK_AT(lock_mutex_at, mutex, "mutex")
+#define read_lock_rwlock(rwlock) LOCK_AT(read_lock_rwlock_at, rwlock, "read")
+#define write_lock_rwlock(rwlock)                                              \
+    LOCK_AT(write_lock_rwlock_at, rwlock, "write")
+#else
 void lock_mutex(pthread_mutex_t *mutex);
 void read_lock_rwlock(pthread_rwlock_t *rwlock);
 void write_lock_rwlock(pthread_rwlock_t *rwlock);
+#endif
 void unlock_mutex(pthread_mutex_t *mutex);
 void unlock_rwlock(pthread_rwlock_t *rwlock);
 void init_mutex(pthread_mutex_t *mutex);
@@ -57,33 +161,65 @@ void init_rwlock(pthread_rwlock_t *rwlock);
 void destroy_mutex(pthread_mutex_t *mutex);
 void destroy_rwlock(pthread_rwlock_t *rwlock);
 
-int state_init(tfs_params);
-int state_destroy(void);
-
-size_t state_block_size(void);
-
-int inode_create(inode_type n_type);
-void inode_delete(int inumber);
-inode_t *inode_get(int inumber);
-
-int clear_dir_entry(inode_t *inode, char const *sub_name);
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
-int find_in_dir(inode_t const *inode, char const *sub_name);
-
-int data_block_alloc(void);
-void data_block_free(int block_number);
-void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-void remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
-
-/* Stores the number of currently open files */
-extern int open_files_count;
-
-/* Condition variable and mutex */
-extern pthread_cond_t open_files_cond;
-extern pthread_mutex_t open_files_mutex;
-extern pthread_mutex_t open_file_lock;
+tfs_instance_t *state_init(tfs_params);
+int state_destroy(tfs_instance_t *fs);
+
+size_t state_block_size(tfs_instance_t *fs);
+size_t state_readahead_blocks(tfs_instance_t *fs);
+
+int inode_create(tfs_instance_t *fs, inode_type n_type);
+size_t inodes_create(tfs_instance_t *fs, inode_type i_type, int *inumbers,
+                     size_t count);
+void inode_delete(tfs_instance_t *fs, int inumber);
+bool inode_pin(tfs_instance_t *fs, int inumber);
+unpin_result_t inode_unpin(tfs_instance_t *fs, int inumber);
+void inode_mark_preallocated(tfs_instance_t *fs, int inumber);
+bool inode_unlink(tfs_instance_t *fs, int inumber);
+inode_t *inode_get(tfs_instance_t *fs, int inumber);
+char *inode_symlink_target(tfs_instance_t *fs, int inumber);
+size_t inode_block_count(inode_t const *inode);
+int inode_block_run(inode_t const *inode, size_t file_block, size_t *run);
+size_t inode_alloc_blocks(tfs_instance_t *fs, inode_t *inode, size_t count);
+void inode_trim_blocks(tfs_instance_t *fs, inode_t *inode, size_t keep);
+void inode_free_blocks(tfs_instance_t *fs, inode_t *inode);
+void inode_share_blocks(tfs_instance_t *fs, inode_t const *src,
+                        inode_t *dest);
+bool inode_unshare_blocks(tfs_instance_t *fs, inode_t *inode, size_t first,
+                          size_t last);
+
+int clear_dir_entry(tfs_instance_t *fs, inode_t *inode, char const *sub_name);
+int add_dir_entry(tfs_instance_t *fs, inode_t *inode, char const *sub_name,
+                  int sub_inumber);
+size_t add_dir_entries(tfs_instance_t *fs, inode_t *inode,
+                       dir_entry_t const *entries, size_t count);
+int copy_dir_entries(tfs_instance_t *fs, inode_t const *inode,
+                     dir_entry_t *entries);
+int find_in_dir(tfs_instance_t *fs, inode_t const *inode,
+                char const *sub_name);
+int find_in_dir_many(tfs_instance_t *fs, inode_t const *inode,
+                     char const *const *sub_names, size_t count,
+                     dir_lookup_t *lookups);
+int clear_dir_entry_at(tfs_instance_t *fs, inode_t *inode,
+                       dir_lookup_t const *lookup, char const *sub_name);
+
+int data_block_alloc(tfs_instance_t *fs);
+void data_block_free(tfs_instance_t *fs, int block_number);
+void *data_block_get(tfs_instance_t *fs, int block_number);
+void *data_blocks_read(tfs_instance_t *fs, int start, size_t count);
+void data_blocks_prefetch(tfs_instance_t *fs, int start, size_t count);
+bool data_block_cached(tfs_instance_t *fs, int block_number);
+void data_blocks_fragmentation(tfs_instance_t *fs, size_t *free_count,
+                               size_t *free_runs, size_t *largest_free_run);
+size_t data_blocks_reclaim_backlog(tfs_instance_t *fs);
+void state_statfs(tfs_instance_t *fs, tfs_statfs_t *stat);
+uint64_t op_stats_begin(tfs_instance_t *fs, tfs_stats_op_t op);
+void op_stats_end(tfs_instance_t *fs, tfs_stats_op_t op, uint64_t start,
+                  ssize_t result);
+void state_get_stats(tfs_instance_t *fs, tfs_stats_t *stats);
+
+int add_to_open_file_table(tfs_instance_t *fs, int inumber, size_t offset,
+                           char *wbuf);
+void remove_from_open_file_table(tfs_instance_t *fs, int fhandle);
+open_file_entry_t *get_open_file_entry(tfs_instance_t *fs, int fhandle);
 
 #endif // STATE_H
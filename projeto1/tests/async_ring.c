@@ -0,0 +1,130 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 8
+#define ENTRIES 4
+#define WORKER_COUNT 3
+
+/* This test opens, writes, reads back and closes several files through an
+ * asynchronous ring with fewer entries than files, keeping the ring full,
+ * and checks the results of the completions (including failed requests). */
+
+static char const *const names[FILE_COUNT] = {"/f0", "/f1", "/f2", "/f3",
+                                              "/f4", "/f5", "/f6", "/f7"};
+static int handles[FILE_COUNT];
+static char contents[FILE_COUNT][16];
+static char read_back[FILE_COUNT][16];
+
+static tfs_request_t requests[FILE_COUNT];
+static ssize_t results[FILE_COUNT]; // the user data of each request
+
+/**
+ * Submit the requests (one per file), keeping at most ENTRIES in flight, and
+ * store their results.
+ */
+static void run_all(tfs_ring_t *ring) {
+    size_t submitted = 0;
+    size_t reaped = 0;
+    while (reaped < FILE_COUNT) {
+        submitted += tfs_ring_submit(ring, &requests[submitted],
+                                     FILE_COUNT - submitted);
+        assert(submitted - reaped <= ENTRIES);
+
+        tfs_completion_t completions[ENTRIES];
+        size_t n = tfs_ring_reap(ring, completions, ENTRIES, 1);
+        assert(n >= 1);
+        for (size_t i = 0; i < n; i++) {
+            ssize_t *result = completions[i].user_data;
+            assert(result >= results && result < results + FILE_COUNT);
+            *result = completions[i].result;
+        }
+        reaped += n;
+    }
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    tfs_ring_t *ring = tfs_ring_create(ENTRIES, WORKER_COUNT);
+    assert(ring != NULL);
+
+    // open
+    for (int i = 0; i < FILE_COUNT; i++) {
+        requests[i] = (tfs_request_t){.op = TFS_OP_OPEN,
+                                      .name = names[i],
+                                      .mode = TFS_O_CREAT,
+                                      .user_data = &results[i]};
+    }
+    run_all(ring);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(results[i] != -1);
+        handles[i] = (int)results[i];
+        for (int j = 0; j < i; j++) {
+            assert(handles[j] != handles[i]);
+        }
+    }
+
+    // write
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(contents[i], sizeof(contents[i]), "contents of %d", i);
+        requests[i] = (tfs_request_t){.op = TFS_OP_WRITE,
+                                      .fhandle = handles[i],
+                                      .buffer = contents[i],
+                                      .len = strlen(contents[i]),
+                                      .user_data = &results[i]};
+    }
+    run_all(ring);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(results[i] == strlen(contents[i]));
+    }
+
+    // close, and reopen to read from the start
+    for (int i = 0; i < FILE_COUNT; i++) {
+        requests[i] = (tfs_request_t){.op = TFS_OP_CLOSE,
+                                      .fhandle = handles[i],
+                                      .user_data = &results[i]};
+    }
+    run_all(ring);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(results[i] == 0);
+        handles[i] = tfs_open(names[i], 0);
+        assert(handles[i] != -1);
+    }
+
+    // read
+    for (int i = 0; i < FILE_COUNT; i++) {
+        requests[i] = (tfs_request_t){.op = TFS_OP_READ,
+                                      .fhandle = handles[i],
+                                      .buffer = read_back[i],
+                                      .len = sizeof(read_back[i]),
+                                      .user_data = &results[i]};
+    }
+    run_all(ring);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(results[i] == strlen(contents[i]));
+        assert(memcmp(read_back[i], contents[i], strlen(contents[i])) == 0);
+        assert(tfs_close(handles[i]) != -1);
+    }
+
+    // failed requests complete with -1
+    requests[0] = (tfs_request_t){.op = TFS_OP_READ,
+                                  .fhandle = handles[0], // closed
+                                  .buffer = read_back[0],
+                                  .len = sizeof(read_back[0])};
+    requests[1] = (tfs_request_t){.op = TFS_OP_OPEN, .name = "/missing"};
+    assert(tfs_ring_submit(ring, requests, 2) == 2);
+    tfs_completion_t completions[2];
+    assert(tfs_ring_reap(ring, completions, 2, 2) == 2);
+    assert(completions[0].result == -1 && completions[1].result == -1);
+
+    // nothing in flight: reaping does not wait
+    assert(tfs_ring_reap(ring, completions, 2, 2) == 0);
+
+    tfs_ring_destroy(ring);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+    return 0;
+}
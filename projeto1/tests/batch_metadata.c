@@ -0,0 +1,128 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 512 // 11 directory entries
+#define RACE_COUNT 4
+#define ROUNDS 50
+
+/* This test creates, stats and deletes files in batches, including invalid
+ * and repeated names, names that already exist, links, and a batch that does
+ * not fit in the directory. It also checks that names created at the same
+ * time in a batch and one by one are only added once. */
+
+static char const *const race[RACE_COUNT] = {"/r0", "/r1", "/r2", "/r3"};
+
+static void *create_batch(void *arg) {
+    (void)arg;
+    int results[RACE_COUNT];
+    assert(tfs_create_many(race, RACE_COUNT, results) == 0);
+    return NULL;
+}
+
+static void *create_each(void *arg) {
+    (void)arg;
+    for (int i = RACE_COUNT; i-- > 0;) {
+        int f = tfs_open(race[i], TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    // an existing file is left untouched
+    int f = tfs_open("/x", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "hello", 5) == 5);
+    assert(tfs_close(f) != -1);
+
+    char const *names[] = {"/a", "/b", "/a", "bad", "/x", "/c"};
+    int results[6];
+    assert(tfs_create_many(names, 6, results) == -1);
+    int expected[] = {0, 0, 0, -1, 0, 0};
+    assert(memcmp(results, expected, sizeof(expected)) == 0);
+
+    // 5 entries used: x, a, b, c and now a hard link and a symbolic link
+    assert(tfs_link("/a", "/a2") != -1);
+    assert(tfs_sym_link("/x", "/l") != -1);
+
+    tfs_stat_t stats[6];
+    char const *stat_names[] = {"/a", "/x", "/l", "/missing", "/c", "/a2"};
+    assert(tfs_stat_many(stat_names, 6, stats) == -1);
+    assert(stats[0].st_type == TFS_T_FILE && stats[0].st_size == 0 &&
+           stats[0].st_nlink == 2);
+    assert(stats[1].st_type == TFS_T_FILE && stats[1].st_size == 5 &&
+           stats[1].st_blocks == 1 && stats[1].st_nlink == 1);
+    assert(stats[2].st_type == TFS_T_SYMLINK);
+    assert(stats[3].st_inumber == -1);
+    assert(stats[4].st_inumber != -1 &&
+           stats[4].st_inumber != stats[0].st_inumber);
+    assert(stats[5].st_inumber == stats[0].st_inumber);
+    assert(tfs_lookup("/a") == stats[0].st_inumber);
+
+    // 6 entries used, so only 5 of these fit
+    char const *more[] = {"/m0", "/m1", "/m2", "/m3", "/m4", "/m5", "/m6"};
+    int more_results[7];
+    assert(tfs_create_many(more, 7, more_results) == -1);
+    int fitted = 0;
+    for (int i = 0; i < 7; i++) {
+        fitted += more_results[i] == 0;
+    }
+    assert(fitted == 5);
+    assert(more_results[5] == -1 && more_results[6] == -1);
+    assert(tfs_lookup("/m5") == -1 && tfs_lookup("/m6") == -1);
+
+    // a repeated name is only deleted once; a hard link keeps its file
+    char const *gone[] = {"/a", "/a", "/l", "/m0", "/m1", "/m2",
+                          "/m3", "/m4", "/nope"};
+    int gone_results[9];
+    assert(tfs_unlink_many(gone, 9, gone_results) == -1);
+    int gone_expected[] = {0, -1, 0, 0, 0, 0, 0, 0, -1};
+    assert(memcmp(gone_results, gone_expected, sizeof(gone_expected)) == 0);
+    assert(tfs_lookup("/a") == -1 && tfs_lookup("/l") == -1);
+    assert(tfs_stat_many(&stat_names[5], 1, stats) == 0);
+    assert(stats[0].st_nlink == 1);
+
+    // the freed entries (and the inodes of the files that did not fit) can
+    // be used again
+    assert(tfs_create_many(more, 7, more_results) == 0);
+    assert(tfs_create_many(more, 0, more_results) == 0);
+    assert(tfs_unlink_many(more, 7, more_results) == 0);
+
+    // a symbolic link is deleted alike by tfs_unlink and tfs_unlink_many
+    assert(tfs_sym_link("/x", "/l") != -1);
+    assert(tfs_unlink("/l") == 0);
+    assert(tfs_lookup("/l") == -1);
+
+    // names created in a batch and one by one at the same time
+    for (int r = 0; r < ROUNDS; r++) {
+        pthread_t threads[2];
+        assert(pthread_create(&threads[0], NULL, create_batch, NULL) == 0);
+        assert(pthread_create(&threads[1], NULL, create_each, NULL) == 0);
+        for (int t = 0; t < 2; t++) {
+            assert(pthread_join(threads[t], NULL) == 0);
+        }
+        int listed = 0;
+        tfs_dir_t *dir = tfs_opendir("/");
+        assert(dir != NULL);
+        for (tfs_dirent_t const *entry; (entry = tfs_readdir(dir)) != NULL;) {
+            listed += entry->d_name[0] == 'r';
+        }
+        tfs_closedir(dir);
+        assert(listed == RACE_COUNT);
+        int race_results[RACE_COUNT];
+        assert(tfs_unlink_many(race, RACE_COUNT, race_results) == 0);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WORKER_COUNT 3
+
+/* This test imports several files at once with tfs_bulk_import, one of which
+ * does not exist, and checks the result and contents of each import. */
+
+static tfs_import_t imports[] = {
+    {.source_path = "tests/file_to_copy.txt", .dest_path = "/f1"},
+    {.source_path = "tests/file_to_copy2.txt", .dest_path = "/f2"},
+    {.source_path = "tests/unexistent", .dest_path = "/f3"},
+    {.source_path = "tests/file_to_copy_over512.txt", .dest_path = "/f4"},
+    {.source_path = "tests/empty_file.txt", .dest_path = "/f5"},
+    {.source_path = "tests/file_to_copy3.txt", .dest_path = "/f6"},
+};
+
+#define IMPORT_COUNT (sizeof(imports) / sizeof(imports[0]))
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    assert(tfs_bulk_import(imports, IMPORT_COUNT, WORKER_COUNT) == -1);
+
+    for (size_t i = 0; i < IMPORT_COUNT; i++) {
+        FILE *source = fopen(imports[i].source_path, "r");
+        if (source == NULL) {
+            assert(imports[i].result == -1);
+            assert(tfs_lookup(imports[i].dest_path) == -1);
+            continue;
+        }
+        assert(imports[i].result == 0);
+
+        char expected[1024], buffer[1024];
+        size_t len = fread(expected, 1, sizeof(expected), source);
+        assert(fclose(source) == 0);
+
+        int f = tfs_open(imports[i].dest_path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+        assert(memcmp(buffer, expected, len) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    // without the missing file, all imports succeed (on a single worker too)
+    imports[2].source_path = "tests/file_to_copy4.txt";
+    assert(tfs_bulk_import(imports, IMPORT_COUNT, 1) == 0);
+    assert(tfs_bulk_import(imports, 0, WORKER_COUNT) == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
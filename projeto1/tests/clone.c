@@ -0,0 +1,135 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 256
+#define BLOCK_COUNT 32
+#define FILE_SIZE (3 * BLOCK_SIZE + 100)
+#define THREAD_COUNT 4
+#define ROUNDS 50
+
+/* This test clones a multi-block file, checks that the clone shares the data
+ * blocks of the original, and that writes to either file (overwrites from the
+ * start and appends) are not visible in the other one. It also checks that
+ * only one of several concurrent clones to the same name succeeds. */
+
+char const path1[] = "/f1";
+char const path2[] = "/f2";
+char const path3[] = "/f3";
+
+static void *clone_fn(void *arg) {
+    *(int *)arg = tfs_clone(path1, path3);
+    return NULL;
+}
+
+static void assert_contents_ok(char const *path, char const *expected,
+                               size_t len) {
+    char buffer[2 * FILE_SIZE];
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char contents[FILE_SIZE + 10];
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+    char expected[FILE_SIZE + 10];
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    assert(tfs_init(&params) != -1);
+    tfs_instance_t *fs = tfs_default_instance();
+
+    int f = tfs_open(path1, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(f) != -1);
+
+    // the clone shares the blocks of the original
+    assert(tfs_clone(path1, path2) == 0);
+    inode_t const *inode1 = inode_get(fs, tfs_lookup(path1));
+    inode_t const *inode2 = inode_get(fs, tfs_lookup(path2));
+    assert(inode2->i_size == FILE_SIZE);
+    assert(inode2->i_extent_count == inode1->i_extent_count);
+    assert(inode2->i_extents[0].e_start == inode1->i_extents[0].e_start);
+    assert_contents_ok(path2, contents, FILE_SIZE);
+
+    // the destination must not exist, and the source must
+    assert(tfs_clone(path1, path2) == -1);
+    assert(tfs_clone("/none", path3) == -1);
+
+    // overwriting the start of the clone copies only the first block
+    f = tfs_open(path2, 0);
+    assert(f != -1);
+    assert(tfs_write(f, "XYZ", 3) == 3);
+    assert(tfs_close(f) != -1);
+    assert(inode2->i_extents[0].e_start != inode1->i_extents[0].e_start);
+    assert(inode2->i_extents[0].e_len == 1);
+    assert(inode2->i_extents[1].e_start == inode1->i_extents[0].e_start + 1);
+    memcpy(expected, contents, FILE_SIZE);
+    memcpy(expected, "XYZ", 3);
+    assert_contents_ok(path2, expected, FILE_SIZE);
+    assert_contents_ok(path1, contents, FILE_SIZE);
+
+    // appending to the original does not change the clone
+    f = tfs_open(path1, TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "0123456789", 10) == 10);
+    assert(tfs_close(f) != -1);
+    memcpy(expected, contents, FILE_SIZE);
+    memcpy(expected + FILE_SIZE, "0123456789", 10);
+    assert_contents_ok(path1, expected, FILE_SIZE + 10);
+    memcpy(expected, "XYZ", 3);
+    assert_contents_ok(path2, expected, FILE_SIZE);
+
+    // a clone of a clone survives both being removed
+    assert(tfs_clone(path2, path3) == 0);
+    assert(tfs_unlink(path1) != -1);
+    assert(tfs_unlink(path2) != -1);
+    assert_contents_ok(path3, expected, FILE_SIZE);
+
+    // truncating the last owner frees the blocks for good
+    f = tfs_open(path3, TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    f = tfs_open(path1, TFS_O_CREAT);
+    assert(f != -1);
+    char big[(BLOCK_COUNT - 2) * BLOCK_SIZE];
+    memset(big, 'B', sizeof(big));
+    assert(tfs_write(f, big, sizeof(big)) == sizeof(big));
+    assert(tfs_close(f) != -1);
+    assert(tfs_unlink(path3) != -1);
+
+    // concurrent clones to the same name: one of them adds it, once
+    for (int r = 0; r < ROUNDS; r++) {
+        pthread_t threads[THREAD_COUNT];
+        int results[THREAD_COUNT];
+        for (int t = 0; t < THREAD_COUNT; t++) {
+            assert(pthread_create(&threads[t], NULL, clone_fn, &results[t]) ==
+                   0);
+        }
+        int cloned = 0;
+        for (int t = 0; t < THREAD_COUNT; t++) {
+            assert(pthread_join(threads[t], NULL) == 0);
+            cloned += results[t] == 0;
+        }
+        assert(cloned == 1);
+        assert(tfs_unlink(path3) != -1);
+        assert(tfs_lookup(path3) == -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
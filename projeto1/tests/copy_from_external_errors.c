@@ -17,7 +17,17 @@ int main() {
     // Scenario 1: source file does not exist
     assert(tfs_copy_from_external_fs("./unexistent", path1) == -1);
 
-    // TODO: add more failure scenarios
+    // Scenario 2: source is a directory (it cannot be read)
+    assert(tfs_copy_from_external_fs("tests", path1) == -1);
+
+    // Scenario 3: source does not fit in the volume
+    assert(tfs_destroy() != -1);
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 1; // only the root directory block
+    assert(tfs_init(&params) != -1);
+    assert(tfs_copy_from_external_fs("tests/file_to_copy_over512.txt",
+                                     path1) == -1);
+    assert(tfs_destroy() != -1);
 
     printf("Successful test.\n");
 
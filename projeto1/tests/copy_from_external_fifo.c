@@ -0,0 +1,58 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DATA_SIZE (200 * 1024 + 13)
+
+/* This test copies from a named pipe, which cannot be mapped (so the copy
+ * falls back to reading it in chunks), more data than fits in one chunk. */
+
+static char fifo_path[] = "/tmp/tfs_fifoXXXXXX";
+static char data[DATA_SIZE];
+
+void *feeder_fn(void *arg) {
+    (void)arg;
+    FILE *fifo = fopen(fifo_path, "w");
+    assert(fifo != NULL);
+    assert(fwrite(data, 1, sizeof(data), fifo) == sizeof(data));
+    assert(fclose(fifo) == 0);
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)('a' + i % 23);
+    }
+
+    // mkfifo needs a name that does not exist yet
+    int fd = mkstemp(fifo_path);
+    assert(fd != -1);
+    assert(close(fd) == 0 && unlink(fifo_path) == 0);
+    assert(mkfifo(fifo_path, 0600) == 0);
+
+    assert(tfs_init(NULL) != -1);
+
+    pthread_t feeder;
+    assert(pthread_create(&feeder, NULL, feeder_fn, NULL) == 0);
+    assert(tfs_copy_from_external_fs(fifo_path, "/f1") == 0);
+    assert(pthread_join(feeder, NULL) == 0);
+
+    static char buffer[DATA_SIZE + 1];
+    int f = tfs_open("/f1", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == DATA_SIZE);
+    assert(memcmp(buffer, data, DATA_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+    assert(unlink(fifo_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 256
+#define FILE_SIZE (7 * BLOCK_SIZE + 31)
+
+/* This test copies files out of TécnicoFS (a multi-block file, through a
+ * symbolic link, and an empty file), checks the host files, and checks the
+ * cases where the copy is expected to fail. */
+
+static char dest_path[] = "/tmp/tfs_copyXXXXXX";
+
+static void assert_host_file_ok(char const *expected, size_t len) {
+    char buffer[2 * FILE_SIZE];
+    FILE *file = fopen(dest_path, "r");
+    assert(file != NULL);
+    assert(fread(buffer, 1, sizeof(buffer), file) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(fclose(file) == 0);
+}
+
+int main() {
+    char contents[FILE_SIZE];
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+    int fd = mkstemp(dest_path);
+    assert(fd != -1);
+    assert(close(fd) == 0);
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(f) != -1);
+    f = tfs_open("/empty", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_sym_link("/f1", "/l1") != -1);
+
+    assert(tfs_copy_to_external_fs("/f1", dest_path) == 0);
+    assert_host_file_ok(contents, FILE_SIZE);
+
+    // the host file is overwritten
+    assert(tfs_copy_to_external_fs("/empty", dest_path) == 0);
+    assert_host_file_ok(contents, 0);
+    assert(tfs_copy_to_external_fs("/l1", dest_path) == 0);
+    assert_host_file_ok(contents, FILE_SIZE);
+
+    // the copy can be imported back
+    assert(tfs_copy_from_external_fs(dest_path, "/f2") == 0);
+    char buffer[2 * FILE_SIZE];
+    f = tfs_open("/f2", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == FILE_SIZE);
+    assert(memcmp(buffer, contents, FILE_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+
+    // failure scenarios: no such file, and a host path that cannot be created
+    assert(tfs_copy_to_external_fs("/none", dest_path) == -1);
+    assert(tfs_copy_to_external_fs("/f1", "/tmp/no/such/dir/file") == -1);
+
+    assert(tfs_destroy() != -1);
+    assert(unlink(dest_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE (16 * 1024) // partial writes to a pipe stop at a page
+#define DATA_SIZE (200 * 1024 + 13)
+#define READ_SIZE (1000)
+
+/* This test copies a file to a named pipe, whose slow reader interrupts the
+ * copying thread with a signal after each read, so that the writes to the
+ * pipe (larger than it holds) are partial, and checks that the copy continues
+ * each of them from where it stopped. */
+
+static char fifo_path[] = "/tmp/tfs_fifoXXXXXX";
+static char data[DATA_SIZE];
+static pthread_t copier;
+
+static void on_signal(int sig) { (void)sig; }
+
+void *reader_fn(void *arg) {
+    (void)arg;
+    static char buffer[DATA_SIZE + 1];
+    FILE *fifo = fopen(fifo_path, "r");
+    assert(fifo != NULL);
+    size_t total = 0;
+    for (;;) {
+        size_t bytes_read = fread(buffer + total, 1, READ_SIZE, fifo);
+        if (bytes_read == 0) {
+            break;
+        }
+        total += bytes_read;
+        assert(total <= DATA_SIZE);
+        assert(pthread_kill(copier, SIGUSR1) == 0);
+    }
+    assert(fclose(fifo) == 0);
+    assert(total == DATA_SIZE);
+    assert(memcmp(buffer, data, DATA_SIZE) == 0);
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)('a' + i % 23);
+    }
+
+    // interrupted writes return what they wrote (no SA_RESTART)
+    struct sigaction action = {.sa_handler = on_signal};
+    sigemptyset(&action.sa_mask);
+    assert(sigaction(SIGUSR1, &action, NULL) == 0);
+    copier = pthread_self();
+
+    // mkfifo needs a name that does not exist yet
+    int fd = mkstemp(fifo_path);
+    assert(fd != -1);
+    assert(close(fd) == 0 && unlink(fifo_path) == 0);
+    assert(mkfifo(fifo_path, 0600) == 0);
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, data, DATA_SIZE) == DATA_SIZE);
+    assert(tfs_close(f) != -1);
+
+    pthread_t reader;
+    assert(pthread_create(&reader, NULL, reader_fn, NULL) == 0);
+    assert(tfs_copy_to_external_fs("/f1", fifo_path) == 0);
+    assert(pthread_join(reader, NULL) == 0);
+
+    assert(tfs_destroy() != -1);
+    assert(unlink(fifo_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
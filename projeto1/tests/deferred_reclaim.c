@@ -0,0 +1,93 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 256
+#define BLOCK_COUNT 16
+#define FILE_COUNT 4
+#define FILE_BLOCKS 3
+
+/* This test checks that blocks freed by truncate and unlink are returned to
+ * the volume by the background reclaimer, and that allocations that would
+ * fail while blocks are pending reclamation reclaim them on the spot. */
+
+char const *paths[FILE_COUNT] = {"/f1", "/f2", "/f3", "/f4"};
+
+static size_t free_block_count(void) {
+    tfs_instance_t *fs = tfs_default_instance();
+    size_t free_count, free_runs, largest_free_run;
+    data_blocks_fragmentation(fs, &free_count, &free_runs, &largest_free_run);
+    return free_count;
+}
+
+static void wait_for_reclaimer(void) {
+    tfs_instance_t *fs = tfs_default_instance();
+    while (data_blocks_reclaim_backlog(fs) > 0) {
+        sched_yield();
+    }
+}
+
+static void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, FILE_BLOCKS * BLOCK_SIZE) ==
+           FILE_BLOCKS * BLOCK_SIZE);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char contents[FILE_BLOCKS * BLOCK_SIZE];
+    memset(contents, 'A', sizeof(contents));
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    assert(tfs_init(&params) != -1);
+
+    // unlinked files: their blocks come back in background (the first round
+    // may also move blocks cached in this thread's magazine to the map, so
+    // it only serves as a reference)
+    size_t free_initially = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < FILE_COUNT; i++) {
+            write_file(paths[i], contents);
+        }
+        for (int i = 0; i < FILE_COUNT; i++) {
+            assert(tfs_unlink(paths[i]) != -1);
+        }
+        wait_for_reclaimer();
+        if (round == 0) {
+            free_initially = free_block_count();
+        }
+    }
+    assert(free_block_count() == free_initially);
+
+    // truncated files too
+    for (int i = 0; i < FILE_COUNT; i++) {
+        write_file(paths[i], contents);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        int f = tfs_open(paths[i], TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    wait_for_reclaimer();
+    assert(free_block_count() == free_initially);
+
+    // rewriting the files right after truncating them, over and over, must
+    // never fail for lack of space, even if the reclaimer lags behind
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < FILE_COUNT; i++) {
+            write_file(paths[i], contents);
+        }
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
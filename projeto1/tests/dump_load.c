@@ -0,0 +1,125 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 512
+#define FILE_SIZE (5 * BLOCK_SIZE + 7)
+
+/* This test dumps a volume with files of several sizes, a hard link and
+ * symbolic links to an image, loads it into a new volume, and checks that
+ * every file, and the links between them, were restored. It also dumps and
+ * loads an empty volume. */
+
+char const path1[] = "/f1";
+char const path2[] = "/f2";
+char const empty_path[] = "/empty";
+char const hard_link[] = "/h1";
+char const sym_link[] = "/s1";
+char const dangling_link[] = "/s2";
+
+static char image_path[] = "/tmp/tfs_imageXXXXXX";
+
+static void write_file(char const *path, char const *buffer, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, len) == len);
+    assert(tfs_close(f) != -1);
+}
+
+static void assert_contents_ok(char const *path, char const *expected,
+                               size_t len) {
+    char buffer[2 * FILE_SIZE];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char contents[FILE_SIZE];
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+
+    int fd = mkstemp(image_path);
+    assert(fd != -1);
+    assert(close(fd) == 0);
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    write_file(path1, contents, FILE_SIZE);
+    write_file(path2, contents + 1, 100);
+    write_file(empty_path, contents, 0);
+    assert(tfs_link(path1, hard_link) != -1);
+    assert(tfs_sym_link(path2, sym_link) != -1);
+    write_file("/gone", contents, 10);
+    assert(tfs_sym_link("/gone", dangling_link) != -1);
+    assert(tfs_unlink("/gone") != -1);
+
+    assert(tfs_dump(image_path) == 0);
+    assert(tfs_destroy() != -1);
+
+    // restores the image in a new volume
+    assert(tfs_init(&params) != -1);
+    assert(tfs_load(image_path) == 0);
+
+    assert_contents_ok(path1, contents, FILE_SIZE);
+    assert_contents_ok(hard_link, contents, FILE_SIZE);
+    assert_contents_ok(path2, contents + 1, 100);
+    assert_contents_ok(sym_link, contents + 1, 100);
+    assert_contents_ok(empty_path, contents, 0);
+    assert(tfs_lookup(dangling_link) != -1);
+    assert(tfs_open(dangling_link, 0) == -1);
+
+    // the hard link still names the same file
+    int f = tfs_open(hard_link, 0);
+    assert(f != -1);
+    assert(tfs_write(f, "XYZ", 3) == 3);
+    assert(tfs_close(f) != -1);
+    memcpy(contents, "XYZ", 3);
+    assert_contents_ok(path1, contents, FILE_SIZE);
+    assert(tfs_lookup(path1) == tfs_lookup(hard_link));
+
+    // loading it again fails (the volume is not empty)
+    assert(tfs_load(image_path) == -1);
+    assert(tfs_destroy() != -1);
+
+    // an image that does not fit is not loaded at all
+    tfs_params small_params = params;
+    small_params.max_block_count = 4;
+    assert(tfs_init(&small_params) != -1);
+    assert(tfs_load(image_path) == -1);
+    assert(tfs_lookup(path1) == -1);
+    assert(tfs_lookup(sym_link) == -1);
+    write_file(path2, contents, 3 * BLOCK_SIZE); // all blocks are free again
+    assert(tfs_destroy() != -1);
+
+    // a truncated image is rejected
+    assert(truncate(image_path, 100) == 0);
+    assert(tfs_init(&params) != -1);
+    assert(tfs_load(image_path) == -1);
+    assert(tfs_load("/tmp/does_not_exist.img") == -1);
+    assert(tfs_destroy() != -1);
+
+    // an empty volume has an image too
+    assert(tfs_init(&params) != -1);
+    assert(tfs_dump(image_path) == 0);
+    assert(tfs_destroy() != -1);
+    assert(tfs_init(&params) != -1);
+    assert(tfs_load(image_path) == 0);
+    assert(tfs_lookup(path1) == -1);
+    write_file(path1, contents, FILE_SIZE);
+    assert(tfs_destroy() != -1);
+
+    assert(unlink(image_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
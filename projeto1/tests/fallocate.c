@@ -0,0 +1,147 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 256
+#define BLOCK_COUNT 16
+#define ROUNDS 100
+
+/* This test preallocates blocks for a file, checks that writes within the
+ * preallocated range do not allocate more blocks, that the unused blocks are
+ * released when the last handle open on the file is closed (whichever handle
+ * preallocated them, and also if they are closed at the same time), and that
+ * preallocating more than the volume holds, or past SIZE_MAX, fails. */
+
+char const path1[] = "/f1";
+char const path2[] = "/f2";
+
+static void *close_fn(void *arg) {
+    assert(tfs_close(*(int *)arg) != -1);
+    return NULL;
+}
+
+static size_t free_block_count(void) {
+    tfs_instance_t *fs = tfs_default_instance();
+    size_t free_count, free_runs, largest_free_run;
+    data_blocks_fragmentation(fs, &free_count, &free_runs, &largest_free_run);
+    return free_count;
+}
+
+int main() {
+    char contents[BLOCK_SIZE];
+    memset(contents, 'A', sizeof(contents));
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    assert(tfs_init(&params) != -1);
+    tfs_instance_t *fs = tfs_default_instance();
+
+    int f = tfs_open(path1, TFS_O_CREAT);
+    assert(f != -1);
+    int inum = tfs_lookup(path1);
+    assert(inum != -1);
+    inode_t const *inode = inode_get(fs, inum);
+
+    // preallocate 4 blocks: the file stays empty, but owns one extent
+    assert(tfs_fallocate(f, 0, 4 * BLOCK_SIZE) == 0);
+    assert(inode_block_count(inode) == 4);
+    assert(inode->i_extent_count == 1);
+    assert(inode->i_size == 0);
+
+    // writes within the preallocated range allocate nothing
+    size_t free_before = free_block_count();
+    assert(tfs_write(f, contents, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(tfs_write(f, contents, 10) == 10);
+    assert(free_block_count() == free_before);
+    assert(inode_block_count(inode) == 4);
+
+    // a range that is already allocated is a no-op
+    assert(tfs_fallocate(f, BLOCK_SIZE, BLOCK_SIZE) == 0);
+    assert(inode_block_count(inode) == 4);
+
+    // closing releases the 2 unused blocks (once reclaimed in background)
+    assert(tfs_close(f) != -1);
+    assert(inode_block_count(inode) == 2);
+    while (data_blocks_reclaim_backlog(fs) > 0) {
+        sched_yield();
+    }
+    assert(free_block_count() == free_before + 2);
+
+    // contents are intact
+    char buffer[2 * BLOCK_SIZE];
+    f = tfs_open(path1, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == BLOCK_SIZE + 10);
+    assert(memcmp(buffer, contents, BLOCK_SIZE) == 0);
+
+    // kept while another handle is open, whichever closes first
+    int g = tfs_open(path1, 0);
+    assert(g != -1);
+    assert(tfs_fallocate(g, 0, 4 * BLOCK_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+    assert(inode_block_count(inode) == 4);
+    assert(tfs_close(g) != -1);
+    assert(inode_block_count(inode) == 2);
+
+    f = tfs_open(path1, 0);
+    assert(f != -1);
+    g = tfs_open(path1, 0);
+    assert(g != -1);
+    assert(tfs_fallocate(g, 0, 4 * BLOCK_SIZE) == 0);
+    assert(tfs_close(g) != -1);
+    assert(inode_block_count(inode) == 4);
+    assert(tfs_close(f) != -1);
+    assert(inode_block_count(inode) == 2);
+
+    // released also when the last two handles are closed at the same time
+    for (int r = 0; r < ROUNDS; r++) {
+        int handles[2];
+        pthread_t threads[2];
+        for (int t = 0; t < 2; t++) {
+            handles[t] = tfs_open(path1, 0);
+            assert(handles[t] != -1);
+            size_t len = (size_t)(2 + t) * BLOCK_SIZE;
+            assert(tfs_fallocate(handles[t], 0, len) == 0);
+        }
+        for (int t = 0; t < 2; t++) {
+            assert(pthread_create(&threads[t], NULL, close_fn, &handles[t]) ==
+                   0);
+        }
+        for (int t = 0; t < 2; t++) {
+            assert(pthread_join(threads[t], NULL) == 0);
+        }
+        assert(inode_block_count(inode) == 2);
+    }
+
+    // an empty range preallocates nothing, a range past SIZE_MAX fails
+    f = tfs_open(path1, 0);
+    assert(f != -1);
+    assert(tfs_fallocate(f, 8 * BLOCK_SIZE, 0) == 0);
+    assert(inode_block_count(inode) == 2);
+    assert(tfs_fallocate(f, 8 * BLOCK_SIZE, SIZE_MAX) == -1);
+    assert(tfs_fallocate(f, 0, SIZE_MAX - 1) == -1);
+    assert(inode_block_count(inode) == 2);
+    assert(tfs_close(f) != -1);
+
+    // not enough space in the volume
+    f = tfs_open(path2, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_fallocate(f, 0, BLOCK_COUNT * BLOCK_SIZE) == -1);
+    assert(tfs_close(f) != -1);
+    assert(inode_block_count(inode_get(fs, tfs_lookup(path2))) == 0);
+
+    // invalid file handle
+    assert(tfs_fallocate(f, 0, BLOCK_SIZE) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "fs/config.h"
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1000 // the data blocks do not fill whole huge pages
+#define BLOCK_COUNT (3 * DATA_BLOCKS_CHUNK)
+#define FILE_SIZE ((BLOCK_COUNT - 1) * BLOCK_SIZE)
+
+/* This test creates instances with every placement of the data blocks (huge
+ * pages or not, and each NUMA policy), whether or not the host supports it,
+ * and checks that files filling all the data blocks are read back intact, and
+ * that data blocks backed by huge pages are aligned to them. */
+
+static char contents[FILE_SIZE];
+static char buffer[FILE_SIZE];
+
+static void check(bool huge_pages, tfs_numa_policy numa_policy) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    params.huge_pages = huge_pages;
+    params.numa_policy = numa_policy;
+    tfs_instance_t *fs = tfs_instance_create(&params);
+    assert(fs != NULL);
+
+    int f = tfsi_open(fs, "/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfsi_write(fs, f, contents, FILE_SIZE) == FILE_SIZE);
+    assert(tfsi_close(fs, f) != -1);
+
+    f = tfsi_open(fs, "/f", 0);
+    assert(f != -1);
+    assert(tfsi_read(fs, f, buffer, sizeof(buffer)) == FILE_SIZE);
+    assert(memcmp(buffer, contents, FILE_SIZE) == 0);
+    assert(tfsi_close(fs, f) != -1);
+
+    if (huge_pages) {
+        assert((uintptr_t)data_block_get(fs, 0) % HUGE_PAGE_SIZE == 0);
+    }
+    assert(tfs_instance_destroy(fs) != -1);
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)(i % 251);
+    }
+
+    tfs_numa_policy const policies[] = {TFS_NUMA_DEFAULT, TFS_NUMA_LOCAL,
+                                        TFS_NUMA_INTERLEAVE};
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        check(false, policies[i]);
+        check(true, policies[i]);
+    }
+
+    printf("Successful test.\n");
+}
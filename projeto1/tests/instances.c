@@ -0,0 +1,107 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define INSTANCE_COUNT 4
+#define ROUNDS 50
+#define FILE_SIZE 3000
+
+/* This test checks that instances are independent volumes: the same names
+ * and file handles refer to different files in each one, each instance is
+ * used by its own thread at the same time as the others, and destroying an
+ * instance does not affect the others (nor the default one). */
+
+static tfs_instance_t *instances[INSTANCE_COUNT];
+
+static void fill(char *buffer, size_t len, int seed) {
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = (char)('a' + (i + (size_t)seed) % 26);
+    }
+}
+
+static void *worker(void *arg) {
+    int id = *(int *)arg;
+    tfs_instance_t *fs = instances[id];
+    char contents[FILE_SIZE];
+    char buffer[FILE_SIZE];
+    fill(contents, sizeof(contents), id);
+
+    for (int i = 0; i < ROUNDS; i++) {
+        int f = tfsi_open(fs, "/f", TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfsi_write(fs, f, contents, FILE_SIZE) == FILE_SIZE);
+        assert(tfsi_close(fs, f) != -1);
+
+        f = tfsi_open(fs, "/f", 0);
+        assert(f != -1);
+        assert(tfsi_read(fs, f, buffer, sizeof(buffer)) == FILE_SIZE);
+        assert(memcmp(buffer, contents, FILE_SIZE) == 0);
+        assert(tfsi_close(fs, f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_default_instance() != NULL);
+
+    tfs_params params = tfs_default_params();
+    params.block_size = 512;
+    for (int i = 0; i < INSTANCE_COUNT; i++) {
+        instances[i] = tfs_instance_create(&params);
+        assert(instances[i] != NULL);
+    }
+
+    // a file of one instance is not seen by the others
+    int f = tfsi_open(instances[0], "/only0", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfsi_lookup(instances[0], "/only0") != -1);
+    assert(tfsi_lookup(instances[1], "/only0") == -1);
+    assert(tfs_lookup("/only0") == -1);
+
+    // nor are its file handles
+    assert(tfsi_close(instances[1], f) == -1);
+    assert(tfsi_close(instances[0], f) != -1);
+
+    // the instances keep their own parameters and usage
+    tfs_statfs_t stat;
+    tfsi_statfs(instances[0], &stat);
+    assert(stat.f_block_size == 512);
+    assert(stat.f_inodes_free == stat.f_inodes - 2);
+    tfs_statfs(&stat);
+    assert(stat.f_block_size == tfs_default_params().block_size);
+    assert(stat.f_inodes_free == stat.f_inodes - 1);
+
+    // the same name on each instance, used concurrently
+    pthread_t tid[INSTANCE_COUNT];
+    int ids[INSTANCE_COUNT];
+    for (int i = 0; i < INSTANCE_COUNT; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, worker, &ids[i]) == 0);
+    }
+    for (int i = 0; i < INSTANCE_COUNT; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    // destroying an instance leaves the others intact
+    assert(tfs_instance_destroy(instances[0]) != -1);
+    char expected[FILE_SIZE];
+    char buffer[FILE_SIZE];
+    for (int i = 1; i < INSTANCE_COUNT; i++) {
+        fill(expected, sizeof(expected), i);
+        f = tfsi_open(instances[i], "/f", 0);
+        assert(f != -1);
+        assert(tfsi_read(instances[i], f, buffer, sizeof(buffer)) ==
+               FILE_SIZE);
+        assert(memcmp(buffer, expected, FILE_SIZE) == 0);
+        assert(tfsi_close(instances[i], f) != -1);
+        assert(tfs_instance_destroy(instances[i]) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+    assert(tfs_default_instance() == NULL);
+
+    printf("Successful test.\n");
+}
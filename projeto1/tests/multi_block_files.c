@@ -0,0 +1,111 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 256
+#define BLOCK_COUNT 32
+#define FILE_SIZE (5 * BLOCK_SIZE + 17)
+
+/* This test writes files spanning multiple data blocks, checks that a file
+ * written sequentially occupies a single extent (contiguous blocks), that
+ * files grown in an interleaved way are still read back correctly, and that
+ * writes are cut short once the volume is full. */
+
+char const path1[] = "/f1";
+char const path2[] = "/f2";
+char const path3[] = "/f3";
+
+static void fill(char *buffer, size_t len, char seed) {
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = (char)(seed + (char)(i % 23));
+    }
+}
+
+static void assert_contents_ok(char const *path, char const *expected,
+                               size_t len) {
+    char buffer[FILE_SIZE + 1];
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    // small reads, crossing block boundaries
+    size_t done = 0;
+    ssize_t r;
+    while ((r = tfs_read(f, buffer + done, 100)) > 0) {
+        done += (size_t)r;
+    }
+    assert(r == 0);
+    assert(done == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+
+    // one read for the whole file
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char contents1[FILE_SIZE];
+    char contents2[FILE_SIZE];
+    fill(contents1, sizeof(contents1), 'a');
+    fill(contents2, sizeof(contents2), 'A');
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    assert(tfs_init(&params) != -1);
+    tfs_instance_t *fs = tfs_default_instance();
+
+    // sequential writes end up in a single extent
+    int f = tfs_open(path1, TFS_O_CREAT);
+    assert(f != -1);
+    for (size_t done = 0; done < FILE_SIZE; done += 100) {
+        size_t len = FILE_SIZE - done < 100 ? FILE_SIZE - done : 100;
+        assert(tfs_write(f, contents1 + done, len) == len);
+    }
+    assert(tfs_close(f) != -1);
+    assert(inode_get(fs, tfs_lookup(path1))->i_extent_count == 1);
+    assert_contents_ok(path1, contents1, FILE_SIZE);
+
+    // interleaved growth of two files
+    int f2 = tfs_open(path2, TFS_O_CREAT);
+    int f3 = tfs_open(path3, TFS_O_CREAT);
+    assert(f2 != -1 && f3 != -1);
+    for (size_t done = 0; done < 3 * BLOCK_SIZE; done += BLOCK_SIZE) {
+        assert(tfs_write(f2, contents2 + done, BLOCK_SIZE) == BLOCK_SIZE);
+        assert(tfs_write(f3, contents1 + done, BLOCK_SIZE) == BLOCK_SIZE);
+    }
+    assert(tfs_close(f2) != -1);
+    assert(tfs_close(f3) != -1);
+    assert_contents_ok(path2, contents2, 3 * BLOCK_SIZE);
+    assert_contents_ok(path3, contents1, 3 * BLOCK_SIZE);
+
+    // truncating frees the blocks, which can be reused
+    f = tfs_open(path1, TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents2, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(f) != -1);
+    assert_contents_ok(path1, contents2, FILE_SIZE);
+
+    // fill up the volume: the write is cut short, then fails
+    f = tfs_open(path2, TFS_O_APPEND);
+    assert(f != -1);
+    ssize_t w;
+    size_t appended = 0;
+    while ((w = tfs_write(f, contents1, BLOCK_SIZE)) > 0) {
+        appended += (size_t)w;
+    }
+    assert(w == -1);
+    assert(appended > 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREAD_COUNT 4
+#define ROUNDS 100
+#define FILE_SIZE 100
+
+/* This test checks the operation statistics of tfs_get_stats: the number of
+ * calls, errors and bytes of each operation (made by several threads, some of
+ * which exited before the statistics are read), and the ordering of the
+ * latency percentiles; and that volumes created without the op_stats
+ * parameter report no statistics. */
+
+static tfs_instance_t *fs;
+
+static void *worker(void *arg) {
+    char name[16];
+    char contents[FILE_SIZE];
+    char buffer[FILE_SIZE];
+    snprintf(name, sizeof(name), "/t%d", *(int *)arg);
+    memset(contents, 'a', sizeof(contents));
+
+    for (int i = 0; i < ROUNDS; i++) {
+        int f = tfsi_open(fs, name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfsi_write(fs, f, contents, FILE_SIZE) == FILE_SIZE);
+        assert(tfsi_close(fs, f) != -1);
+
+        f = tfsi_open(fs, name, 0);
+        assert(f != -1);
+        assert(tfsi_read(fs, f, buffer, sizeof(buffer)) == FILE_SIZE);
+        assert(tfsi_close(fs, f) != -1);
+
+        assert(tfsi_unlink(fs, name) != -1);
+        assert(tfsi_open(fs, name, 0) == -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.op_stats = true;
+    fs = tfs_instance_create(&params);
+    assert(fs != NULL);
+
+    pthread_t tid[THREAD_COUNT];
+    int ids[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, worker, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    // and some by a thread that is still running
+    int id = THREAD_COUNT;
+    worker(&id);
+    assert(tfsi_copy_from_external_fs(fs, "tests/file_to_copy.txt", "/copy") !=
+           -1);
+    assert(tfsi_copy_from_external_fs(fs, "tests/does_not_exist", "/copy") ==
+           -1);
+
+    size_t const calls = (THREAD_COUNT + 1) * ROUNDS;
+    tfs_stats_t stats;
+    tfsi_get_stats(fs, &stats);
+
+    tfs_op_stats_t *opens = &stats.st_ops[TFS_STATS_OPEN];
+    assert(opens->s_ops == 3 * calls);
+    assert(opens->s_errors == calls);
+    assert(opens->s_bytes == 0);
+
+    tfs_op_stats_t *writes = &stats.st_ops[TFS_STATS_WRITE];
+    assert(writes->s_ops == calls && writes->s_errors == 0);
+    assert(writes->s_bytes == calls * FILE_SIZE);
+
+    tfs_op_stats_t *reads = &stats.st_ops[TFS_STATS_READ];
+    assert(reads->s_ops == calls && reads->s_errors == 0);
+    assert(reads->s_bytes == calls * FILE_SIZE);
+
+    tfs_op_stats_t *unlinks = &stats.st_ops[TFS_STATS_UNLINK];
+    assert(unlinks->s_ops == calls && unlinks->s_errors == 0);
+
+    // the opens and writes of the copy are not counted as such
+    tfs_op_stats_t *copies = &stats.st_ops[TFS_STATS_COPY_FROM_EXTERNAL_FS];
+    assert(copies->s_ops == 2 && copies->s_errors == 1);
+
+    for (int op = 0; op < TFS_STATS_OP_COUNT; op++) {
+        tfs_op_stats_t *s = &stats.st_ops[op];
+        assert(s->s_max_ns > 0);
+        assert(s->s_p50_ns <= s->s_p99_ns);
+        assert(s->s_p99_ns <= s->s_p999_ns);
+        assert(s->s_p999_ns <= s->s_max_ns);
+    }
+    assert(tfs_instance_destroy(fs) != -1);
+
+    // without the parameter, nothing is measured
+    assert(tfs_init(NULL) != -1);
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "abc", 3) == 3);
+    assert(tfs_close(f) != -1);
+    tfs_get_stats(&stats);
+    for (int op = 0; op < TFS_STATS_OP_COUNT; op++) {
+        assert(stats.st_ops[op].s_ops == 0);
+        assert(stats.st_ops[op].s_max_ns == 0);
+    }
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+}
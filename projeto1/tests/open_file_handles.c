@@ -0,0 +1,88 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define THREAD_COUNT 4
+#define HELD_PER_THREAD 100
+#define ROUNDS 20
+
+/* This test opens and closes many files from several threads at once (each
+ * thread caches some free file handles), and checks that no handle is given
+ * to two open files, that closed handles are rejected even while they are
+ * cached, and that handles cached by a thread are used by the others once
+ * the table is full. */
+
+static int handles[THREAD_COUNT][HELD_PER_THREAD];
+static bool in_use[THREAD_COUNT * HELD_PER_THREAD + 1];
+
+static void *open_close(void *arg) {
+    int t = *(int *)arg;
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < HELD_PER_THREAD; i++) {
+            handles[t][i] = tfs_open("/f", 0);
+            assert(handles[t][i] != -1);
+        }
+        for (int i = 0; i < HELD_PER_THREAD; i++) {
+            assert(tfs_close(handles[t][i]) != -1);
+        }
+    }
+    // keeps the last round's handles open for the check of main
+    for (int i = 0; i < HELD_PER_THREAD; i++) {
+        handles[t][i] = tfs_open("/f", 0);
+        assert(handles[t][i] != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_open_files_count = THREAD_COUNT * HELD_PER_THREAD + 1;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "abc", 3) == 3);
+    assert(tfs_close(f) != -1);
+
+    // a closed handle is rejected (it is only cached by this thread)
+    char buffer[3];
+    assert(tfs_close(f) == -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == -1);
+    assert(tfs_write(f, "abc", 3) == -1);
+
+    pthread_t threads[THREAD_COUNT];
+    int ids[THREAD_COUNT];
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        ids[t] = t;
+        assert(pthread_create(&threads[t], NULL, open_close, &ids[t]) == 0);
+    }
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+
+    // all the handles held are distinct, and one is left (cached by main)
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        for (int i = 0; i < HELD_PER_THREAD; i++) {
+            int h = handles[t][i];
+            assert(h >= 0 && h < THREAD_COUNT * HELD_PER_THREAD + 1);
+            assert(!in_use[h]);
+            in_use[h] = true;
+        }
+    }
+    f = tfs_open("/f", 0);
+    assert(f != -1 && !in_use[f]);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 3);
+    assert(tfs_open("/f", 0) == -1);
+    assert(tfs_close(f) != -1);
+
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        for (int i = 0; i < HELD_PER_THREAD; i++) {
+            assert(tfs_close(handles[t][i]) != -1);
+        }
+    }
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+}
@@ -0,0 +1,85 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 256
+#define FILE_BLOCKS 48
+
+/* This test reads a file sequentially and checks that the blocks ahead of
+ * the reader are brought into the block cache in the background, with a
+ * window that grows as the reads stay sequential. */
+
+char const path[] = "/f1";
+
+static int physical_block(inode_t const *inode, size_t file_block) {
+    size_t run;
+    return inode_block_run(inode, file_block, &run);
+}
+
+static void wait_cached(inode_t const *inode, size_t file_block) {
+    tfs_instance_t *fs = tfs_default_instance();
+    int bnum = physical_block(inode, file_block);
+    while (!data_block_cached(fs, bnum)) {
+        sched_yield();
+    }
+}
+
+int main() {
+    char contents[FILE_BLOCKS * BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+    tfs_instance_t *fs = tfs_default_instance();
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(f) != -1);
+    inode_t const *inode = inode_get(fs, tfs_lookup(path));
+
+    // writes do not go through the cache
+    for (size_t b = 0; b < FILE_BLOCKS; b++) {
+        assert(!data_block_cached(fs, physical_block(inode, b)));
+    }
+
+    // the first read starts the window (READAHEAD_MIN_BLOCKS blocks)
+    char buffer[BLOCK_SIZE];
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, 100) == 100);
+    assert(memcmp(buffer, contents, 100) == 0);
+    assert(data_block_cached(fs, physical_block(inode, 0)));
+    wait_cached(inode, READAHEAD_MIN_BLOCKS);
+
+    // each sequential read doubles it
+    assert(tfs_read(f, buffer, 100) == 100);
+    assert(memcmp(buffer, contents + 100, 100) == 0);
+    wait_cached(inode, 2 * READAHEAD_MIN_BLOCKS);
+    assert(tfs_read(f, buffer, 100) == 100);
+    assert(memcmp(buffer, contents + 200, 100) == 0);
+    wait_cached(inode, 1 + 4 * READAHEAD_MIN_BLOCKS);
+
+    // the rest of the file reads correctly, and the prefetch stops at its end
+    size_t done = 300;
+    ssize_t r;
+    while ((r = tfs_read(f, buffer, sizeof(buffer))) > 0) {
+        assert(memcmp(buffer, contents + done, (size_t)r) == 0);
+        done += (size_t)r;
+    }
+    assert(done == sizeof(contents));
+    wait_cached(inode, FILE_BLOCKS - 1);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 512 // 11 directory entries
+#define BATCH 4
+#define ROUNDS 200
+
+/* This test lists the root directory with tfs_opendir/tfs_readdir and checks
+ * file status with tfs_stat. It checks that changes made after tfs_opendir
+ * are not listed, and that a batch of files created and deleted by another
+ * thread is always listed entirely or not at all, while yet another thread
+ * creates, writes and deletes a single file, and another one moves a name
+ * back and forth (adding the new name before removing the old one, so that
+ * one of them is always listed). */
+
+static char const *const batch[BATCH] = {"/b0", "/b1", "/b2", "/b3"};
+
+static void *churn(void *arg) {
+    (void)arg;
+    int results[BATCH];
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(tfs_create_many(batch, BATCH, results) == 0);
+        assert(tfs_unlink_many(batch, BATCH, results) == 0);
+    }
+    return NULL;
+}
+
+static void *churn_single(void *arg) {
+    (void)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        int f = tfs_open("/x", TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, "abc", 3) == 3);
+        assert(tfs_close(f) != -1);
+        assert(tfs_unlink("/x") != -1);
+    }
+    return NULL;
+}
+
+static void *churn_move(void *arg) {
+    (void)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(tfs_link("/f1", "/m1") != -1);
+        assert(tfs_unlink("/m0") != -1);
+        assert(tfs_link("/f1", "/m0") != -1);
+        assert(tfs_unlink("/m1") != -1);
+    }
+    return NULL;
+}
+
+/**
+ * List the root directory, checking that it holds the given names (in any
+ * order), and returns how many other names it holds (not counting those
+ * starting with 'm', which are counted in moved, if not NULL).
+ */
+static int list_moved(char const *const *names, int count, int *moved) {
+    bool seen[8] = {false};
+    int others = 0;
+    tfs_dir_t *dir = tfs_opendir("/");
+    assert(dir != NULL);
+    for (tfs_dirent_t const *entry; (entry = tfs_readdir(dir)) != NULL;) {
+        assert(entry->d_inumber != -1);
+        bool known = false;
+        for (int i = 0; i < count; i++) {
+            if (strcmp(entry->d_name, names[i] + 1) == 0) {
+                assert(!seen[i]);
+                seen[i] = known = true;
+            }
+        }
+        if (!known && entry->d_name[0] == 'm' && moved != NULL) {
+            (*moved)++;
+        } else {
+            others += !known;
+        }
+    }
+    assert(tfs_readdir(dir) == NULL);
+    tfs_closedir(dir);
+    for (int i = 0; i < count; i++) {
+        assert(seen[i]);
+    }
+    return others;
+}
+
+static int list(char const *const *names, int count) {
+    return list_moved(names, count, NULL);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    assert(tfs_opendir("/f1") == NULL);
+    assert(list(NULL, 0) == 0);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "abc", 3) == 3);
+    assert(tfs_close(f) != -1);
+    assert(tfs_link("/f1", "/h1") != -1);
+    assert(tfs_sym_link("/f1", "/s1") != -1);
+
+    tfs_stat_t stat;
+    assert(tfs_stat("/f1", &stat) == 0);
+    assert(stat.st_type == TFS_T_FILE && stat.st_size == 3 &&
+           stat.st_nlink == 2 && stat.st_inumber == tfs_lookup("/h1"));
+    assert(tfs_stat("/s1", &stat) == 0);
+    assert(stat.st_type == TFS_T_SYMLINK && stat.st_nlink == 1);
+    assert(tfs_stat("/none", &stat) == -1);
+
+    // the listing is taken at tfs_opendir
+    char const *names[] = {"/f1", "/h1", "/s1"};
+    tfs_dir_t *dir = tfs_opendir("/");
+    assert(dir != NULL);
+    assert(tfs_unlink("/h1") != -1);
+    f = tfs_open("/f2", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    int listed = 0;
+    for (tfs_dirent_t const *entry; (entry = tfs_readdir(dir)) != NULL;) {
+        assert(strcmp(entry->d_name, "f2") != 0);
+        listed++;
+    }
+    assert(listed == 3);
+    tfs_closedir(dir);
+    assert(tfs_unlink("/f2") != -1);
+    names[1] = "/s1";
+    assert(list(names, 2) == 0);
+
+    // a batch is never listed in part (the single file may be listed or not),
+    // and a moved name is listed at least once
+    assert(tfs_link("/f1", "/m0") != -1);
+    pthread_t threads[3];
+    assert(pthread_create(&threads[0], NULL, churn, NULL) == 0);
+    assert(pthread_create(&threads[1], NULL, churn_single, NULL) == 0);
+    assert(pthread_create(&threads[2], NULL, churn_move, NULL) == 0);
+    for (int i = 0; i < ROUNDS; i++) {
+        int moved = 0;
+        int others = list_moved(names, 2, &moved);
+        assert(others == 0 || others == 1 || others == BATCH ||
+               others == BATCH + 1);
+        assert(moved == 1 || moved == 2);
+    }
+    for (int t = 0; t < 3; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+    return 0;
+}
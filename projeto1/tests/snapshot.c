@@ -0,0 +1,127 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 256
+#define FILE_SIZE (3 * BLOCK_SIZE + 50)
+
+/* This test takes a snapshot of the volume, changes every file afterwards
+ * (overwrite, append, truncate and unlink), and checks that the snapshot
+ * still reads the old contents, including when it is exported by another
+ * thread while a writer keeps changing the files. */
+
+char const path1[] = "/f1";
+char const path2[] = "/f2";
+char const path3[] = "/f3";
+char const link_path[] = "/l1";
+
+static char contents[FILE_SIZE];
+static char export_dir[] = "/tmp/tfs_snapshotXXXXXX";
+
+static void assert_snapshot_ok(tfs_snapshot_t const *snapshot, char const *path,
+                               char const *expected, size_t len) {
+    char buffer[2 * FILE_SIZE];
+    assert(tfs_snapshot_read(snapshot, path, 0, buffer, sizeof(buffer)) ==
+           len);
+    assert(memcmp(buffer, expected, len) == 0);
+}
+
+static void assert_exported_ok(char const *name, char const *expected,
+                               size_t len) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s", export_dir, name);
+
+    char buffer[2 * FILE_SIZE];
+    FILE *file = fopen(path, "r");
+    assert(file != NULL);
+    assert(fread(buffer, 1, sizeof(buffer), file) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(fclose(file) == 0);
+    assert(unlink(path) == 0);
+}
+
+static void write_file(char const *path, tfs_file_mode_t mode,
+                       char const *buffer, size_t len) {
+    int f = tfs_open(path, mode);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, len) == len);
+    assert(tfs_close(f) != -1);
+}
+
+void *writer_fn(void *arg) {
+    (void)arg;
+    char other[BLOCK_SIZE];
+    memset(other, 'W', sizeof(other));
+    for (int i = 0; i < 50; i++) {
+        write_file(path1, TFS_O_TRUNC, other, sizeof(other));
+        write_file(path2, TFS_O_APPEND, other, 10);
+    }
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    write_file(path1, TFS_O_CREAT, contents, FILE_SIZE);
+    write_file(path2, TFS_O_CREAT, contents, 100);
+    write_file(path3, TFS_O_CREAT, contents, BLOCK_SIZE);
+    assert(tfs_sym_link(path1, link_path) != -1);
+
+    tfs_snapshot_t *snapshot = tfs_snapshot();
+    assert(snapshot != NULL);
+
+    // changes every file of the live volume
+    write_file(path1, 0, "XYZ", 3);
+    write_file(path2, TFS_O_APPEND, "0123456789", 10);
+    write_file(path3, TFS_O_TRUNC, "T", 1);
+    assert(tfs_unlink(path3) != -1);
+    write_file("/f4", TFS_O_CREAT, contents, 10);
+
+    // the snapshot still sees the volume as it was
+    assert_snapshot_ok(snapshot, path1, contents, FILE_SIZE);
+    assert_snapshot_ok(snapshot, link_path, contents, FILE_SIZE);
+    assert_snapshot_ok(snapshot, path2, contents, 100);
+    assert_snapshot_ok(snapshot, path3, contents, BLOCK_SIZE);
+    assert(tfs_snapshot_read(snapshot, "/f4", 0, contents, 1) == -1);
+
+    char buffer[16];
+    assert(tfs_snapshot_read(snapshot, path1, FILE_SIZE - 5, buffer,
+                             sizeof(buffer)) == 5);
+    assert(memcmp(buffer, contents + FILE_SIZE - 5, 5) == 0);
+
+    int f = tfs_open(path1, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, 3) == 3);
+    assert(memcmp(buffer, "XYZ", 3) == 0);
+    assert(tfs_close(f) != -1);
+
+    // exports the snapshot while another thread keeps writing
+    assert(mkdtemp(export_dir) != NULL);
+    pthread_t writer;
+    assert(pthread_create(&writer, NULL, writer_fn, NULL) == 0);
+    assert(tfs_snapshot_export(snapshot, export_dir) == 0);
+    assert(pthread_join(writer, NULL) == 0);
+
+    assert_exported_ok("l1", contents, FILE_SIZE); // before its target
+    assert_exported_ok("f1", contents, FILE_SIZE);
+    assert_exported_ok("f2", contents, 100);
+    assert_exported_ok("f3", contents, BLOCK_SIZE);
+    assert(rmdir(export_dir) == 0);
+
+    tfs_snapshot_release(snapshot);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
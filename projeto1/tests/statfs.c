@@ -0,0 +1,96 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define BLOCK_SIZE 256
+#define BLOCK_COUNT 64
+#define INODE_COUNT 16
+#define THREAD_COUNT 4
+#define ROUNDS 50
+
+/* This test checks the free block and inode counts reported by tfs_statfs
+ * as files are written, cloned (and then copied on write), truncated and
+ * deleted, also from several threads at once. */
+
+static char contents[4 * BLOCK_SIZE];
+
+static void *churn(void *arg) {
+    char name[16];
+    snprintf(name, sizeof(name), "/t%d", *(int *)arg);
+    for (int i = 0; i < ROUNDS; i++) {
+        int f = tfs_open(name, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_write(f, contents, 2 * BLOCK_SIZE) == 2 * BLOCK_SIZE);
+        assert(tfs_close(f) != -1);
+        assert(tfs_unlink(name) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    params.max_inode_count = INODE_COUNT;
+    assert(tfs_init(&params) != -1);
+
+    // the root directory takes an inode and a block
+    tfs_statfs_t stat;
+    tfs_statfs(&stat);
+    assert(stat.f_block_size == BLOCK_SIZE && stat.f_blocks == BLOCK_COUNT &&
+           stat.f_inodes == INODE_COUNT);
+    assert(stat.f_blocks_free == BLOCK_COUNT - 1);
+    assert(stat.f_inodes_free == INODE_COUNT - 1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, 3 * BLOCK_SIZE) == 3 * BLOCK_SIZE);
+    assert(tfs_close(f) != -1);
+    tfs_statfs(&stat);
+    assert(stat.f_blocks_free == BLOCK_COUNT - 4);
+    assert(stat.f_inodes_free == INODE_COUNT - 2);
+
+    // a clone shares the blocks until one of them is written
+    assert(tfs_clone("/f1", "/f2") != -1);
+    tfs_statfs(&stat);
+    assert(stat.f_blocks_free == BLOCK_COUNT - 4);
+    assert(stat.f_inodes_free == INODE_COUNT - 3);
+    f = tfs_open("/f2", 0);
+    assert(f != -1);
+    assert(tfs_write(f, "x", 1) == 1);
+    assert(tfs_close(f) != -1);
+    tfs_statfs(&stat);
+    assert(stat.f_blocks_free == BLOCK_COUNT - 5);
+
+    // freed blocks count as free right away (even if still being reclaimed)
+    f = tfs_open("/f1", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    tfs_statfs(&stat);
+    assert(stat.f_blocks_free == BLOCK_COUNT - 4);
+    assert(stat.f_blocks_reclaiming <= 1);
+    assert(tfs_unlink("/f1") != -1);
+    assert(tfs_unlink("/f2") != -1);
+    tfs_statfs(&stat);
+    assert(stat.f_blocks_free == BLOCK_COUNT - 1);
+    assert(stat.f_inodes_free == INODE_COUNT - 1);
+
+    pthread_t threads[THREAD_COUNT];
+    int ids[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        ids[i] = i;
+        assert(pthread_create(&threads[i], NULL, churn, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    tfs_statfs(&stat);
+    assert(stat.f_blocks_free == BLOCK_COUNT - 1);
+    assert(stat.f_inodes_free == INODE_COUNT - 1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "fs/config.h"
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 4096 // 93 directory entries
+#define INODE_COUNT 90
+#define BLOCK_COUNT (3 * DATA_BLOCKS_CHUNK)
+#define OPEN_FILES (4 * OPEN_FILES_CHUNK + 3)
+#define THREAD_COUNT 4
+
+/* This test fills tables that start with one chunk of entries (inodes, data
+ * blocks and open files) past their first chunk, from several threads for
+ * the open file table, and checks that their entries did not move and that
+ * they stop growing at the maximum sizes. */
+
+static int handles[THREAD_COUNT][OPEN_FILES];
+static int handle_counts[THREAD_COUNT];
+
+static void *open_many(void *arg) {
+    int t = *(int *)arg;
+    int f;
+    while ((f = tfs_open("/f0", 0)) != -1) {
+        handles[t][handle_counts[t]++] = f;
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_inode_count = INODE_COUNT;
+    params.max_block_count = BLOCK_COUNT;
+    params.max_open_files_count = OPEN_FILES;
+    assert(tfs_init(&params) != -1);
+    tfs_instance_t *fs = tfs_default_instance();
+    inode_t *root = inode_get(fs, ROOT_DIR_INUM);
+
+    // inodes: all but the root's
+    static char names[INODE_COUNT][16];
+    char const *name_ptrs[INODE_COUNT];
+    int results[INODE_COUNT];
+    for (int i = 0; i < INODE_COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "/f%d", i);
+        name_ptrs[i] = names[i];
+    }
+    assert(tfs_create_many(name_ptrs, INODE_COUNT - 1, results) == 0);
+    assert(tfs_create_many(&name_ptrs[INODE_COUNT - 1], 1, results) == -1);
+    tfs_stat_t stat;
+    assert(tfs_stat(names[INODE_COUNT - 2], &stat) == 0);
+    assert(stat.st_inumber >= INODE_TABLE_CHUNK);
+    assert(inode_get(fs, ROOT_DIR_INUM) == root);
+
+    // data blocks: all but the root directory's, then one too many
+    static char buffer[BLOCK_COUNT * BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (char)(i % 251);
+    }
+    for (int i = 0; i < 2; i++) {
+        int f = tfs_open(names[i], 0);
+        assert(f != -1);
+        size_t len = (i == 0 ? BLOCK_COUNT / 2 : BLOCK_COUNT / 2 - 1) *
+                     BLOCK_SIZE;
+        assert(tfs_write(f, buffer, len) == len);
+        assert(tfs_close(f) != -1);
+    }
+    int f = tfs_open(names[2], 0);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, 1) == -1);
+    assert(tfs_close(f) != -1);
+    static char read_back[BLOCK_COUNT * BLOCK_SIZE];
+    f = tfs_open(names[0], 0);
+    assert(f != -1);
+    assert(tfs_read(f, read_back, sizeof(read_back)) ==
+           BLOCK_COUNT / 2 * BLOCK_SIZE);
+    assert(memcmp(read_back, buffer, BLOCK_COUNT / 2 * BLOCK_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+
+    // open files, from several threads at once
+    pthread_t threads[THREAD_COUNT];
+    int ids[THREAD_COUNT];
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        ids[t] = t;
+        assert(pthread_create(&threads[t], NULL, open_many, &ids[t]) == 0);
+    }
+    int total = 0;
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+        total += handle_counts[t];
+    }
+    assert(total == OPEN_FILES);
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        for (int i = 0; i < handle_counts[t]; i++) {
+            assert(tfs_close(handles[t][i]) != -1);
+        }
+    }
+
+    assert(inode_get(fs, ROOT_DIR_INUM) == root);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+    return 0;
+}
@@ -12,9 +12,10 @@ char const target_path1[] = "/f1";
 char const link_path1[] = "/l1";
 
 int check_hard_link_counter(char const *name) {
+    tfs_instance_t *fs = tfs_default_instance();
     int inum = tfs_lookup(name);
 
-    inode_t *inode = inode_get(inum);
+    inode_t *inode = inode_get(fs, inum);
 
     if (inode->i_hardlink_counter > 1)
         return 0;
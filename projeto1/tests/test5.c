@@ -38,6 +38,7 @@ void write_contents(char const *path) {
 
 int check_target_path_in_symLink(char const *link_path,
                                  char const *target_path) {
+    tfs_instance_t *fs = tfs_default_instance();
     int link_path_inum = tfs_lookup(link_path);
     if (link_path_inum == -1)
         return -1;
@@ -46,11 +47,11 @@ int check_target_path_in_symLink(char const *link_path,
     if (target_inum == -1)
         return -1;
 
-    inode_t *link_path_inode = inode_get(link_path_inum);
-    if (link_path_inode == NULL)
+    char const *link_path_target = inode_symlink_target(fs, link_path_inum);
+    if (link_path_target == NULL)
         return -1;
 
-    if (strcmp(link_path_inode->i_symlink_target, target_path) == 0)
+    if (strcmp(link_path_target, target_path) == 0)
         return 0;
     return -1;
 }
@@ -0,0 +1,183 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 1024 // 23 directory entries
+#define THREAD_COUNT 4
+#define FILE_COUNT 16
+#define ROUNDS 400
+#define REUSE_ROUNDS 500
+
+/* This test checks that the handles open on a file share it, each with its
+ * own offset, and that unlinking an open file only removes its name: it is
+ * still read and written through its handles, and is deleted (its inode and
+ * blocks freed) when the last of them is closed, also while other threads
+ * open, read and close it at the same time. A file opened by name is the
+ * file with that name, even while files are unlinked and created again, which
+ * reuses their inodes for other names. */
+
+static char contents[3 * BLOCK_SIZE];
+static char names[FILE_COUNT][16];
+
+static void *open_read_close(void *arg) {
+    (void)arg;
+    char buffer[sizeof(contents)];
+    for (int i = 0; i < ROUNDS; i++) {
+        int f = tfs_open(names[i % FILE_COUNT], 0);
+        if (f == -1) {
+            continue; // already unlinked
+        }
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(contents));
+        assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+// the contents of the file named names[i] are FILE_BYTE(i)
+#define FILE_BYTE(i) ((char)('A' + (i)))
+
+static void *open_check_close(void *arg) {
+    (void)arg;
+    char buffer[BLOCK_SIZE];
+    for (int i = 0; i < REUSE_ROUNDS * FILE_COUNT; i++) {
+        int n = i % FILE_COUNT;
+        int f = tfs_open(names[n], i % 3 == 0 ? TFS_O_TRUNC : 0);
+        if (f == -1) {
+            continue; // unlinked, not yet created again
+        }
+        ssize_t read = tfs_read(f, buffer, sizeof(buffer));
+        assert(read >= 0);
+        for (ssize_t b = 0; b < read; b++) {
+            assert(buffer[b] == FILE_BYTE(n));
+        }
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+static void *unlink_create(void *arg) {
+    int first = *(int *)arg;
+    char buffer[BLOCK_SIZE];
+    for (int r = 0; r < REUSE_ROUNDS; r++) {
+        // all unlinked before created again, so that names swap inodes
+        for (int n = first; n < FILE_COUNT; n += 2) {
+            assert(tfs_unlink(names[n]) != -1);
+        }
+        for (int n = first; n < FILE_COUNT; n += 2) {
+            memset(buffer, FILE_BYTE(n), sizeof(buffer));
+            int f = tfs_open(names[n], TFS_O_CREAT);
+            assert(f != -1);
+            assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+            assert(tfs_close(f) != -1);
+        }
+    }
+    return NULL;
+}
+
+static void *unlink_all(void *arg) {
+    (void)arg;
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_unlink(names[i]) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    tfs_statfs_t empty;
+    tfs_statfs(&empty);
+
+    // two handles on the same file, with their own offsets
+    int f1 = tfs_open("/f", TFS_O_CREAT);
+    assert(f1 != -1);
+    int f2 = tfs_open("/f", 0);
+    assert(f2 != -1 && f2 != f1);
+    assert(tfs_write(f1, contents, sizeof(contents)) == sizeof(contents));
+    char buffer[sizeof(contents)];
+    assert(tfs_read(f2, buffer, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(memcmp(buffer, contents, BLOCK_SIZE) == 0);
+
+    // unlinked while open: the name is gone, the file is not
+    assert(tfs_unlink("/f") != -1);
+    assert(tfs_lookup("/f") == -1);
+    assert(tfs_open("/f", 0) == -1);
+    tfs_statfs_t stat;
+    tfs_statfs(&stat);
+    assert(stat.f_inodes_free == empty.f_inodes_free - 1);
+    assert(tfs_read(f2, buffer, sizeof(buffer)) == 2 * BLOCK_SIZE);
+    assert(memcmp(buffer, contents + BLOCK_SIZE, 2 * BLOCK_SIZE) == 0);
+    assert(tfs_write(f1, contents, BLOCK_SIZE) == BLOCK_SIZE);
+
+    // a new file with the same name is another file
+    int f3 = tfs_open("/f", TFS_O_CREAT);
+    assert(f3 != -1);
+    assert(tfs_read(f3, buffer, sizeof(buffer)) == 0);
+    assert(tfs_close(f3) != -1);
+    assert(tfs_unlink("/f") != -1);
+
+    // deleted with its last handle
+    assert(tfs_close(f1) != -1);
+    tfs_statfs(&stat);
+    assert(stat.f_inodes_free == empty.f_inodes_free - 1);
+    assert(tfs_close(f2) != -1);
+    tfs_statfs(&stat);
+    assert(stat.f_inodes_free == empty.f_inodes_free);
+    assert(stat.f_blocks_free == empty.f_blocks_free);
+
+    // opened, read and closed while being unlinked
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "/s%d", i);
+        int f = tfs_open(names[i], TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+        assert(tfs_close(f) != -1);
+    }
+    pthread_t threads[THREAD_COUNT];
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        assert(pthread_create(&threads[t], NULL,
+                              t == 0 ? unlink_all : open_read_close,
+                              NULL) == 0);
+    }
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+    tfs_statfs(&stat);
+    assert(stat.f_inodes_free == empty.f_inodes_free);
+    assert(stat.f_blocks_free == empty.f_blocks_free);
+
+    // opened while unlinked and created again, with inodes reused by others
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "/r%d", i);
+        int f = tfs_open(names[i], TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    int firsts[2] = {0, 1};
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        assert(pthread_create(&threads[t], NULL,
+                              t < 2 ? unlink_create : open_check_close,
+                              t < 2 ? &firsts[t] : NULL) == 0);
+    }
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_unlink(names[i]) != -1);
+    }
+    tfs_statfs(&stat);
+    assert(stat.f_inodes_free == empty.f_inodes_free);
+    assert(stat.f_blocks_free == empty.f_blocks_free);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+}
@@ -0,0 +1,118 @@
+#include "fs/config.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 256
+#define BLOCK_COUNT 32 // more than WRITE_BUFFER_SIZE bytes
+#define ROUNDS 100
+#define RACE_WRITES 1000
+
+/* This test writes small appends through a buffered file handle, and checks
+ * when they become visible to other handles: on tfs_flush, when the buffer
+ * fills up, before a read on the same handle, and on tfs_close. It also
+ * checks that running out of space is reported when flushing, and that
+ * closing a handle while another thread writes to it keeps every write that
+ * succeeded. */
+
+char const path[] = "/f1";
+
+static size_t file_size(void) {
+    char buffer[BLOCK_COUNT * BLOCK_SIZE];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    ssize_t r = tfs_read(f, buffer, sizeof(buffer));
+    assert(r != -1);
+    assert(tfs_close(f) != -1);
+    return (size_t)r;
+}
+
+static int race_handle;
+
+void *race_write_fn(void *arg) {
+    size_t *written = arg;
+    for (int i = 0; i < RACE_WRITES; i++) {
+        ssize_t w = tfs_write(race_handle, "w", 1);
+        if (w == -1) {
+            break; // closed
+        }
+        assert(w == 1);
+        (*written)++;
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_BUFFERED);
+    assert(f != -1);
+
+    // small writes stay in the buffer until flushed
+    for (int i = 0; i < 10; i++) {
+        assert(tfs_write(f, "0123456789ABCDEF", 16) == 16);
+    }
+    assert(file_size() == 0);
+    assert(tfs_flush(f) == 0);
+    assert(file_size() == 160);
+    assert(tfs_flush(f) == 0); // nothing left to flush
+
+    // reading on the same handle sees its own writes
+    assert(tfs_write(f, "xyz", 3) == 3);
+    char buffer[16];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 0); // at the end of file
+    assert(file_size() == 163);
+
+    // closing flushes
+    assert(tfs_write(f, "END", 3) == 3);
+    assert(tfs_close(f) != -1);
+    assert(file_size() == 166);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, 16) == 16);
+    assert(memcmp(buffer, "0123456789ABCDEF", 16) == 0);
+    assert(tfs_close(f) != -1);
+
+    // a full buffer is written before buffering more; a write larger than
+    // the buffer goes straight to the file
+    f = tfs_open(path, TFS_O_TRUNC | TFS_O_BUFFERED);
+    assert(f != -1);
+    char big[BLOCK_COUNT * BLOCK_SIZE];
+    memset(big, 'B', sizeof(big));
+    assert(tfs_write(f, big, 100) == 100);
+    assert(tfs_write(f, big, WRITE_BUFFER_SIZE) == WRITE_BUFFER_SIZE);
+    assert(file_size() == 100 + WRITE_BUFFER_SIZE);
+
+    // buffered bytes that do not fit are reported when flushed (the root
+    // directory takes one block)
+    size_t space = (BLOCK_COUNT - 1) * BLOCK_SIZE - 100 - WRITE_BUFFER_SIZE;
+    assert(space < WRITE_BUFFER_SIZE);
+    assert(tfs_write(f, big, space + 1) == space + 1);
+    assert(tfs_close(f) == -1);
+
+    // the bytes of the writes that returned before the close are flushed by
+    // it, the others fail
+    for (int round = 0; round < ROUNDS; round++) {
+        race_handle = tfs_open(path, TFS_O_TRUNC | TFS_O_BUFFERED);
+        assert(race_handle != -1);
+        size_t written = 0;
+        pthread_t writer;
+        assert(pthread_create(&writer, NULL, race_write_fn, &written) == 0);
+        assert(tfs_close(race_handle) != -1);
+        assert(pthread_join(writer, NULL) == 0);
+        assert(file_size() == written);
+        assert(tfs_close(race_handle) == -1); // already closed
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define THREAD_NUM 4
+#define DURATION_SEC 2
+#define MESSAGE_SIZE 32
+
+/* This benchmark runs the broker's publish path (open the box with
+ * TFS_O_APPEND, write one message, close it) from several publisher threads
+ * twice: first with every publisher on the same box, and then with each one on
+ * a box of its own. A full box is emptied by opening it with TFS_O_TRUNC.
+ *
+ * Build it (the simulated storage delay is what the locks serialize; add
+ * EXTRA_CFLAGS=-DDELAY=0 to measure the locking overhead alone):
+ *   make clean && make bench */
+
+static atomic_bool running;
+
+typedef struct {
+    char const *box;
+    _Alignas(64) size_t messages;
+} publisher_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *publisher_fn(void *arg) {
+    publisher_t *publisher = (publisher_t *)arg;
+    char message[MESSAGE_SIZE];
+    memset(message, 'm', sizeof(message));
+
+    while (atomic_load(&running)) {
+        int box = tfs_open(publisher->box, TFS_O_APPEND);
+        assert(box != -1);
+        ssize_t written = tfs_write(box, message, sizeof(message));
+        assert(written != -1);
+        assert(tfs_close(box) != -1);
+
+        if (written < (ssize_t)sizeof(message)) {
+            box = tfs_open(publisher->box, TFS_O_TRUNC);
+            assert(box != -1);
+            assert(tfs_close(box) != -1);
+        } else {
+            publisher->messages++;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Runs the publishers, the i-th one on boxes[i], and returns the messages
+ * published per second
+ */
+static double run(char const *const *boxes) {
+    pthread_t tid[THREAD_NUM];
+    publisher_t publishers[THREAD_NUM] = {0};
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        int box = tfs_open(boxes[i], TFS_O_CREAT | TFS_O_TRUNC);
+        assert(box != -1);
+        assert(tfs_close(box) != -1);
+    }
+
+    atomic_store(&running, true);
+    double start = now();
+    for (int i = 0; i < THREAD_NUM; i++) {
+        publishers[i].box = boxes[i];
+        assert(pthread_create(&tid[i], NULL, publisher_fn, &publishers[i]) ==
+               0);
+    }
+
+    struct timespec duration = {.tv_sec = DURATION_SEC};
+    nanosleep(&duration, NULL);
+    atomic_store(&running, false);
+
+    size_t messages = 0;
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+        messages += publishers[i].messages;
+    }
+    return (double)messages / (now() - start);
+}
+
+int main() {
+    char const *same_box[THREAD_NUM];
+    char const *own_box[THREAD_NUM] = {"/box0", "/box1", "/box2", "/box3"};
+    for (int i = 0; i < THREAD_NUM; i++) {
+        same_box[i] = own_box[0];
+    }
+
+    assert(tfs_init(NULL) != -1);
+    double same_rate = run(same_box);
+    double own_rate = run(own_box);
+    assert(tfs_destroy() != -1);
+
+    printf("publishers: %d\n", THREAD_NUM);
+    printf("same box: %.0f messages/s\n", same_rate);
+    printf("one box per publisher: %.0f messages/s\n", own_rate);
+    return 0;
+}
@@ -6,6 +6,10 @@
 
 #define MAX_FILE_NAME (40)
 
+// Simulated storage access latency (busy loop iterations, see insert_delay)
+// can be overridden at build time, e.g. -DDELAY=0 for benchmarks
+#ifndef DELAY
 #define DELAY (5000)
+#endif
 
 #endif // CONFIG_H
@@ -1,7 +1,6 @@
 #include "operations.h"
 #include "config.h"
 #include "state.h"
-#include <errno.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -10,8 +9,6 @@
 
 #include "betterassert.h"
 
-pthread_mutex_t g_library_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 tfs_params tfs_default_params() {
     tfs_params params = {
         .max_inode_count = 64,
@@ -77,19 +74,20 @@ static int tfs_lookup(char const *name, inode_t const *root_inode) {
 }
 
 int tfs_open(char const *name, tfs_file_mode_t mode) {
-    if (pthread_mutex_lock(&g_library_mutex) == -1) {
-        WARN("failed to lock mutex: %s", strerror(errno));
-        return -1;
-    }
     // Checks if the path name is valid
     if (!valid_pathname(name)) {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
         return -1;
     }
 
+    // only creating a file changes the root directory, so opening existing
+    // files (e.g. publishing to a box) only takes it for reading
+    pthread_rwlock_t *root_lock = get_inode_table_lock(ROOT_DIR_INUM);
+    if (mode & TFS_O_CREAT) {
+        write_lock_rwlock(root_lock);
+    } else {
+        read_lock_rwlock(root_lock);
+    }
+
     inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
     ALWAYS_ASSERT(root_dir_inode != NULL,
                   "tfs_open: root dir inode must exist");
@@ -102,6 +100,13 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
         ALWAYS_ASSERT(inode != NULL,
                       "tfs_open: directory files must have an inode");
 
+        pthread_rwlock_t *inode_lock = get_inode_table_lock(inum);
+        if (mode & TFS_O_TRUNC) {
+            write_lock_rwlock(inode_lock);
+        } else {
+            read_lock_rwlock(inode_lock);
+        }
+
         // Truncate (if requested)
         if (mode & TFS_O_TRUNC) {
             if (inode->i_size > 0) {
@@ -115,44 +120,34 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
         } else {
             offset = 0;
         }
+        unlock_rwlock(inode_lock);
     } else if (mode & TFS_O_CREAT) {
         // The file does not exist; the mode specified that it should be created
         // Create inode
         inum = inode_create(T_FILE);
         if (inum == -1) {
-            if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-                WARN("failed to unlock mutex: %s", strerror(errno));
-                return -1;
-            }
+            unlock_rwlock(root_lock);
             return -1; // no space in inode table
         }
 
         // Add entry in the root directory
         if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
             inode_delete(inum);
-            if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-                WARN("failed to unlock mutex: %s", strerror(errno));
-                return -1;
-            }
+            unlock_rwlock(root_lock);
             return -1; // no space in directory
         }
 
         offset = 0;
     } else {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
+        unlock_rwlock(root_lock);
         return -1;
     }
 
     // Finally, add entry to the open file table and return the corresponding
-    // handle
+    // handle (still holding the root directory, so that the file cannot be
+    // unlinked before it is open)
     int ret = add_to_open_file_table(inum, offset);
-    if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-        WARN("failed to unlock mutex: %s", strerror(errno));
-        return -1;
-    }
+    unlock_rwlock(root_lock);
     return ret;
 
     // Note: for simplification, if file was created with TFS_O_CREAT and there
@@ -161,45 +156,32 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
 }
 
 int tfs_close(int fhandle) {
-    if (pthread_mutex_lock(&g_library_mutex) == -1) {
-        WARN("failed to lock mutex: %s", strerror(errno));
-        return -1;
-    }
+    // waits for any operation in progress on the handle
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
-        return -1; // invalid fd
+        return -1; // invalid fd, or already closed
     }
 
+    pthread_mutex_t *file_lock = get_open_file_table_lock(fhandle);
     remove_from_open_file_table(fhandle);
+    unlock_mutex(file_lock);
 
-    if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-        WARN("failed to unlock mutex: %s", strerror(errno));
-        return -1;
-    }
     return 0;
 }
 
 ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    if (pthread_mutex_lock(&g_library_mutex) == -1) {
-        WARN("failed to lock mutex: %s", strerror(errno));
-        return -1;
-    }
+    // locks the handle, so that it is not closed while in use
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
         return -1;
     }
+    pthread_mutex_t *file_lock = get_open_file_table_lock(fhandle);
 
     //  From the open file table entry, we get the inode
     inode_t *inode = inode_get(file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(file->of_inumber);
+    write_lock_rwlock(inode_lock);
 
     // Determine how many bytes to write
     size_t block_size = state_block_size();
@@ -212,10 +194,8 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
             // If empty file, allocate new block
             int bnum = data_block_alloc();
             if (bnum == -1) {
-                if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-                    WARN("failed to unlock mutex: %s", strerror(errno));
-                    return -1;
-                }
+                unlock_rwlock(inode_lock);
+                unlock_mutex(file_lock);
                 return -1; // no space
             }
 
@@ -235,30 +215,24 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
         }
     }
 
-    if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-        WARN("failed to unlock mutex: %s", strerror(errno));
-        return -1;
-    }
+    unlock_rwlock(inode_lock);
+    unlock_mutex(file_lock);
     return (ssize_t)to_write;
 }
 
 ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    if (pthread_mutex_lock(&g_library_mutex) == -1) {
-        WARN("failed to lock mutex: %s", strerror(errno));
-        return -1;
-    }
+    // locks the handle, so that it is not closed while in use
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
         return -1;
     }
+    pthread_mutex_t *file_lock = get_open_file_table_lock(fhandle);
 
     // From the open file table entry, we get the inode
     inode_t const *inode = inode_get(file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(file->of_inumber);
+    read_lock_rwlock(inode_lock);
 
     // Determine how many bytes to read
     size_t to_read = inode->i_size - file->of_offset;
@@ -276,53 +250,41 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
         file->of_offset += to_read;
     }
 
-    if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-        WARN("failed to unlock mutex: %s", strerror(errno));
-        return -1;
-    }
+    unlock_rwlock(inode_lock);
+    unlock_mutex(file_lock);
     return (ssize_t)to_read;
 }
 
 int tfs_unlink(char const *target) {
-    if (pthread_mutex_lock(&g_library_mutex) == -1) {
-        WARN("failed to lock mutex: %s", strerror(errno));
-        return -1;
-    }
     // Checks if the path name is valid
     if (!valid_pathname(target)) {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
         return -1;
     }
 
+    pthread_rwlock_t *root_lock = get_inode_table_lock(ROOT_DIR_INUM);
+    write_lock_rwlock(root_lock);
+
     inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
     ALWAYS_ASSERT(root_dir_inode != NULL,
                   "tfs_open: root dir inode must exist");
     int inum = tfs_lookup(target, root_dir_inode);
 
     if (inum == -1) {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
+        unlock_rwlock(root_lock);
         return -1;
     }
 
+    // waits for the writes and reads in progress on the file
+    pthread_rwlock_t *inode_lock = get_inode_table_lock(inum);
+    write_lock_rwlock(inode_lock);
     inode_delete(inum);
-    if (clear_dir_entry(root_dir_inode, target + 1) == -1) {
-        if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-            WARN("failed to unlock mutex: %s", strerror(errno));
-            return -1;
-        }
-        return -1;
-    }
+    unlock_rwlock(inode_lock);
 
-    if (pthread_mutex_unlock(&g_library_mutex) == -1) {
-        WARN("failed to unlock mutex: %s", strerror(errno));
+    if (clear_dir_entry(root_dir_inode, target + 1) == -1) {
+        unlock_rwlock(root_lock);
         return -1;
     }
 
+    unlock_rwlock(root_lock);
     return 0;
 }
@@ -28,6 +28,16 @@ static allocation_state_t *free_blocks;
 static open_file_entry_t *open_file_table;
 static allocation_state_t *free_open_file_entries;
 
+/*
+ * Locks: one per inode and one per open file entry, plus a mutex for each
+ * allocation map (they are only held while scanning or updating the map)
+ */
+static pthread_rwlock_t *inode_table_locks;
+static pthread_mutex_t *open_file_table_locks;
+static pthread_mutex_t free_inodes_lock;
+static pthread_mutex_t free_blocks_lock;
+static pthread_mutex_t free_open_file_entries_lock;
+
 // Convenience macros
 #define INODE_TABLE_SIZE (fs_params.max_inode_count)
 #define DATA_BLOCKS (fs_params.max_block_count)
@@ -49,6 +59,16 @@ static inline bool valid_file_handle(int file_handle) {
 
 size_t state_block_size(void) { return BLOCK_SIZE; }
 
+/* Returns the lock associated with the given inumber */
+pthread_rwlock_t *get_inode_table_lock(int inumber) {
+    return &inode_table_locks[inumber];
+}
+
+/* Returns the lock associated with the given file handle */
+pthread_mutex_t *get_open_file_table_lock(int file_handle) {
+    return &open_file_table_locks[file_handle];
+}
+
 /**
  * Do nothing, while preventing the compiler from performing any optimizations.
  *
@@ -80,6 +100,87 @@ static void insert_delay(void) {
     }
 }
 
+/*
+ * Locks (and checks for errors) a given mutex
+ */
+void lock_mutex(pthread_mutex_t *mutex) {
+    if (pthread_mutex_lock(mutex) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Read-locks (and checks for errors) a given rwlock
+ */
+void read_lock_rwlock(pthread_rwlock_t *rwlock) {
+    if (pthread_rwlock_rdlock(rwlock) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Write-locks (and checks for errors) a given rwlock
+ */
+void write_lock_rwlock(pthread_rwlock_t *rwlock) {
+    if (pthread_rwlock_wrlock(rwlock) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Unlocks (and checks for errors) a given mutex
+ */
+void unlock_mutex(pthread_mutex_t *mutex) {
+    if (pthread_mutex_unlock(mutex) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Unlocks (and checks for errors) a given rwlock
+ */
+void unlock_rwlock(pthread_rwlock_t *rwlock) {
+    if (pthread_rwlock_unlock(rwlock) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Initializes (and checks for errors) a given mutex
+ */
+static void init_mutex(pthread_mutex_t *mutex) {
+    if (pthread_mutex_init(mutex, NULL) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Initializes (and checks for errors) a given rwlock
+ */
+static void init_rwlock(pthread_rwlock_t *rwlock) {
+    if (pthread_rwlock_init(rwlock, NULL) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Destroys (and checks for errors) a given mutex
+ */
+static void destroy_mutex(pthread_mutex_t *mutex) {
+    if (pthread_mutex_destroy(mutex) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Destroys (and checks for errors) a given rwlock
+ */
+static void destroy_rwlock(pthread_rwlock_t *rwlock) {
+    if (pthread_rwlock_destroy(rwlock) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
 /**
  * Initialize FS state.
  *
@@ -106,14 +207,18 @@ int state_init(tfs_params params) {
     open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
     free_open_file_entries =
         malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
+    inode_table_locks = malloc(INODE_TABLE_SIZE * sizeof(pthread_rwlock_t));
+    open_file_table_locks = malloc(MAX_OPEN_FILES * sizeof(pthread_mutex_t));
 
     if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !open_file_table || !free_open_file_entries) {
+        !open_file_table || !free_open_file_entries || !inode_table_locks ||
+        !open_file_table_locks) {
         return -1; // allocation failed
     }
 
     for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
         freeinode_ts[i] = FREE;
+        init_rwlock(&inode_table_locks[i]);
     }
 
     for (size_t i = 0; i < DATA_BLOCKS; i++) {
@@ -122,8 +227,13 @@ int state_init(tfs_params params) {
 
     for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
         free_open_file_entries[i] = FREE;
+        init_mutex(&open_file_table_locks[i]);
     }
 
+    init_mutex(&free_inodes_lock);
+    init_mutex(&free_blocks_lock);
+    init_mutex(&free_open_file_entries_lock);
+
     return 0;
 }
 
@@ -133,12 +243,24 @@ int state_init(tfs_params params) {
  * Returns 0 if succesful, -1 otherwise.
  */
 int state_destroy(void) {
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        destroy_rwlock(&inode_table_locks[i]);
+    }
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        destroy_mutex(&open_file_table_locks[i]);
+    }
+    destroy_mutex(&free_inodes_lock);
+    destroy_mutex(&free_blocks_lock);
+    destroy_mutex(&free_open_file_entries_lock);
+
     free(inode_table);
     free(freeinode_ts);
     free(fs_data);
     free(free_blocks);
     free(open_file_table);
     free(free_open_file_entries);
+    free(inode_table_locks);
+    free(open_file_table_locks);
 
     inode_table = NULL;
     freeinode_ts = NULL;
@@ -146,6 +268,8 @@ int state_destroy(void) {
     free_blocks = NULL;
     open_file_table = NULL;
     free_open_file_entries = NULL;
+    inode_table_locks = NULL;
+    open_file_table_locks = NULL;
 
     return 0;
 }
@@ -160,6 +284,7 @@ int state_destroy(void) {
  *   - No free slots in inode table.
  */
 static int inode_alloc(void) {
+    lock_mutex(&free_inodes_lock);
     for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
         if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
             insert_delay(); // simulate storage access delay (to freeinode_ts)
@@ -169,10 +294,12 @@ static int inode_alloc(void) {
         if (freeinode_ts[inumber] == FREE) {
             //  Found a free entry, so takes it for the new inode
             freeinode_ts[inumber] = TAKEN;
+            unlock_mutex(&free_inodes_lock);
 
             return (int)inumber;
         }
     }
+    unlock_mutex(&free_inodes_lock);
 
     // no free inodes
     return -1;
@@ -256,14 +383,15 @@ void inode_delete(int inumber) {
 
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
 
-    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
-                  "inode_delete: inode already freed");
-
     if (inode_table[inumber].i_size > 0) {
         data_block_free(inode_table[inumber].i_data_block);
     }
 
+    lock_mutex(&free_inodes_lock);
+    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
+                  "inode_delete: inode already freed");
     freeinode_ts[inumber] = FREE;
+    unlock_mutex(&free_inodes_lock);
 }
 
 /**
@@ -284,6 +412,8 @@ inode_t *inode_get(int inumber) {
 /**
  * Clear the directory entry associated with a sub file.
  *
+ * The caller must hold the directory's inode lock for writing.
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
@@ -318,6 +448,8 @@ int clear_dir_entry(inode_t *inode, char const *sub_name) {
 /**
  * Store the inumber for a sub file in a directory.
  *
+ * The caller must hold the directory's inode lock for writing.
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
@@ -362,6 +494,8 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
 /**
  * Obtain the inumber for a sub file inside a directory.
  *
+ * The caller must hold the directory's inode lock (at least for reading).
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
@@ -408,6 +542,7 @@ int find_in_dir(inode_t const *inode, char const *sub_name) {
  *   - No free data blocks.
  */
 int data_block_alloc(void) {
+    lock_mutex(&free_blocks_lock);
     for (size_t i = 0; i < DATA_BLOCKS; i++) {
         if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
             insert_delay(); // simulate storage access delay to free_blocks
@@ -415,10 +550,12 @@ int data_block_alloc(void) {
 
         if (free_blocks[i] == FREE) {
             free_blocks[i] = TAKEN;
+            unlock_mutex(&free_blocks_lock);
 
             return (int)i;
         }
     }
+    unlock_mutex(&free_blocks_lock);
     return -1;
 }
 
@@ -434,7 +571,9 @@ void data_block_free(int block_number) {
 
     insert_delay(); // simulate storage access delay to free_blocks
 
+    lock_mutex(&free_blocks_lock);
     free_blocks[block_number] = FREE;
+    unlock_mutex(&free_blocks_lock);
 }
 
 /**
@@ -466,15 +605,23 @@ void *data_block_get(int block_number) {
  *   - No space in open file table for a new open file.
  */
 int add_to_open_file_table(int inumber, size_t offset) {
+    lock_mutex(&free_open_file_entries_lock);
     for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
+        // the entry is initialised under its lock, as it is used; if the lock
+        // is busy (the entry is being closed, or used through a stale handle)
+        // the entry is skipped, as waiting for it would invert the lock order
+        if (free_open_file_entries[i] == FREE &&
+            pthread_mutex_trylock(&open_file_table_locks[i]) == 0) {
             free_open_file_entries[i] = TAKEN;
             open_file_table[i].of_inumber = inumber;
             open_file_table[i].of_offset = offset;
+            unlock_mutex(&open_file_table_locks[i]);
+            unlock_mutex(&free_open_file_entries_lock);
 
             return i;
         }
     }
+    unlock_mutex(&free_open_file_entries_lock);
 
     return -1;
 }
@@ -483,33 +630,43 @@ int add_to_open_file_table(int inumber, size_t offset) {
  * Free an entry from the open file table.
  *
  * Input:
- *   - fhandle: file handle to free/close
+ *   - fhandle: file handle to free/close, whose entry was obtained (and is
+ *     still locked) by get_open_file_entry
  */
 void remove_from_open_file_table(int fhandle) {
     ALWAYS_ASSERT(valid_file_handle(fhandle),
                   "remove_from_open_file_table: file handle must be valid");
 
+    lock_mutex(&free_open_file_entries_lock);
     ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
                   "remove_from_open_file_table: file handle must be taken");
 
     free_open_file_entries[fhandle] = FREE;
+    unlock_mutex(&free_open_file_entries_lock);
 }
 
 /**
- * Obtain pointer to a given entry in the open file table.
+ * Obtain pointer to a given entry in the open file table, and lock it.
+ *
+ * The entry's lock (see get_open_file_table_lock) is taken before checking
+ * that the entry is open, so that it is not closed (or reused) while in use;
+ * the caller must unlock it when done with the entry.
  *
  * Input:
  *   - fhandle: file handle
  *
- * Returns pointer to the entry, or NULL if the fhandle is invalid/closed/never
- * opened.
+ * Returns pointer to the (locked) entry, or NULL if the fhandle is
+ * invalid/closed/never opened.
  */
 open_file_entry_t *get_open_file_entry(int fhandle) {
     if (!valid_file_handle(fhandle)) {
         return NULL;
     }
 
+    pthread_mutex_t *file_lock = get_open_file_table_lock(fhandle);
+    lock_mutex(file_lock);
     if (free_open_file_entries[fhandle] != TAKEN) {
+        unlock_mutex(file_lock);
         return NULL;
     }
 
@@ -4,6 +4,7 @@
 #include "config.h"
 #include "operations.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +42,24 @@ typedef struct {
     size_t of_offset;
 } open_file_entry_t;
 
+/*
+ * Lock ordering: an operation that takes more than one lock takes the root
+ * directory's inode lock first, then a file handle's lock, then the file's
+ * inode lock. The allocation maps' mutexes are only held inside state.c, never
+ * nest (a free file handle's lock is only tried, without waiting, while
+ * holding the open file table's map) and may be taken while holding any of the
+ * above, so publishes to different boxes only share the (read-locked) root
+ * directory.
+ */
+pthread_rwlock_t *get_inode_table_lock(int inumber);
+pthread_mutex_t *get_open_file_table_lock(int file_handle);
+
+void lock_mutex(pthread_mutex_t *mutex);
+void read_lock_rwlock(pthread_rwlock_t *rwlock);
+void write_lock_rwlock(pthread_rwlock_t *rwlock);
+void unlock_mutex(pthread_mutex_t *mutex);
+void unlock_rwlock(pthread_rwlock_t *rwlock);
+
 int state_init(tfs_params);
 int state_destroy(void);
 